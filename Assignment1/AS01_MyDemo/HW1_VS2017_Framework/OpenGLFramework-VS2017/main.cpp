@@ -2,15 +2,23 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
 #include <math.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "textfile.h"
+#include "objfile.h"
 
 #include "Vectors.h"
 #include "Matrices.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
+#include "meshcache.h"
 
 #ifndef max
 # define max(a,b) (((a)>(b))?(a):(b))
@@ -31,6 +39,35 @@ bool mouse_pressed = false;
 int starting_press_x = -1;
 int starting_press_y = -1;
 
+// Render on demand: a frame is drawn only once something has changed what
+// it shows, otherwise the loop sleeps in glfwWaitEventsTimeout and the last
+// frame stays on screen. --continuous draws every iteration, for timing
+// the frame itself.
+bool render_on_demand = true;
+bool scene_dirty = true; // the frame on screen is out of date
+// Longest sleep of the idle loop; input wakes it at once, so this is only
+// a backstop and may be long
+const double kIdleWait = 0.5; // seconds
+
+// --loop-stats: the main thread's time outside the event wait, which is
+// what the loop costs the CPU, and the frames drawn, printed at exit
+chrono::steady_clock::time_point loop_start;
+double loop_busy_ms = 0.0;
+int loop_wakeups = 0, loop_frames = 0;
+
+void PrintRenderLoopStats()
+{
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - loop_start).count();
+	printf("Render loop (%s): %d frames in %.1f s (%.1f per second), %d wakeups, main thread busy %.1f%% of the time\n",
+		render_on_demand ? "on demand" : "continuous", loop_frames, seconds, loop_frames / seconds, loop_wakeups, 100.0 * loop_busy_ms / (seconds * 1000.0));
+}
+
+// The window system lost the frame on screen, as when the window is uncovered
+void WindowRefresh(GLFWwindow*)
+{
+	scene_dirty = true;
+}
+
 enum TransMode
 {
 	GeoTranslation = 0,
@@ -98,7 +135,14 @@ typedef struct
 Shape quad;
 Shape m_shpae;
 vector<Shape> m_shape_list;
+// Mesh cache tag, bump when normalization() or the streams uploaded change
+const char* MESH_CACHE_TAG = "as01v1";
+// Workers preparing model_list at startup, 0 = one per core (--load-threads N)
+unsigned int load_threads = 0;
+// Cleared by --no-mesh-cache: always parse the .obj and write no cache
+bool use_mesh_cache = true;
 int cur_idx = 0; // represent which model should be rendered now
+vector<string> model_list{ "../ColorModels/bunny5KC.obj", "../ColorModels/dragon10KC.obj", "../ColorModels/lucy25KC.obj", "../ColorModels/teapot4KC.obj", "../ColorModels/dolphinC.obj" };
 
 
 static GLvoid Normalize(GLfloat v[3])
@@ -268,6 +312,7 @@ void ChangeSize(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 	// [TODO] change your aspect ratio
 	proj.aspect = (float)width / (float)height;
+	scene_dirty = true;
 
 	//Perspective view(人眼視角需要aspect)
 	if (cur_proj_mode == Perspective) {
@@ -373,6 +418,7 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 {
 	// [TODO] Call back function for keyboard
 	if (action == GLFW_PRESS) {
+		scene_dirty = true;
 		switch (key) {
 		case GLFW_KEY_ESCAPE: 
 			exit(0); 
@@ -446,6 +492,7 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
 	// [TODO] scroll up positive, otherwise it would be negtive
+	scene_dirty = true;
 	if (yoffset > 0) {
 		switch (cur_trans_mode) {
 		case GeoTranslation: 
@@ -524,6 +571,7 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 	int delta_y = ypos - starting_press_y;
 
 	if (mouse_pressed) {
+		scene_dirty = true;
 		switch (cur_trans_mode) {
 		case GeoTranslation: 
 			models[cur_idx].position.x += delta_x * 0.002;
@@ -566,20 +614,23 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 void setShaders()
 {
 	GLuint v, f, p;
-	char *vs = NULL;
-	char *fs = NULL;
+	MappedFile vs_file, fs_file;
 
 	v = glCreateShader(GL_VERTEX_SHADER);
 	f = glCreateShader(GL_FRAGMENT_SHADER);
 
-	vs = textFileRead("shader.vs");
-	fs = textFileRead("shader.fs");
-
-	glShaderSource(v, 1, (const GLchar**)&vs, NULL);
-	glShaderSource(f, 1, (const GLchar**)&fs, NULL);
+	if (!vs_file.Open("shader.vs"))
+		cout << "The file \"shader.vs\" was not opened" << endl;
+	if (!fs_file.Open("shader.fs"))
+		cout << "The file \"shader.fs\" was not opened" << endl;
 
-	free(vs);
-	free(fs);
+	// The sources are passed with their lengths, so the mappings need no '\0'
+	const GLchar* vs = vs_file.data();
+	const GLchar* fs = fs_file.data();
+	GLint vs_length = (GLint)vs_file.size();
+	GLint fs_length = (GLint)fs_file.size();
+	glShaderSource(v, 1, &vs, &vs_length);
+	glShaderSource(f, 1, &fs, &fs_length);
 
 	GLint success;
 	char infoLog[1000];
@@ -750,18 +801,24 @@ void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<
 	}
 }
 
-void LoadModels(string model_path)
+string GetBaseDir(const string& filepath) {
+	if (filepath.find_last_of("/\\") != std::string::npos)
+		return filepath.substr(0, filepath.find_last_of("/\\"));
+	return "";
+}
+
+// Parse model_path and build the streams LoadModels uploads, on
+// parse_threads threads (LoadObjFile's num_threads)
+bool BuildModelData(const string& model_path, MeshCacheData& data, unsigned int parse_threads = 0)
 {
 	vector<tinyobj::shape_t> shapes;
 	vector<tinyobj::material_t> materials;
 	tinyobj::attrib_t attrib;
-	vector<GLfloat> vertices;
-	vector<GLfloat> colors;
 
 	string err;
 	string warn;
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str());
+	bool ret = LoadObjFile(&attrib, &shapes, &materials, &warn, &err, model_path, "", parse_threads);
 
 	if (!warn.empty()) {
 		cout << warn << std::endl;
@@ -772,12 +829,52 @@ void LoadModels(string model_path)
 	}
 
 	if (!ret) {
-		exit(1);
+		return false;
 	}
 
 	printf("Load Models Success ! Shapes size %d Maerial size %d\n", shapes.size(), materials.size());
 
-	normalization(&attrib, vertices, colors, &shapes[0]);
+	MeshCacheShape shape;
+	shape.name = shapes[0].name;
+	shape.material_id = -1;
+	normalization(&attrib, shape.streams[MESHCACHE_POSITION], shape.streams[MESHCACHE_COLOR], &shapes[0]);
+
+	data.shapes.push_back(shape);
+	return true;
+}
+
+// Everything LoadModels needs from the disk, ready for the GL upload
+struct PreparedModel
+{
+	MappedFile cache_file;
+	MeshCacheData data;
+	MeshCacheView view;
+	bool ok = false;
+};
+
+// CPU half of LoadModels: maps the mesh cache or builds (and caches) the
+// streams from the .obj. Touches no GL state, so it may run on any thread.
+bool PrepareModel(const string& model_path, PreparedModel& prepared, unsigned int parse_threads = 0)
+{
+	string cache_path = MeshCachePath(model_path, MESH_CACHE_TAG);
+
+	if (!use_mesh_cache || !ReadMeshCache(cache_path, model_path, MESH_CACHE_TAG, &prepared.cache_file, &prepared.view))
+	{
+		if (!BuildModelData(model_path, prepared.data, parse_threads)) {
+			return false;
+		}
+		if (use_mesh_cache && !WriteMeshCache(cache_path, model_path, MESH_CACHE_TAG, prepared.data)) {
+			cout << "LoadModels: Cannot write mesh cache " << cache_path << endl;
+		}
+		MakeMeshCacheView(prepared.data, &prepared.view);
+	}
+	return true;
+}
+
+// GL half of LoadModels, appends the model to m_shape_list and models
+void UploadPreparedModel(const PreparedModel& prepared)
+{
+	const MeshCacheShapeView& shape = prepared.view.shapes[0];
 
 	Shape tmp_shape;
 	glGenVertexArrays(1, &tmp_shape.vao);
@@ -785,13 +882,13 @@ void LoadModels(string model_path)
 
 	glGenBuffers(1, &tmp_shape.vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GL_FLOAT), &vertices.at(0), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, shape.stream_sizes[MESHCACHE_POSITION] * sizeof(GLfloat), shape.streams[MESHCACHE_POSITION], GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	tmp_shape.vertex_count = vertices.size() / 3;
+	tmp_shape.vertex_count = shape.stream_sizes[MESHCACHE_POSITION] / 3;
 
 	glGenBuffers(1, &tmp_shape.p_color);
 	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
-	glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GL_FLOAT), &colors.at(0), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, shape.stream_sizes[MESHCACHE_COLOR] * sizeof(GLfloat), shape.streams[MESHCACHE_COLOR], GL_STATIC_DRAW);
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
 	m_shape_list.push_back(tmp_shape);
@@ -801,9 +898,341 @@ void LoadModels(string model_path)
 
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
+}
+
+void LoadModels(string model_path)
+{
+	PreparedModel prepared;
+	if (!PrepareModel(model_path, prepared)) {
+		exit(1);
+	}
+	UploadPreparedModel(prepared);
+}
+
+// Loads every model of model_list: `threads` workers prepare the models
+// concurrently while this (GL) thread uploads them strictly in list order,
+// each as soon as it is ready, so models[i] is always model_list[i].
+// threads == 0 means one per core, 1 is the plain serial loop, which alone
+// parses each model on every core. Without upload the prepared models are
+// dropped instead (for --bench-load).
+bool LoadModelList(unsigned int threads, bool upload)
+{
+	size_t count = model_list.size();
+	if (threads == 0)
+		threads = max(1u, thread::hardware_concurrency());
+	threads = (unsigned int)min((size_t)threads, count);
+
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			PreparedModel prepared;
+			if (!PrepareModel(model_list[i], prepared))
+				return false;
+			if (upload)
+				UploadPreparedModel(prepared);
+		}
+		return true;
+	}
 
-	shapes.clear();
-	materials.clear();
+	// filled by the workers, guarded by ready_mutex; drained in order below
+	vector<unique_ptr<PreparedModel> > prepared(count);
+	vector<char> ready(count, 0);
+	mutex ready_mutex;
+	condition_variable ready_cv;
+	atomic<size_t> next_model(0);
+
+	vector<thread> workers;
+	for (unsigned int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&]() {
+			for (size_t i = next_model++; i < count; i = next_model++)
+			{
+				unique_ptr<PreparedModel> model_data(new PreparedModel);
+				model_data->ok = PrepareModel(model_list[i], *model_data, 1);
+				{
+					lock_guard<mutex> lock(ready_mutex);
+					prepared[i] = move(model_data);
+					ready[i] = 1;
+				}
+				ready_cv.notify_all();
+			}
+		});
+	}
+
+	// upload queue: GL calls stay on this thread, in list order
+	bool ok = true;
+	for (size_t i = 0; i < count && ok; i++)
+	{
+		unique_ptr<PreparedModel> model_data;
+		{
+			unique_lock<mutex> lock(ready_mutex);
+			ready_cv.wait(lock, [&]() { return ready[i] != 0; });
+			model_data = move(prepared[i]);
+		}
+		ok = model_data->ok;
+		if (ok && upload)
+			UploadPreparedModel(*model_data);
+	}
+
+	// on failure stop handing out models and let the running ones finish
+	next_model = count;
+	for (thread& worker : workers)
+		worker.join();
+	return ok;
+}
+
+// Single threaded tinyobj parse of model_path, the reference for LoadObjParallel
+static bool LoadObjSerial(const string& model_path, tinyobj::attrib_t* attrib, vector<tinyobj::shape_t>* shapes, vector<tinyobj::material_t>* materials)
+{
+	string warn, err;
+	ifstream ifs(model_path.c_str());
+	if (!ifs)
+		return false;
+
+	tinyobj::MaterialFileReader matFileReader(GetBaseDir(model_path) + "/");
+	return tinyobj::LoadObj(attrib, shapes, materials, &warn, &err, &ifs, &matFileReader);
+}
+
+static bool SameObj(const tinyobj::attrib_t& a, const vector<tinyobj::shape_t>& as, const tinyobj::attrib_t& b, const vector<tinyobj::shape_t>& bs)
+{
+	if (a.vertices != b.vertices || a.normals != b.normals || a.texcoords != b.texcoords || a.colors != b.colors || as.size() != bs.size())
+		return false;
+
+	for (size_t s = 0; s < as.size(); s++)
+	{
+		const tinyobj::mesh_t& ma = as[s].mesh;
+		const tinyobj::mesh_t& mb = bs[s].mesh;
+		if (as[s].name != bs[s].name || ma.indices.size() != mb.indices.size() || ma.num_face_vertices != mb.num_face_vertices || ma.material_ids != mb.material_ids)
+			return false;
+
+		for (size_t i = 0; i < ma.indices.size(); i++)
+		{
+			if (ma.indices[i].vertex_index != mb.indices[i].vertex_index || ma.indices[i].normal_index != mb.indices[i].normal_index || ma.indices[i].texcoord_index != mb.indices[i].texcoord_index)
+				return false;
+		}
+	}
+	return true;
+}
+
+// `--bench-parse`: serial vs threaded OBJ parse of every model in model_list
+void BenchmarkObjParse()
+{
+	const int rounds = 5;
+	unsigned int thread_counts[] = { 1, 2, 4, 0 };
+
+	for (string model_path : model_list)
+	{
+		tinyobj::attrib_t ref_attrib;
+		vector<tinyobj::shape_t> ref_shapes;
+		vector<tinyobj::material_t> ref_materials;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			if (!LoadObjSerial(model_path, &ref_attrib, &ref_shapes, &ref_materials))
+			{
+				cout << "BenchmarkObjParse: Cannot load " << model_path << endl;
+				break;
+			}
+		}
+		double serial_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+		printf("%s\n  serial            %8.2f ms\n", model_path.c_str(), serial_ms);
+
+		for (unsigned int threads : thread_counts)
+		{
+			tinyobj::attrib_t attrib;
+			vector<tinyobj::shape_t> shapes;
+			vector<tinyobj::material_t> materials;
+			string warn, err;
+
+			start = chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++)
+			{
+				tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), (GetBaseDir(model_path) + "/").c_str(), true, true, threads);
+			}
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+
+			printf("  %2u threads%s  %8.2f ms  x%.2f  %s\n", threads, threads == 0 ? "(auto)" : "      ", ms, serial_ms / ms,
+				SameObj(ref_attrib, ref_shapes, attrib, shapes) ? "identical" : "MISMATCH");
+		}
+	}
+}
+
+// `--bench-float`: tinyobj's original parseReal step (strcspn, then the
+// digit-by-digit tryParseDouble) vs the one-pass tryParseDoubleFast over every
+// number in the v/vn/vt lines of buddha50KC.obj. Checks that both give the
+// same floats. The lines are read up front so only the number parsing is
+// timed.
+void BenchmarkFloatParse()
+{
+	const int rounds = 20;
+	string model_path = "../ColorModels/buddha50KC.obj";
+
+	ifstream file(model_path.c_str());
+	if (!file)
+	{
+		cout << "BenchmarkFloatParse: Cannot open " << model_path << endl;
+		return;
+	}
+
+	// NUL terminated vertex lines without their v/vn/vt keyword, as
+	// ParseObjLine hands them to parseReal
+	string text, line;
+	vector<size_t> line_starts;
+	while (getline(file, line))
+	{
+		if (line.compare(0, 2, "v ") == 0 || line.compare(0, 3, "vn ") == 0 || line.compare(0, 3, "vt ") == 0)
+		{
+			line_starts.push_back(text.size());
+			text += line.substr(line.find(' ') + 1);
+			text += '\0';
+		}
+	}
+
+	vector<float> legacy, fast;
+	legacy.reserve(line_starts.size() * 6);
+	fast.reserve(line_starts.size() * 6);
+
+	// best of the rounds, so a busy machine does not decide the comparison
+	double legacy_ms = 1e30, fast_ms = 1e30;
+	for (int r = 0; r < rounds; r++)
+	{
+		legacy.clear();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (size_t start_offset : line_starts)
+		{
+			const char* token = text.c_str() + start_offset;
+			while (*token != '\0')
+			{
+				double val = 0;
+				tinyobj::parseDoubleLegacy(&token, &val);
+				legacy.push_back((float)val);
+			}
+		}
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		legacy_ms = min(legacy_ms, ms);
+
+		fast.clear();
+		start = chrono::steady_clock::now();
+		for (size_t start_offset : line_starts)
+		{
+			const char* token = text.c_str() + start_offset;
+			while (*token != '\0')
+			{
+				double val = 0;
+				tinyobj::parseDouble(&token, &val);
+				fast.push_back((float)val);
+			}
+		}
+		ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		fast_ms = min(fast_ms, ms);
+	}
+
+	bool same = legacy.size() == fast.size() && memcmp(legacy.data(), fast.data(), legacy.size() * sizeof(float)) == 0;
+	printf("%s: %zu numbers\n  legacy  %8.2f ms  %6.1f ns/number\n  fast    %8.2f ms  %6.1f ns/number  x%.2f  %s\n",
+		model_path.c_str(), legacy.size(),
+		legacy_ms, legacy_ms * 1e6 / legacy.size(), fast_ms, fast_ms * 1e6 / fast.size(), legacy_ms / fast_ms,
+		same ? "identical" : "MISMATCH");
+#ifdef TINYOBJLOADER_DISABLE_FAST_FLOAT
+	printf("  (built with TINYOBJLOADER_DISABLE_FAST_FLOAT, both columns are the legacy parser)\n");
+#endif
+}
+
+// `--bench-cache`: text path (parse + normalization) vs mapped mesh cache
+// for every model in model_list, checking both produce the same streams
+void BenchmarkMeshCache()
+{
+	const int rounds = 5;
+
+	for (string model_path : model_list)
+	{
+		MeshCacheData data;
+		MeshCacheView text_view;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			data = MeshCacheData();
+			if (!BuildModelData(model_path, data))
+				break;
+		}
+		double text_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+		if (data.shapes.empty())
+		{
+			cout << "BenchmarkMeshCache: Cannot load " << model_path << endl;
+			continue;
+		}
+		MakeMeshCacheView(data, &text_view);
+
+		string cache_path = MeshCachePath(model_path, MESH_CACHE_TAG);
+		if (!WriteMeshCache(cache_path, model_path, MESH_CACHE_TAG, data))
+		{
+			cout << "BenchmarkMeshCache: Cannot write " << cache_path << endl;
+			continue;
+		}
+
+		// touch every page so the mapped timing includes faulting the streams in,
+		// as glBufferData would
+		bool hit = true;
+		volatile float sink = 0;
+		start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds && hit; r++)
+		{
+			MappedFile cache_file;
+			MeshCacheView view;
+			hit = ReadMeshCache(cache_path, model_path, MESH_CACHE_TAG, &cache_file, &view);
+			for (size_t i = 0; hit && i < cache_file.size(); i += 4096)
+				sink += cache_file.data()[i];
+		}
+		double cache_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+
+		MappedFile cache_file;
+		MeshCacheView cache_view;
+		bool same = hit && ReadMeshCache(cache_path, model_path, MESH_CACHE_TAG, &cache_file, &cache_view) && SameMeshCacheView(text_view, cache_view);
+
+		printf("%s\n  text   %8.2f ms\n  cache  %8.2f ms  x%.2f  %zu bytes  %s\n", model_path.c_str(), text_ms, cache_ms, text_ms / cache_ms,
+			cache_file.size(), same ? "identical" : "MISMATCH");
+	}
+}
+
+// `--bench-load`: wall-clock time to prepare all of model_list against the
+// worker count, from the .obj files (cold) and from the mesh caches (warm).
+// There is no GL context here, so the in-order upload is left out.
+void BenchmarkModelLoad()
+{
+	const int rounds = 5;
+	unsigned int thread_counts[] = { 1, 2, 4, 0 };
+	bool cache_modes[] = { false, true };
+
+	// make sure the warm rounds find a cache for every model
+	if (!LoadModelList(1, false))
+	{
+		cout << "BenchmarkModelLoad: Cannot load model_list" << endl;
+		return;
+	}
+
+	for (bool cache : cache_modes)
+	{
+		use_mesh_cache = cache;
+		printf("%s\n", cache ? "mesh cache" : "obj parse");
+
+		double serial_ms = 0;
+		for (unsigned int threads : thread_counts)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++)
+			{
+				LoadModelList(threads, false);
+			}
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+			if (threads == 1)
+				serial_ms = ms;
+
+			printf("  %2u threads%s  %8.2f ms  x%.2f\n", threads, threads == 0 ? "(auto)" : "      ", ms, serial_ms / ms);
+		}
+	}
+	use_mesh_cache = true;
 }
 
 void initParameter()
@@ -834,12 +1263,13 @@ void setupRC()
 
 	// OpenGL States and Values
 	glClearColor(0.2, 0.2, 0.2, 1.0);
-	vector<string> model_list{ "../ColorModels/bunny5KC.obj", "../ColorModels/dragon10KC.obj", "../ColorModels/lucy25KC.obj", "../ColorModels/teapot4KC.obj", "../ColorModels/dolphinC.obj" };
 	// [TODO] Load five model at here
-	for (int cur_idx = 0; cur_idx < model_list.size(); ++cur_idx)
-	{
-		LoadModels(model_list[cur_idx]);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (!LoadModelList(load_threads, true)) {
+		exit(1);
 	}
+	printf("Loaded %zu models in %.2f ms (--load-threads %u)\n", model_list.size(),
+		chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), load_threads);
 
 }
 
@@ -864,6 +1294,43 @@ void glPrintContextInfo(bool printExtension)
 
 int main(int argc, char **argv)
 {
+	if (argc > 1 && string(argv[1]) == "--bench-parse")
+	{
+		BenchmarkObjParse();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-cache")
+	{
+		BenchmarkMeshCache();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-float")
+	{
+		BenchmarkFloatParse();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-load")
+	{
+		BenchmarkModelLoad();
+		return 0;
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		if (string(argv[i]) == "--load-threads" && i + 1 < argc)
+			load_threads = (unsigned int)atoi(argv[++i]);
+		else if (string(argv[i]) == "--no-mesh-cache")
+			use_mesh_cache = false;
+		else if (string(argv[i]) == "--io-stats")
+		{
+			EnableFileIoStats();
+			atexit(PrintFileIoStats);
+		}
+		else if (string(argv[i]) == "--continuous")
+			render_on_demand = false;
+		else if (string(argv[i]) == "--loop-stats")
+			atexit(PrintRenderLoopStats);
+	}
+
 	// initial glfw
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -900,21 +1367,34 @@ int main(int argc, char **argv)
 	glfwSetCursorPosCallback(window, cursor_pos_callback);
 
 	glfwSetFramebufferSizeCallback(window, ChangeSize);
+	glfwSetWindowRefreshCallback(window, WindowRefresh);
 	glEnable(GL_DEPTH_TEST);
 	// Setup render context
 	setupRC();
 
 	// main loop
+	loop_start = chrono::steady_clock::now();
 	while (!glfwWindowShouldClose(window))
 	{
-		// render
-		RenderScene();
+		chrono::steady_clock::time_point wake = chrono::steady_clock::now();
+		loop_wakeups++;
+		if (scene_dirty || !render_on_demand)
+		{
+			scene_dirty = false;
+			// render
+			RenderScene();
 
-		// swap buffer from back to front
-		glfwSwapBuffers(window);
+			// swap buffer from back to front
+			glfwSwapBuffers(window);
+			loop_frames++;
+		}
+		loop_busy_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - wake).count();
 
-		// Poll input event
-		glfwPollEvents();
+		// Poll input event, or sleep until there is some
+		if (render_on_demand)
+			glfwWaitEventsTimeout(kIdleWait);
+		else
+			glfwPollEvents();
 	}
 
 	// just for compatibiliy purposes
@@ -0,0 +1,571 @@
+#include "meshcache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <atomic>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static const char kMeshCacheMagic[8] = { 'M', 'E', 'S', 'H', 'C', 'A', 'C', 'H' };
+static const size_t kMeshCacheAlign = 16;
+
+// On-disk layout: header, shape records, material records, dependency
+// records, string table, then every stream 16 byte aligned. Offsets are from
+// the start of the file.
+struct MeshCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t shape_count;
+	char tag[16];
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+	float aabb_min[3];
+	float aabb_max[3];
+	uint32_t material_count;
+	uint32_t string_bytes;
+	uint64_t file_size;
+	uint32_t dependency_count;
+	uint32_t reserved;
+};
+
+// A file besides the .obj that the cached data was built from, i.e. a
+// material library. The path is relative to the .obj's directory.
+struct MeshCacheDependencyRecord
+{
+	uint32_t path;	// offset into the string table
+	uint32_t reserved;
+	uint64_t size;	// kMissingDependency if it did not exist
+	int64_t mtime;
+	uint64_t hash;
+};
+
+static const uint64_t kMissingDependency = ~0ULL;
+
+struct MeshCacheShapeRecord
+{
+	uint32_t name;	// offset into the string table
+	int32_t material_id;
+	uint32_t stream_sizes[MESHCACHE_STREAM_COUNT];
+	uint64_t stream_offsets[MESHCACHE_STREAM_COUNT];
+	uint32_t index_count;
+	uint32_t index_size;
+	uint64_t index_offset;
+};
+
+struct MeshCacheMaterialRecord
+{
+	uint32_t name;
+	uint32_t diffuse_texname;
+	float ambient[3];
+	float diffuse[3];
+	float specular[3];
+	float shininess;
+};
+
+static size_t AlignUp(size_t n)
+{
+	return (n + kMeshCacheAlign - 1) & ~(kMeshCacheAlign - 1);
+}
+
+static bool StatFile(const std::string& path, uint64_t* size, int64_t* mtime)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+	*size = (uint64_t)st.st_size;
+	*mtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+// FNV-1a over the whole file
+static bool HashFile(const std::string& path, uint64_t* hash)
+{
+	MappedFile file;
+	if (!file.Open(path))
+		return false;
+
+	uint64_t h = 14695981039346656037ULL;
+	const unsigned char* p = (const unsigned char*)file.data();
+	for (size_t i = 0; i < file.size(); i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	*hash = h;
+	return true;
+}
+
+// Directory of path including its trailing separator, "" for none
+static std::string DirectoryOf(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+// The names on the mtllib lines of an .obj, in file order
+static bool FindMaterialLibraries(const std::string& source_path, std::vector<std::string>* names)
+{
+	MappedFile file;
+	if (!file.Open(source_path))
+		return false;
+
+	const char* p = file.data();
+	const char* end = p + file.size();
+	while (p < end)
+	{
+		const char* line_end = (const char*)memchr(p, '\n', end - p);
+		if (line_end == NULL)
+			line_end = end;
+		while (p < line_end && (*p == ' ' || *p == '\t'))
+			p++;
+		if (line_end - p > 7 && memcmp(p, "mtllib", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))
+		{
+			p += 7;
+			while (p < line_end)
+			{
+				while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r'))
+					p++;
+				const char* name = p;
+				while (p < line_end && *p != ' ' && *p != '\t' && *p != '\r')
+					p++;
+				if (p > name)
+					names->push_back(std::string(name, p));
+			}
+		}
+		p = line_end + 1;
+	}
+	return true;
+}
+
+// Compares a file against what was recorded of it. A file that was only
+// touched matches by its hash and sets *touched with the new mtime.
+static bool SameSourceFile(const std::string& path, uint64_t size, int64_t mtime, uint64_t hash, bool* touched, int64_t* new_mtime)
+{
+	uint64_t actual_size;
+	if (!StatFile(path, &actual_size, new_mtime))
+		return size == kMissingDependency;
+	if (actual_size != size)
+		return false;
+	if (*new_mtime == mtime)
+		return true;
+
+	uint64_t actual_hash;
+	if (!HashFile(path, &actual_hash) || actual_hash != hash)
+		return false;
+	*touched = true;
+	return true;
+}
+
+static void ComputeAabb(const MeshCacheView& view, float aabb_min[3], float aabb_max[3])
+{
+	for (int k = 0; k < 3; k++)
+	{
+		aabb_min[k] = 0.0f;
+		aabb_max[k] = 0.0f;
+	}
+
+	bool first = true;
+	for (size_t s = 0; s < view.shapes.size(); s++)
+	{
+		const float* p = view.shapes[s].streams[MESHCACHE_POSITION];
+		uint32_t n = view.shapes[s].stream_sizes[MESHCACHE_POSITION];
+		for (uint32_t i = 0; i + 2 < n; i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				if (first || p[i + k] < aabb_min[k])
+					aabb_min[k] = p[i + k];
+				if (first || p[i + k] > aabb_max[k])
+					aabb_max[k] = p[i + k];
+			}
+			first = false;
+		}
+	}
+}
+
+std::string MeshCachePath(const std::string& source_path, const char* tag)
+{
+	return source_path + "." + tag + ".meshcache";
+}
+
+// Checks the header against the source file and the recorded dependencies.
+// Files that were only touched get their recorded mtimes refreshed so the
+// next start skips hashing them.
+static bool ValidateMeshCacheHeader(const std::string& cache_path, const std::string& source_path, const char* tag)
+{
+	FILE* fp = fopen(cache_path.c_str(), "rb");
+	if (fp == NULL)
+		return false;
+
+	MeshCacheHeader header;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1
+		&& memcmp(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic)) == 0
+		&& header.version == MESHCACHE_VERSION
+		&& strncmp(header.tag, tag, sizeof(header.tag)) == 0
+		&& header.dependency_count <= header.file_size / sizeof(MeshCacheDependencyRecord)
+		&& header.string_bytes <= header.file_size;
+
+	// the dependency records and the string table follow the other records
+	long dependencies_offset = (long)(sizeof(MeshCacheHeader) + (uint64_t)header.shape_count * sizeof(MeshCacheShapeRecord) + (uint64_t)header.material_count * sizeof(MeshCacheMaterialRecord));
+	std::vector<MeshCacheDependencyRecord> dependencies(ok ? header.dependency_count : 0);
+	std::vector<char> strings(ok ? header.string_bytes + 1 : 0);
+	if (ok && (!dependencies.empty() || !strings.empty()))
+	{
+		ok = fseek(fp, dependencies_offset, SEEK_SET) == 0
+			&& (dependencies.empty() || fread(&dependencies[0], sizeof(MeshCacheDependencyRecord), dependencies.size(), fp) == dependencies.size())
+			&& fread(&strings[0], 1, header.string_bytes, fp) == header.string_bytes;
+		if (ok)
+			strings[header.string_bytes] = '\0';
+	}
+	fclose(fp);
+	if (!ok)
+		return false;
+
+	bool touched = false;
+	int64_t mtime;
+	if (!SameSourceFile(source_path, header.source_size, header.source_mtime, header.source_hash, &touched, &mtime) || header.source_size == kMissingDependency)
+		return false;
+	header.source_mtime = mtime;
+
+	std::string base_dir = DirectoryOf(source_path);
+	for (size_t d = 0; d < dependencies.size(); d++)
+	{
+		MeshCacheDependencyRecord& dependency = dependencies[d];
+		if (dependency.path >= header.string_bytes
+			|| !SameSourceFile(base_dir + &strings[dependency.path], dependency.size, dependency.mtime, dependency.hash, &touched, &mtime))
+			return false;
+		if (dependency.size != kMissingDependency)
+			dependency.mtime = mtime;
+	}
+	if (!touched)
+		return true;
+
+	fp = fopen(cache_path.c_str(), "r+b");
+	if (fp != NULL)
+	{
+		fwrite(&header, sizeof(header), 1, fp);
+		if (!dependencies.empty() && fseek(fp, dependencies_offset, SEEK_SET) == 0)
+			fwrite(&dependencies[0], sizeof(MeshCacheDependencyRecord), dependencies.size(), fp);
+		fclose(fp);
+	}
+	return true;
+}
+
+bool ReadMeshCache(const std::string& cache_path, const std::string& source_path, const char* tag, MappedFile* file, MeshCacheView* view)
+{
+	if (!ValidateMeshCacheHeader(cache_path, source_path, tag) || !file->Open(cache_path))
+		return false;
+
+	const char* base = file->data();
+	size_t size = file->size();
+	if (size < sizeof(MeshCacheHeader))
+	{
+		file->Close();
+		return false;
+	}
+
+	const MeshCacheHeader* header = (const MeshCacheHeader*)base;
+	size_t records_end = sizeof(MeshCacheHeader) + header->shape_count * sizeof(MeshCacheShapeRecord) + header->material_count * sizeof(MeshCacheMaterialRecord)
+		+ header->dependency_count * sizeof(MeshCacheDependencyRecord);
+	if (header->file_size != size || records_end + header->string_bytes > size)
+	{
+		file->Close();
+		return false;
+	}
+
+	const MeshCacheShapeRecord* shapes = (const MeshCacheShapeRecord*)(base + sizeof(MeshCacheHeader));
+	const MeshCacheMaterialRecord* materials = (const MeshCacheMaterialRecord*)(shapes + header->shape_count);
+	const char* strings = base + records_end;
+
+	view->shapes.resize(header->shape_count);
+	for (uint32_t s = 0; s < header->shape_count; s++)
+	{
+		MeshCacheShapeView& shape = view->shapes[s];
+		if (shapes[s].name >= header->string_bytes)
+		{
+			file->Close();
+			return false;
+		}
+		shape.name = strings + shapes[s].name;
+		shape.material_id = shapes[s].material_id;
+		for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		{
+			uint64_t offset = shapes[s].stream_offsets[k];
+			uint64_t bytes = (uint64_t)shapes[s].stream_sizes[k] * sizeof(float);
+			if (offset > size || bytes > size - offset)
+			{
+				file->Close();
+				return false;
+			}
+			shape.streams[k] = (const float*)(base + offset);
+			shape.stream_sizes[k] = shapes[s].stream_sizes[k];
+		}
+
+		uint64_t index_bytes = (uint64_t)shapes[s].index_count * shapes[s].index_size;
+		if ((shapes[s].index_size != 0 && shapes[s].index_size != 2 && shapes[s].index_size != 4)
+			|| shapes[s].index_offset > size || index_bytes > size - shapes[s].index_offset)
+		{
+			file->Close();
+			return false;
+		}
+		shape.indices = shapes[s].index_count > 0 ? base + shapes[s].index_offset : NULL;
+		shape.index_count = shapes[s].index_count;
+		shape.index_size = shapes[s].index_size;
+	}
+
+	view->materials.resize(header->material_count);
+	for (uint32_t m = 0; m < header->material_count; m++)
+	{
+		MeshCacheMaterial& material = view->materials[m];
+		if (materials[m].name >= header->string_bytes || materials[m].diffuse_texname >= header->string_bytes)
+		{
+			file->Close();
+			return false;
+		}
+		material.name = strings + materials[m].name;
+		material.diffuse_texname = strings + materials[m].diffuse_texname;
+		memcpy(material.ambient, materials[m].ambient, sizeof(material.ambient));
+		memcpy(material.diffuse, materials[m].diffuse, sizeof(material.diffuse));
+		memcpy(material.specular, materials[m].specular, sizeof(material.specular));
+		material.shininess = materials[m].shininess;
+	}
+
+	memcpy(view->aabb_min, header->aabb_min, sizeof(view->aabb_min));
+	memcpy(view->aabb_max, header->aabb_max, sizeof(view->aabb_max));
+	return true;
+}
+
+static uint32_t AddString(std::vector<char>& strings, const std::string& s)
+{
+	uint32_t offset = (uint32_t)strings.size();
+	strings.insert(strings.end(), s.begin(), s.end());
+	strings.push_back('\0');
+	return offset;
+}
+
+static bool WriteBytes(FILE* fp, const void* data, size_t bytes, uint64_t* written)
+{
+	*written += bytes;
+	return fwrite(data, 1, bytes, fp) == bytes;
+}
+
+static bool PadTo(FILE* fp, uint64_t offset, uint64_t* written)
+{
+	static const char zeros[kMeshCacheAlign] = { 0 };
+	return *written >= offset || WriteBytes(fp, zeros, (size_t)(offset - *written), written);
+}
+
+bool WriteMeshCache(const std::string& cache_path, const std::string& source_path, const char* tag, const MeshCacheData& data)
+{
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic));
+	header.version = MESHCACHE_VERSION;
+	strncpy(header.tag, tag, sizeof(header.tag) - 1);
+	if (!StatFile(source_path, &header.source_size, &header.source_mtime) || !HashFile(source_path, &header.source_hash))
+		return false;
+
+	// the material libraries, as they are now; one that does not exist is
+	// recorded as missing
+	std::vector<std::string> libraries;
+	if (!FindMaterialLibraries(source_path, &libraries))
+		return false;
+	std::string base_dir = DirectoryOf(source_path);
+	std::vector<char> strings;
+	std::vector<MeshCacheDependencyRecord> dependencies(libraries.size());
+	for (size_t d = 0; d < libraries.size(); d++)
+	{
+		MeshCacheDependencyRecord& dependency = dependencies[d];
+		dependency.path = AddString(strings, libraries[d]);
+		if (!StatFile(base_dir + libraries[d], &dependency.size, &dependency.mtime) || !HashFile(base_dir + libraries[d], &dependency.hash))
+		{
+			dependency.size = kMissingDependency;
+			dependency.mtime = 0;
+			dependency.hash = 0;
+		}
+	}
+
+	MeshCacheView view;
+	MakeMeshCacheView(data, &view);
+	memcpy(header.aabb_min, view.aabb_min, sizeof(header.aabb_min));
+	memcpy(header.aabb_max, view.aabb_max, sizeof(header.aabb_max));
+
+	std::vector<MeshCacheShapeRecord> shapes(data.shapes.size());
+	std::vector<MeshCacheMaterialRecord> materials(data.materials.size());
+	for (size_t m = 0; m < data.materials.size(); m++)
+	{
+		const MeshCacheMaterial& src = data.materials[m];
+		materials[m].name = AddString(strings, src.name);
+		materials[m].diffuse_texname = AddString(strings, src.diffuse_texname);
+		memcpy(materials[m].ambient, src.ambient, sizeof(src.ambient));
+		memcpy(materials[m].diffuse, src.diffuse, sizeof(src.diffuse));
+		memcpy(materials[m].specular, src.specular, sizeof(src.specular));
+		materials[m].shininess = src.shininess;
+	}
+	for (size_t s = 0; s < data.shapes.size(); s++)
+	{
+		shapes[s].name = AddString(strings, data.shapes[s].name);
+		shapes[s].material_id = data.shapes[s].material_id;
+	}
+
+	size_t offset = AlignUp(sizeof(header) + shapes.size() * sizeof(MeshCacheShapeRecord) + materials.size() * sizeof(MeshCacheMaterialRecord)
+		+ dependencies.size() * sizeof(MeshCacheDependencyRecord) + strings.size());
+	for (size_t s = 0; s < data.shapes.size(); s++)
+	{
+		for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		{
+			shapes[s].stream_sizes[k] = (uint32_t)data.shapes[s].streams[k].size();
+			shapes[s].stream_offsets[k] = offset;
+			offset = AlignUp(offset + data.shapes[s].streams[k].size() * sizeof(float));
+		}
+
+		const MeshCacheShape& shape = data.shapes[s];
+		shapes[s].index_size = !shape.indices32.empty() ? 4 : !shape.indices16.empty() ? 2 : 0;
+		shapes[s].index_count = (uint32_t)(shape.indices32.empty() ? shape.indices16.size() : shape.indices32.size());
+		shapes[s].index_offset = offset;
+		offset = AlignUp(offset + (size_t)shapes[s].index_count * shapes[s].index_size);
+	}
+	header.shape_count = (uint32_t)shapes.size();
+	header.material_count = (uint32_t)materials.size();
+	header.dependency_count = (uint32_t)dependencies.size();
+	header.string_bytes = (uint32_t)strings.size();
+	header.file_size = offset;
+
+	// write beside the real file and rename, so a crash never leaves a
+	// truncated cache that looks valid. The name is unique per process and
+	// call, so concurrent writers never share a temporary file.
+	static std::atomic<unsigned int> tmp_counter(0);
+	char tmp_suffix[48];
+	snprintf(tmp_suffix, sizeof(tmp_suffix), ".%d.%u.tmp", (int)getpid(), tmp_counter++);
+	std::string tmp_path = cache_path + tmp_suffix;
+	FILE* fp = fopen(tmp_path.c_str(), "wb");
+	if (fp == NULL)
+		return false;
+
+	uint64_t written = 0;
+	bool ok = WriteBytes(fp, &header, sizeof(header), &written);
+	if (ok && !shapes.empty())
+		ok = WriteBytes(fp, &shapes[0], shapes.size() * sizeof(MeshCacheShapeRecord), &written);
+	if (ok && !materials.empty())
+		ok = WriteBytes(fp, &materials[0], materials.size() * sizeof(MeshCacheMaterialRecord), &written);
+	if (ok && !dependencies.empty())
+		ok = WriteBytes(fp, &dependencies[0], dependencies.size() * sizeof(MeshCacheDependencyRecord), &written);
+	if (ok && !strings.empty())
+		ok = WriteBytes(fp, &strings[0], strings.size(), &written);
+	for (size_t s = 0; ok && s < data.shapes.size(); s++)
+	{
+		for (int k = 0; ok && k < MESHCACHE_STREAM_COUNT; k++)
+		{
+			const std::vector<float>& stream = data.shapes[s].streams[k];
+			ok = PadTo(fp, shapes[s].stream_offsets[k], &written);
+			if (ok && !stream.empty())
+				ok = WriteBytes(fp, &stream[0], stream.size() * sizeof(float), &written);
+		}
+
+		const MeshCacheShape& shape = data.shapes[s];
+		if (ok)
+			ok = PadTo(fp, shapes[s].index_offset, &written);
+		if (ok && !shape.indices32.empty())
+			ok = WriteBytes(fp, &shape.indices32[0], shape.indices32.size() * sizeof(uint32_t), &written);
+		else if (ok && !shape.indices16.empty())
+			ok = WriteBytes(fp, &shape.indices16[0], shape.indices16.size() * sizeof(uint16_t), &written);
+	}
+	if (ok)
+		ok = PadTo(fp, header.file_size, &written);
+	ok = fclose(fp) == 0 && ok;
+
+	if (ok)
+	{
+		remove(cache_path.c_str());
+		ok = rename(tmp_path.c_str(), cache_path.c_str()) == 0;
+	}
+	if (!ok)
+		remove(tmp_path.c_str());
+	return ok;
+}
+
+void MakeMeshCacheView(const MeshCacheData& data, MeshCacheView* view)
+{
+	view->shapes.resize(data.shapes.size());
+	for (size_t s = 0; s < data.shapes.size(); s++)
+	{
+		MeshCacheShapeView& shape = view->shapes[s];
+		shape.name = data.shapes[s].name.c_str();
+		shape.material_id = data.shapes[s].material_id;
+		for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		{
+			shape.streams[k] = data.shapes[s].streams[k].empty() ? NULL : &data.shapes[s].streams[k][0];
+			shape.stream_sizes[k] = (uint32_t)data.shapes[s].streams[k].size();
+		}
+
+		if (!data.shapes[s].indices32.empty())
+		{
+			shape.indices = &data.shapes[s].indices32[0];
+			shape.index_count = (uint32_t)data.shapes[s].indices32.size();
+			shape.index_size = 4;
+		}
+		else if (!data.shapes[s].indices16.empty())
+		{
+			shape.indices = &data.shapes[s].indices16[0];
+			shape.index_count = (uint32_t)data.shapes[s].indices16.size();
+			shape.index_size = 2;
+		}
+		else
+		{
+			shape.indices = NULL;
+			shape.index_count = 0;
+			shape.index_size = 0;
+		}
+	}
+	view->materials = data.materials;
+	ComputeAabb(*view, view->aabb_min, view->aabb_max);
+}
+
+bool SameMeshCacheView(const MeshCacheView& a, const MeshCacheView& b)
+{
+	if (memcmp(a.aabb_min, b.aabb_min, sizeof(a.aabb_min)) != 0 || memcmp(a.aabb_max, b.aabb_max, sizeof(a.aabb_max)) != 0)
+		return false;
+	if (a.shapes.size() != b.shapes.size() || a.materials.size() != b.materials.size())
+		return false;
+
+	for (size_t s = 0; s < a.shapes.size(); s++)
+	{
+		const MeshCacheShapeView& sa = a.shapes[s];
+		const MeshCacheShapeView& sb = b.shapes[s];
+		if (strcmp(sa.name, sb.name) != 0 || sa.material_id != sb.material_id)
+			return false;
+		for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		{
+			if (sa.stream_sizes[k] != sb.stream_sizes[k])
+				return false;
+			if (sa.stream_sizes[k] > 0 && memcmp(sa.streams[k], sb.streams[k], sa.stream_sizes[k] * sizeof(float)) != 0)
+				return false;
+		}
+		if (sa.index_count != sb.index_count || sa.index_size != sb.index_size)
+			return false;
+		if (sa.index_count > 0 && memcmp(sa.indices, sb.indices, (size_t)sa.index_count * sa.index_size) != 0)
+			return false;
+	}
+
+	for (size_t m = 0; m < a.materials.size(); m++)
+	{
+		const MeshCacheMaterial& ma = a.materials[m];
+		const MeshCacheMaterial& mb = b.materials[m];
+		if (ma.name != mb.name || ma.diffuse_texname != mb.diffuse_texname
+			|| memcmp(ma.ambient, mb.ambient, sizeof(ma.ambient)) != 0
+			|| memcmp(ma.diffuse, mb.diffuse, sizeof(ma.diffuse)) != 0
+			|| memcmp(ma.specular, mb.specular, sizeof(ma.specular)) != 0
+			|| memcmp(&ma.shininess, &mb.shininess, sizeof(ma.shininess)) != 0)
+			return false;
+	}
+	return true;
+}
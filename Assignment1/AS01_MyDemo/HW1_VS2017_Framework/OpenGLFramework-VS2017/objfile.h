@@ -0,0 +1,37 @@
+#ifndef OBJFILE_H
+#define OBJFILE_H
+
+#include <string>
+#include <vector>
+
+#include "textfile.h"
+#include "tiny_obj_loader.h"
+
+// tinyobj on top of MappedFile. The .obj text is tokenized in place in a
+// copy-on-write mapping and each .mtl is parsed straight from its mapping,
+// so neither goes through an ifstream or a heap copy of the file.
+
+// .mtl reader with the search rules of tinyobj::MaterialFileReader
+class MappedMaterialReader : public tinyobj::MaterialReader
+{
+public:
+	explicit MappedMaterialReader(const std::string& mtl_basedir) : mtl_basedir_(mtl_basedir) {}
+
+	virtual bool operator()(const std::string& mat_id, std::vector<tinyobj::material_t>* materials,
+		std::map<std::string, int>* mat_map, std::string* warn, std::string* err);
+
+private:
+	std::string mtl_basedir_;
+};
+
+// Same result as tinyobj::LoadObj(attrib, shapes, materials, warn, err, path, mtl_basedir).
+// num_threads 0 parses on one thread per core; pass 1 from a worker thread,
+// which would otherwise start that many more.
+bool LoadObjFile(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+	std::string* warn, std::string* err, const std::string& path, const std::string& mtl_basedir, unsigned int num_threads = 0);
+
+// tinyobj::LoadObjWithCallback on a read-only mapping of path
+bool LoadObjFileWithCallback(const std::string& path, const std::string& mtl_basedir, const tinyobj::callback_t& callback,
+	void* user_data, std::string* warn, std::string* err);
+
+#endif
@@ -1,29 +1,40 @@
+#include "textfile.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 
-char *textFileRead(const char *fn) {
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
+// Files are opened from the model loader threads as well
+static std::mutex file_io_mutex;
+static std::vector<FileIoStat> file_io_stats;
+static std::atomic<bool> file_io_stats_enabled(false);
 
-	FILE *fp;
-	char *content = NULL;
+char *textFileRead(const char *fn) {
 
-	int count = 0;
+	char *content = NULL;
 
 	if (fn != NULL) {
-        fp = fopen(fn, "rt");
-
-		if (fp != NULL) {
-			fseek(fp, 0, SEEK_END);
-			count = ftell(fp);
-			rewind(fp);
+		MappedFile file;
 
-			if (count > 0) {
-				content = (char *)malloc(sizeof(char) * (count + 1));
-				count = fread(content, sizeof(char), count, fp);
-				content[count] = '\0';
-			}
-			fclose(fp);
+		if (file.Open(fn)) {
+			content = (char *)malloc(sizeof(char) * (file.size() + 1));
+			memcpy(content, file.data(), file.size());
+			content[file.size()] = '\0';
 		}
         else{
             printf("The file \"%s\" was not opened\n", fn);
@@ -38,7 +49,7 @@ int textFileWrite(char *fn, char *s) {
 	int status = 0;
 
 	if (fn != NULL) {
-        fp = fopen(fn, "rt");
+        fp = fopen(fn, "w");
 		if (fp != NULL) {
 			if (fwrite(s, sizeof(char), strlen(s), fp) == strlen(s))
 				status = 1;
@@ -51,6 +62,201 @@ int textFileWrite(char *fn, char *s) {
 	return(status);
 }
 
+MappedFile::MappedFile()
+	: data_(NULL), size_(0), mapped_(false), writable_(false), terminated_(false), file_(NULL), mapping_(NULL)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& path, Mode mode)
+{
+	Close();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (!(mode != READ_BUFFERED && Map(path, mode == MAP_COPY_ON_WRITE)) && !Read(path))
+		return false;
+	if (!file_io_stats_enabled)
+		return true;
+
+	FileIoStat stat;
+	stat.path = path;
+	stat.bytes = size_;
+	stat.mapped = mapped_;
+	stat.open_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::lock_guard<std::mutex> lock(file_io_mutex);
+	file_io_stats.push_back(stat);
+	return true;
+}
+
+bool MappedFile::Read(const std::string& path)
+{
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (fp == NULL)
+		return false;
+
+	struct stat st;
+	if (fstat(fileno(fp), &st) != 0)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	size_t size = (size_t)st.st_size;
+	buffer_.resize(size + 1);
+	size = fread(&buffer_[0], 1, size, fp);
+	fclose(fp);
+	buffer_[size] = '\0';
+
+	data_ = &buffer_[0];
+	size_ = size;
+	mapped_ = false;
+	writable_ = true;
+	terminated_ = true;
+	return true;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Map(const std::string& path, bool copy_on_write)
+{
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	const void* view = MapViewOfFile(mapping, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	file_ = file;
+	mapping_ = mapping;
+	data_ = (const char*)view;
+	size_ = (size_t)size.QuadPart;
+	mapped_ = true;
+	writable_ = copy_on_write;
+	terminated_ = size_ % info.dwPageSize != 0;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mapped_)
+		UnmapViewOfFile(data_);
+	if (mapping_ != NULL)
+		CloseHandle((HANDLE)mapping_);
+	if (file_ != NULL)
+		CloseHandle((HANDLE)file_);
+	std::vector<char>().swap(buffer_);
+	data_ = NULL;
+	size_ = 0;
+	mapped_ = false;
+	writable_ = false;
+	terminated_ = false;
+	file_ = NULL;
+	mapping_ = NULL;
+}
+
+#else
+
+bool MappedFile::Map(const std::string& path, bool copy_on_write)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* view = mmap(NULL, (size_t)st.st_size, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	data_ = (const char*)view;
+	size_ = (size_t)st.st_size;
+	mapped_ = true;
+	writable_ = copy_on_write;
+	terminated_ = size_ % (size_t)sysconf(_SC_PAGESIZE) != 0;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mapped_)
+		munmap((void*)data_, size_);
+	std::vector<char>().swap(buffer_);
+	data_ = NULL;
+	size_ = 0;
+	mapped_ = false;
+	writable_ = false;
+	terminated_ = false;
+}
+
+#endif
+
+void EnableFileIoStats()
+{
+	file_io_stats_enabled = true;
+}
+
+std::vector<FileIoStat> GetFileIoStats()
+{
+	std::lock_guard<std::mutex> lock(file_io_mutex);
+	return file_io_stats;
+}
+
+void ResetFileIoStats()
+{
+	std::lock_guard<std::mutex> lock(file_io_mutex);
+	file_io_stats.clear();
+}
+
+void PrintFileIoStats()
+{
+	std::vector<FileIoStat> stats = GetFileIoStats();
+
+	size_t bytes = 0, mapped = 0;
+	double ms = 0.0;
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		printf("  %-8s %10.2f KB %8.3f ms  %s\n", stats[i].mapped ? "mapped" : "buffered",
+			stats[i].bytes / 1024.0, stats[i].open_ms, stats[i].path.c_str());
+		bytes += stats[i].bytes;
+		mapped += stats[i].mapped ? 1 : 0;
+		ms += stats[i].open_ms;
+	}
+	printf("File I/O: %zu files (%zu mapped, %zu buffered), %.2f MB, %.3f ms\n",
+		stats.size(), mapped, stats.size() - mapped, bytes / (1024.0 * 1024.0), ms);
+}
+
 /*
 char *textFileRead(char *fn) {
 
@@ -1,9 +1,30 @@
 #version 330 core
 
+// A variant defines one LIGHT_* and at most one SHADING_* (UseShaderVariant
+// in main.cpp), folding the branches on them below; the uber shader defines
+// none and reads lightIdx and shading instead
+#if defined(LIGHT_DIRECTIONAL)
+#define LIGHT_IDX 0
+#elif defined(LIGHT_POINT)
+#define LIGHT_IDX 1
+#elif defined(LIGHT_SPOT)
+#define LIGHT_IDX 2
+#else
+#define LIGHT_IDX lightIdx
+#endif
+#if defined(SHADING_GOURAUD)
+#define SHADING 0
+#elif defined(SHADING_PHONG)
+#define SHADING 1
+#else
+#define SHADING shading
+#endif
+
 in vec4 vertex_color;
 in vec3 vertex_normal;
 in vec3 vertex_view;
 in vec3 vertex_position; // * Rasterizer
+flat in int shading; // 0 vertex lighting, 1 pixel lighting
 
 out vec4 FragColor;
 
@@ -38,9 +59,15 @@ struct MaterialInfo{
 
 uniform int lightIdx;			// for switching lighting mode
 uniform mat4 view_matrix;			
-uniform LightInfo light[3];
-uniform MaterialInfo material;
-uniform int vertex_or_perpixel;
+// std140, mirrored by LightBlockEntry and MaterialBlock in main.cpp
+layout (std140) uniform Lights
+{
+	LightInfo light[3];
+};
+layout (std140) uniform Material
+{
+	MaterialInfo material;
+};
 
 vec4 directionalLight(){
 	// calculate light_position, viewing_position, vertex_position
@@ -134,19 +161,19 @@ vec4 spotLight(){
 void main() 
 {
 	vec4 color;
-	if(vertex_or_perpixel == 0) {
+	if(SHADING == 0) {
 		FragColor =  vertex_color;
 		return;
 	}
-	if(lightIdx == 0)
+	if(LIGHT_IDX == 0)
 	{
 		color = directionalLight();
 	}
-	else if(lightIdx == 1)
+	else if(LIGHT_IDX == 1)
 	{
 		color = pointLight();
 	}
-	else if(lightIdx == 2)
+	else if(LIGHT_IDX == 2)
 	{
 		color = spotLight();
 	}
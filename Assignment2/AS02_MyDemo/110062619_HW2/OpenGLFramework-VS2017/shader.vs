@@ -1,4 +1,37 @@
 #version 330 core
+// gl_ViewportIndex in the vertex shader, for the single pass side by side
+// views; written only where the context has one of these
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+
+// A variant defines one LIGHT_*, at most one SHADING_* and one SPLIT_*
+// (UseShaderVariant in main.cpp), folding the branches on them below; the
+// uber shader defines none and reads the uniforms instead
+#if defined(LIGHT_DIRECTIONAL)
+#define LIGHT_IDX 0
+#elif defined(LIGHT_POINT)
+#define LIGHT_IDX 1
+#elif defined(LIGHT_SPOT)
+#define LIGHT_IDX 2
+#else
+#define LIGHT_IDX lightIdx
+#endif
+#if defined(SHADING_GOURAUD)
+#define VERTEX_OR_PERPIXEL 0
+#elif defined(SHADING_PHONG)
+#define VERTEX_OR_PERPIXEL 1
+#else
+#define VERTEX_OR_PERPIXEL vertex_or_perpixel
+#endif
+#if defined(SPLIT_TWO_PASS)
+#define SPLIT_PATH 0
+#elif defined(SPLIT_CLIP_PLANES)
+#define SPLIT_PATH 1
+#elif defined(SPLIT_VIEWPORT_INDEX)
+#define SPLIT_PATH 2
+#else
+#define SPLIT_PATH split_path
+#endif
 
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
@@ -8,6 +41,7 @@ out vec4 vertex_color;
 out vec3 vertex_normal;
 out vec3 vertex_view;
 out vec3 vertex_position; // *
+flat out int shading; // vertex_or_perpixel, or the instance's
 
 //uniform mat4 mvp;
 
@@ -44,8 +78,17 @@ struct MaterialInfo{
 
 uniform int lightIdx;			// pixel lighting
 uniform int lightIdxv;			// vertex lighting
-uniform LightInfo light[3];
-uniform MaterialInfo material;
+uniform int vertex_or_perpixel; // 0 vertex lighting, 1 pixel lighting, for split_path 0
+uniform int split_path; // SplitViewPath in main.cpp
+// std140, mirrored by LightBlockEntry and MaterialBlock in main.cpp
+layout (std140) uniform Lights
+{
+	LightInfo light[3];
+};
+layout (std140) uniform Material
+{
+	MaterialInfo material;
+};
 
 vec4 directionalLight(){
 	// calculate light_position, viewing_position, vertex_position
@@ -139,19 +182,41 @@ vec4 spotLight(){
 
 void main()
 {
+	// the single pass paths draw two instances, the vertex lit view at LHS
+	// and the pixel lit one at RHS
+	shading = SPLIT_PATH == 0 ? VERTEX_OR_PERPIXEL : gl_InstanceID;
+	vertex_position = (mv * vec4(aPos, 1.0)).xyz;
 	vertex_normal = normalize( (normTrans * vec4(aNormal, 1.0)).xyz );
-	if(lightIdx == 0)
+	// the pixel lit half lights in the fragment shader instead
+	vertex_color = vec4(0.0);
+	if(shading == 0)
 	{
-		vertex_color = directionalLight();
+		if(LIGHT_IDX == 0)
+		{
+			vertex_color = directionalLight();
+		}
+		else if(LIGHT_IDX == 1)
+		{
+			vertex_color = pointLight();
+		}
+		else if(LIGHT_IDX == 2)
+		{
+			vertex_color = spotLight();
+		}
 	}
-	else if(lightIdx == 1)
-	{
-		vertex_color = pointLight();
-	}
-	else if(lightIdx == 2)
+	gl_Position = project_matrix * view_matrix * model_matrix * vec4(aPos, 1.0);
+
+	if(SPLIT_PATH == 1)
 	{
-		vertex_color = spotLight();
+		// squeeze into this instance's half of the window, cutting off
+		// what would spill into the other half
+		float side = gl_InstanceID == 0 ? -1.0 : 1.0;
+		gl_Position.x = 0.5 * (gl_Position.x + side * gl_Position.w);
+		gl_ClipDistance[0] = side * gl_Position.x;
 	}
-	gl_Position = project_matrix * view_matrix * model_matrix * vec4(aPos, 1.0);
+#if defined(GL_ARB_shader_viewport_layer_array) || defined(GL_AMD_vertex_shader_viewport_index)
+	if(SPLIT_PATH == 2)
+		gl_ViewportIndex = gl_InstanceID;
+#endif
 }
 
@@ -396,6 +396,10 @@ struct attrib_t {
 struct callback_t {
   // W is optional and set to 1 if there is no `w` item in `v` line
   void (*vertex_cb)(void *user_data, real_t x, real_t y, real_t z, real_t w);
+  // Called instead of `vertex_cb` when set, for the `v x y z r g b` vertex
+  // color extension. r, g and b are 1 if the `v` line has no color.
+  void (*vertex_color_cb)(void *user_data, real_t x, real_t y, real_t z,
+                          real_t r, real_t g, real_t b);
   void (*normal_cb)(void *user_data, real_t x, real_t y, real_t z);
 
   // y and z are optional and set to 0 if there is no `y` and/or `z` item(s) in
@@ -419,6 +423,7 @@ struct callback_t {
 
   callback_t()
       : vertex_cb(NULL),
+        vertex_color_cb(NULL),
         normal_cb(NULL),
         texcoord_cb(NULL),
         index_cb(NULL),
@@ -569,12 +574,41 @@ class ObjReader {
 /// or not.
 /// Option 'default_vcols_fallback' specifies whether vertex colors should
 /// always be defined, even if no colors are given (fallback to white).
+/// Parses on one thread per core, see LoadObjParallel() below.
 bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
              std::vector<material_t> *materials, std::string *warn,
              std::string *err, const char *filename,
              const char *mtl_basedir = NULL, bool triangulate = true,
              bool default_vcols_fallback = true);
 
+/// Loads .obj from a file like LoadObj(), but splits the file into newline
+/// aligned chunks and tokenizes `v`/`vn`/`vt`/`f` lines of each chunk on a
+/// worker thread. The chunks are merged in file order, so the result is
+/// exactly the same as the one of the single threaded parser.
+/// 'num_threads' = 0 uses std::thread::hardware_concurrency() workers.
+/// LoadObj() with a filename uses this function unless
+/// TINYOBJLOADER_NO_THREADS is defined, so it too starts one worker per
+/// core. A caller that already runs on one of several threads should call
+/// this with 'num_threads' = 1 instead.
+bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                     std::vector<material_t> *materials, std::string *warn,
+                     std::string *err, const char *filename,
+                     const char *mtl_basedir = NULL, bool triangulate = true,
+                     bool default_vcols_fallback = true,
+                     unsigned int num_threads = 0);
+
+/// Same as above, but parses 'size' bytes of .obj text the caller already
+/// holds (e.g. a copy-on-write file mapping) instead of reading a file.
+/// The text is tokenized in place, so it must be writable. Unless its last
+/// byte is '\n' or '\r', text[size] must be a writable '\0' as well.
+/// .mtl files are read through 'readMatFn'.
+bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                     std::vector<material_t> *materials, std::string *warn,
+                     std::string *err, char *text, size_t size,
+                     MaterialReader *readMatFn, bool triangulate = true,
+                     bool default_vcols_fallback = true,
+                     unsigned int num_threads = 0);
+
 /// Loads .obj from a file with custom user callback.
 /// .mtl is loaded as usual and parsed material_t data will be passed to
 /// `callback.mtllib_cb`.
@@ -631,6 +665,10 @@ bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
 #include <fstream>
 #include <sstream>
 
+#ifndef TINYOBJLOADER_NO_THREADS
+#include <thread>
+#endif
+
 namespace tinyobj {
 
 MaterialReader::~MaterialReader() {}
@@ -937,26 +975,121 @@ fail:
   return false;
 }
 
-static inline real_t parseReal(const char **token, double default_value = 0.0) {
+// Fast path of parseReal for the plain decimals `[sign] digits [. digits]`
+// that make up nearly all of an .obj file. s must be NUL terminated. It parses
+// and finds the end of the token in one pass, where the legacy path needs
+// strcspn and then tryParseDouble. The digits are gathered into one integer
+// and divided by a single power of ten. If the integer fits in 53 bits and
+// the power is at most 10^22, both are exact doubles and the quotient is
+// correctly rounded (Clinger's fast path).
+//
+// It returns false and leaves result alone for anything else: exponents, more
+// than 19 digits, no digits, or a token that does not end at a space, tab,
+// '\r' or NUL. Those go to tryParseDouble with its exact grammar.
+static bool tryParseDoubleFast(const char *s, double *result,
+                               const char **token_end) {
+  static const double pow10_lut[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  const int max_pow10 = sizeof pow10_lut / sizeof pow10_lut[0] - 1;
+
+  const char *curr = s;
+  bool negative = (*curr == '-');
+  if (*curr == '+' || *curr == '-') {
+    curr++;
+  }
+
+  // One pass over the digits on both sides of the '.'. More than 19 digits
+  // may wrap mantissa, but those are rejected below anyway.
+  unsigned long long mantissa = 0;
+  const char *digits_begin = curr;
+  const char *dot = NULL;
+  for (;; curr++) {
+    unsigned int digit = static_cast<unsigned int>(*curr - '0');
+    if (digit < 10) {
+      mantissa = mantissa * 10 + digit;
+    } else if (*curr == '.' && !dot) {
+      dot = curr;
+    } else {
+      break;
+    }
+  }
+
+  if (*curr != ' ' && *curr != '\t' && *curr != '\r' && *curr != '\0') {
+    return false;
+  }
+  const long digits = (curr - digits_begin) - (dot ? 1 : 0);
+  const long fraction_digits = dot ? (curr - dot - 1) : 0;
+  if (digits == 0 || digits > 19 || fraction_digits > max_pow10 ||
+      mantissa > (1ULL << 53)) {
+    return false;
+  }
+
+  double value = static_cast<double>(static_cast<long long>(mantissa)) /
+                 pow10_lut[fraction_digits];
+
+#ifndef TINYOBJLOADER_USE_DOUBLE
+  // real_t is float. tryParseDouble is off by a few double ulps, which only
+  // matters when the value is that close to a tie between two floats (the
+  // low 29 mantissa bits of the double near 1 << 28), or below the normal
+  // float range where the tie sits elsewhere. Leave those to it so the
+  // floats stay the same.
+  if (value != 0.0 && value < 1.1754943508222875e-38) {
+    return false;
+  }
+  unsigned long long bits;
+  memcpy(&bits, &value, sizeof(bits));
+  unsigned long long float_tail = bits & ((1ULL << 29) - 1);
+  if (float_tail + 64 - (1ULL << 28) <= 128) {
+    return false;
+  }
+#endif
+
+  *result = negative ? -value : value;
+  *token_end = curr;
+  return true;
+}
+
+// The original token step of parseReal: the token runs up to the next space,
+// tab or '\r' and tryParseDouble reads it. val is left alone on failure.
+static inline bool parseDoubleLegacy(const char **token, double *val) {
   (*token) += strspn((*token), " \t");
   const char *end = (*token) + strcspn((*token), " \t\r");
-  double val = default_value;
-  tryParseDouble((*token), end, &val);
-  real_t f = static_cast<real_t>(val);
+  bool ret = tryParseDouble((*token), end, val);
   (*token) = end;
-  return f;
+  return ret;
+}
+
+// tryParseDoubleFast where it applies, parseDoubleLegacy otherwise, unless
+// TINYOBJLOADER_DISABLE_FAST_FLOAT is defined. With float real_t both give
+// the same floats. With TINYOBJLOADER_USE_DOUBLE the fast path is correctly
+// rounded and may differ from the legacy one in the last bit.
+static inline bool parseDouble(const char **token, double *val) {
+#ifndef TINYOBJLOADER_DISABLE_FAST_FLOAT
+  while (**token == ' ' || **token == '\t') {
+    (*token)++;
+  }
+  if (tryParseDoubleFast(*token, val, token)) {
+    return true;
+  }
+#endif
+  return parseDoubleLegacy(token, val);
+}
+
+static inline real_t parseReal(const char **token, double default_value = 0.0) {
+  double val = default_value;
+  parseDouble(token, &val);
+  return static_cast<real_t>(val);
 }
 
 static inline bool parseReal(const char **token, real_t *out) {
-  (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
   double val;
-  bool ret = tryParseDouble((*token), end, &val);
+  bool ret = parseDouble(token, &val);
   if (ret) {
     real_t f = static_cast<real_t>(val);
     (*out) = f;
   }
-  (*token) = end;
   return ret;
 }
 
@@ -2138,6 +2271,10 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
              std::vector<material_t> *materials, std::string *warn,
              std::string *err, const char *filename, const char *mtl_basedir,
              bool trianglulate, bool default_vcols_fallback) {
+#ifndef TINYOBJLOADER_NO_THREADS
+  return LoadObjParallel(attrib, shapes, materials, warn, err, filename,
+                         mtl_basedir, trianglulate, default_vcols_fallback);
+#else
   attrib->vertices.clear();
   attrib->normals.clear();
   attrib->texcoords.clear();
@@ -2168,15 +2305,13 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
 
   return LoadObj(attrib, shapes, materials, warn, err, &ifs, &matFileReader,
                  trianglulate, default_vcols_fallback);
+#endif
 }
 
-bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
-             std::vector<material_t> *materials, std::string *warn,
-             std::string *err, std::istream *inStream,
-             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
-             bool default_vcols_fallback) {
-  std::stringstream errss;
-
+// Parser state of one .obj file.
+// Both the stream based LoadObj() and LoadObjParallel() push every line
+// through ParseObjLine() in file order, so they build the same attrib/shapes.
+struct obj_parse_state {
   std::vector<real_t> v;
   std::vector<real_t> vn;
   std::vector<real_t> vt;
@@ -2187,445 +2322,472 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
 
   // material
   std::map<std::string, int> material_map;
-  int material = -1;
+  int material;
 
   // smoothing group id
-  unsigned int current_smoothing_id =
-      0;  // Initial value. 0 means no smoothing.
+  unsigned int current_smoothing_id;  // 0 means no smoothing.
 
-  int greatest_v_idx = -1;
-  int greatest_vn_idx = -1;
-  int greatest_vt_idx = -1;
+  int greatest_v_idx;
+  int greatest_vn_idx;
+  int greatest_vt_idx;
 
   shape_t shape;
 
-  bool found_all_colors = true;
+  bool found_all_colors;
 
-  size_t line_num = 0;
-  std::string linebuf;
-  while (inStream->peek() != -1) {
-    safeGetline(*inStream, linebuf);
-
-    line_num++;
+  size_t line_num;
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
-    }
+  obj_parse_state()
+      : material(-1),
+        current_smoothing_id(0),
+        greatest_v_idx(-1),
+        greatest_vn_idx(-1),
+        greatest_vt_idx(-1),
+        found_all_colors(true),
+        line_num(0) {}
+};
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
+// Parses one line of .obj. `token` points past the leading white spaces.
+// Returns false on a fatal parse error(message is appended to `err`).
+static bool ParseObjLine(obj_parse_state *st, const char *token,
+                         std::vector<shape_t> *shapes,
+                         std::vector<material_t> *materials, std::string *warn,
+                         std::string *err, MaterialReader *readMatFn,
+                         bool triangulate, bool default_vcols_fallback) {
+  std::vector<real_t> &v = st->v;
+  std::vector<real_t> &vn = st->vn;
+  std::vector<real_t> &vt = st->vt;
+  std::vector<real_t> &vc = st->vc;
+  std::vector<tag_t> &tags = st->tags;
+  PrimGroup &prim_group = st->prim_group;
+  std::string &name = st->name;
+  std::map<std::string, int> &material_map = st->material_map;
+  int &material = st->material;
+  unsigned int &current_smoothing_id = st->current_smoothing_id;
+  int &greatest_v_idx = st->greatest_v_idx;
+  int &greatest_vn_idx = st->greatest_vn_idx;
+  int &greatest_vt_idx = st->greatest_vt_idx;
+  shape_t &shape = st->shape;
+  bool &found_all_colors = st->found_all_colors;
+  const size_t line_num = st->line_num;
+
+  if (token[0] == '\0') return true;  // empty line
+
+  if (token[0] == '#') return true;  // comment line
+
+  // vertex
+  if (token[0] == 'v' && IS_SPACE((token[1]))) {
+    token += 2;
+    real_t x, y, z;
+    real_t r, g, b;
+
+    found_all_colors &= parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+
+    v.push_back(x);
+    v.push_back(y);
+    v.push_back(z);
+
+    if (found_all_colors || default_vcols_fallback) {
+      vc.push_back(r);
+      vc.push_back(g);
+      vc.push_back(b);
     }
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
-
-    assert(token);
-    if (token[0] == '\0') continue;  // empty line
-
-    if (token[0] == '#') continue;  // comment line
-
-    // vertex
-    if (token[0] == 'v' && IS_SPACE((token[1]))) {
-      token += 2;
-      real_t x, y, z;
-      real_t r, g, b;
-
-      found_all_colors &= parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
-
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
-
-      if (found_all_colors || default_vcols_fallback) {
-        vc.push_back(r);
-        vc.push_back(g);
-        vc.push_back(b);
-      }
-
-      continue;
-    }
+    return true;
+  }
 
-    // normal
-    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y, z;
-      parseReal3(&x, &y, &z, &token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
-    }
+  // normal
+  if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+    token += 3;
+    real_t x, y, z;
+    parseReal3(&x, &y, &z, &token);
+    vn.push_back(x);
+    vn.push_back(y);
+    vn.push_back(z);
+    return true;
+  }
 
-    // texcoord
-    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y;
-      parseReal2(&x, &y, &token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
-    }
+  // texcoord
+  if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+    token += 3;
+    real_t x, y;
+    parseReal2(&x, &y, &token);
+    vt.push_back(x);
+    vt.push_back(y);
+    return true;
+  }
 
-    // line
-    if (token[0] == 'l' && IS_SPACE((token[1]))) {
-      token += 2;
+  // line
+  if (token[0] == 'l' && IS_SPACE((token[1]))) {
+    token += 2;
 
-      __line_t line;
+    __line_t line;
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `l' line(e.g. zero value for vertex index. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index_t vi;
+      if (!parseTriple(&token, static_cast<int>(v.size() / 3),
+                       static_cast<int>(vn.size() / 3),
+                       static_cast<int>(vt.size() / 2), &vi)) {
+        if (err) {
+          std::stringstream ss;
+          ss << "Failed parse `l' line(e.g. zero value for vertex index. "
+                "line "
+             << line_num << ".)\n";
+          (*err) += ss.str();
         }
-
-        line.vertex_indices.push_back(vi);
-
-        size_t n = strspn(token, " \t\r");
-        token += n;
+        return false;
       }
 
-      prim_group.lineGroup.push_back(line);
+      line.vertex_indices.push_back(vi);
 
-      continue;
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // points
-    if (token[0] == 'p' && IS_SPACE((token[1]))) {
-      token += 2;
+    prim_group.lineGroup.push_back(line);
 
-      __points_t pts;
+    return true;
+  }
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `p' line(e.g. zero value for vertex index. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+  // points
+  if (token[0] == 'p' && IS_SPACE((token[1]))) {
+    token += 2;
 
-        pts.vertex_indices.push_back(vi);
+    __points_t pts;
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index_t vi;
+      if (!parseTriple(&token, static_cast<int>(v.size() / 3),
+                       static_cast<int>(vn.size() / 3),
+                       static_cast<int>(vt.size() / 2), &vi)) {
+        if (err) {
+          std::stringstream ss;
+          ss << "Failed parse `p' line(e.g. zero value for vertex index. "
+                "line "
+             << line_num << ".)\n";
+          (*err) += ss.str();
+        }
+        return false;
       }
 
-      prim_group.pointsGroup.push_back(pts);
+      pts.vertex_indices.push_back(vi);
 
-      continue;
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // face
-    if (token[0] == 'f' && IS_SPACE((token[1]))) {
-      token += 2;
-      token += strspn(token, " \t");
+    prim_group.pointsGroup.push_back(pts);
 
-      face_t face;
+    return true;
+  }
 
-      face.smoothing_group_id = current_smoothing_id;
-      face.vertex_indices.reserve(3);
+  // face
+  if (token[0] == 'f' && IS_SPACE((token[1]))) {
+    token += 2;
+    token += strspn(token, " \t");
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `f' line(e.g. zero value for face index. line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+    face_t face;
 
-        greatest_v_idx = greatest_v_idx > vi.v_idx ? greatest_v_idx : vi.v_idx;
-        greatest_vn_idx =
-            greatest_vn_idx > vi.vn_idx ? greatest_vn_idx : vi.vn_idx;
-        greatest_vt_idx =
-            greatest_vt_idx > vi.vt_idx ? greatest_vt_idx : vi.vt_idx;
+    face.smoothing_group_id = current_smoothing_id;
+    face.vertex_indices.reserve(3);
 
-        face.vertex_indices.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index_t vi;
+      if (!parseTriple(&token, static_cast<int>(v.size() / 3),
+                       static_cast<int>(vn.size() / 3),
+                       static_cast<int>(vt.size() / 2), &vi)) {
+        if (err) {
+          std::stringstream ss;
+          ss << "Failed parse `f' line(e.g. zero value for face index. line "
+             << line_num << ".)\n";
+          (*err) += ss.str();
+        }
+        return false;
       }
 
-      // replace with emplace_back + std::move on C++11
-      prim_group.faceGroup.push_back(face);
+      greatest_v_idx = greatest_v_idx > vi.v_idx ? greatest_v_idx : vi.v_idx;
+      greatest_vn_idx =
+          greatest_vn_idx > vi.vn_idx ? greatest_vn_idx : vi.vn_idx;
+      greatest_vt_idx =
+          greatest_vt_idx > vi.vt_idx ? greatest_vt_idx : vi.vt_idx;
 
-      continue;
+      face.vertex_indices.push_back(vi);
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6))) {
-      token += 6;
-      std::string namebuf = parseString(&token);
+    // replace with emplace_back + std::move on C++11
+    prim_group.faceGroup.push_back(face);
 
-      int newMaterialId = -1;
-      std::map<std::string, int>::const_iterator it = material_map.find(namebuf);
-      if (it != material_map.end()) {
-        newMaterialId = it->second;
-      } else {
-        // { error!! material not found }
-        if (warn) {
-          (*warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
-        }
-      }
+    return true;
+  }
 
-      if (newMaterialId != material) {
-        // Create per-face material. Thus we don't add `shape` to `shapes` at
-        // this time.
-        // just clear `faceGroup` after `exportGroupsToShape()` call.
-        exportGroupsToShape(&shape, prim_group, tags, material, name,
-                            triangulate, v);
-        prim_group.faceGroup.clear();
-        material = newMaterialId;
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6))) {
+    token += 6;
+    std::string namebuf = parseString(&token);
+
+    int newMaterialId = -1;
+    std::map<std::string, int>::const_iterator it = material_map.find(namebuf);
+    if (it != material_map.end()) {
+      newMaterialId = it->second;
+    } else {
+      // { error!! material not found }
+      if (warn) {
+        (*warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
       }
+    }
 
-      continue;
+    if (newMaterialId != material) {
+      // Create per-face material. Thus we don't add `shape` to `shapes` at
+      // this time.
+      // just clear `faceGroup` after `exportGroupsToShape()` call.
+      exportGroupsToShape(&shape, prim_group, tags, material, name,
+                          triangulate, v);
+      prim_group.faceGroup.clear();
+      material = newMaterialId;
     }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
-      if (readMatFn) {
-        token += 7;
+    return true;
+  }
 
-        std::vector<std::string> filenames;
-        SplitString(std::string(token), ' ', filenames);
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+    if (readMatFn) {
+      token += 7;
 
-        if (filenames.empty()) {
-          if (warn) {
-            std::stringstream ss;
-            ss << "Looks like empty filename for mtllib. Use default "
-                  "material (line "
-               << line_num << ".)\n";
+      std::vector<std::string> filenames;
+      SplitString(std::string(token), ' ', filenames);
 
-            (*warn) += ss.str();
+      if (filenames.empty()) {
+        if (warn) {
+          std::stringstream ss;
+          ss << "Looks like empty filename for mtllib. Use default "
+                "material (line "
+             << line_num << ".)\n";
+
+          (*warn) += ss.str();
+        }
+      } else {
+        bool found = false;
+        for (size_t s = 0; s < filenames.size(); s++) {
+          std::string warn_mtl;
+          std::string err_mtl;
+          bool ok = (*readMatFn)(filenames[s].c_str(), materials,
+                                 &material_map, &warn_mtl, &err_mtl);
+          if (warn && (!warn_mtl.empty())) {
+            (*warn) += warn_mtl;
           }
-        } else {
-          bool found = false;
-          for (size_t s = 0; s < filenames.size(); s++) {
-            std::string warn_mtl;
-            std::string err_mtl;
-            bool ok = (*readMatFn)(filenames[s].c_str(), materials,
-                                   &material_map, &warn_mtl, &err_mtl);
-            if (warn && (!warn_mtl.empty())) {
-              (*warn) += warn_mtl;
-            }
 
-            if (err && (!err_mtl.empty())) {
-              (*err) += err_mtl;
-            }
+          if (err && (!err_mtl.empty())) {
+            (*err) += err_mtl;
+          }
 
-            if (ok) {
-              found = true;
-              break;
-            }
+          if (ok) {
+            found = true;
+            break;
           }
+        }
 
-          if (!found) {
-            if (warn) {
-              (*warn) +=
-                  "Failed to load material file(s). Use default "
-                  "material.\n";
-            }
+        if (!found) {
+          if (warn) {
+            (*warn) +=
+                "Failed to load material file(s). Use default "
+                "material.\n";
           }
         }
       }
-
-      continue;
     }
 
-    // group name
-    if (token[0] == 'g' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v);
-      (void)ret;  // return value not used.
+    return true;
+  }
 
-      if (shape.mesh.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
+  // group name
+  if (token[0] == 'g' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
+                                   triangulate, v);
+    (void)ret;  // return value not used.
 
-      shape = shape_t();
+    if (shape.mesh.indices.size() > 0) {
+      shapes->push_back(shape);
+    }
 
-      // material = -1;
-      prim_group.clear();
+    shape = shape_t();
 
-      std::vector<std::string> names;
+    // material = -1;
+    prim_group.clear();
 
-      while (!IS_NEW_LINE(token[0])) {
-        std::string str = parseString(&token);
-        names.push_back(str);
-        token += strspn(token, " \t\r");  // skip tag
-      }
+    std::vector<std::string> names;
 
-      // names[0] must be 'g'
+    while (!IS_NEW_LINE(token[0])) {
+      std::string str = parseString(&token);
+      names.push_back(str);
+      token += strspn(token, " \t\r");  // skip tag
+    }
 
-      if (names.size() < 2) {
-        // 'g' with empty names
-        if (warn) {
-          std::stringstream ss;
-          ss << "Empty group name. line: " << line_num << "\n";
-          (*warn) += ss.str();
-          name = "";
-        }
-      } else {
-        std::stringstream ss;
-        ss << names[1];
+    // names[0] must be 'g'
 
-        // tinyobjloader does not support multiple groups for a primitive.
-        // Currently we concatinate multiple group names with a space to get
-        // single group name.
+    if (names.size() < 2) {
+      // 'g' with empty names
+      if (warn) {
+        std::stringstream ss;
+        ss << "Empty group name. line: " << line_num << "\n";
+        (*warn) += ss.str();
+        name = "";
+      }
+    } else {
+      std::stringstream ss;
+      ss << names[1];
 
-        for (size_t i = 2; i < names.size(); i++) {
-          ss << " " << names[i];
-        }
+      // tinyobjloader does not support multiple groups for a primitive.
+      // Currently we concatinate multiple group names with a space to get
+      // single group name.
 
-        name = ss.str();
+      for (size_t i = 2; i < names.size(); i++) {
+        ss << " " << names[i];
       }
 
-      continue;
+      name = ss.str();
     }
 
-    // object name
-    if (token[0] == 'o' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v);
-      (void)ret;  // return value not used.
-
-      if (shape.mesh.indices.size() > 0 || shape.lines.indices.size() > 0 ||
-          shape.points.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
-
-      // material = -1;
-      prim_group.clear();
-      shape = shape_t();
+    return true;
+  }
 
-      // @todo { multiple object name? }
-      token += 2;
-      std::stringstream ss;
-      ss << token;
-      name = ss.str();
+  // object name
+  if (token[0] == 'o' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
+                                   triangulate, v);
+    (void)ret;  // return value not used.
 
-      continue;
+    if (shape.mesh.indices.size() > 0 || shape.lines.indices.size() > 0 ||
+        shape.points.indices.size() > 0) {
+      shapes->push_back(shape);
     }
 
-    if (token[0] == 't' && IS_SPACE(token[1])) {
-      const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
-      tag_t tag;
+    // material = -1;
+    prim_group.clear();
+    shape = shape_t();
 
-      token += 2;
+    // @todo { multiple object name? }
+    token += 2;
+    std::stringstream ss;
+    ss << token;
+    name = ss.str();
 
-      tag.name = parseString(&token);
+    return true;
+  }
 
-      tag_sizes ts = parseTagTriple(&token);
+  if (token[0] == 't' && IS_SPACE(token[1])) {
+    const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
+    tag_t tag;
 
-      if (ts.num_ints < 0) {
-        ts.num_ints = 0;
-      }
-      if (ts.num_ints > max_tag_nums) {
-        ts.num_ints = max_tag_nums;
-      }
+    token += 2;
 
-      if (ts.num_reals < 0) {
-        ts.num_reals = 0;
-      }
-      if (ts.num_reals > max_tag_nums) {
-        ts.num_reals = max_tag_nums;
-      }
+    tag.name = parseString(&token);
 
-      if (ts.num_strings < 0) {
-        ts.num_strings = 0;
-      }
-      if (ts.num_strings > max_tag_nums) {
-        ts.num_strings = max_tag_nums;
-      }
+    tag_sizes ts = parseTagTriple(&token);
 
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+    if (ts.num_ints < 0) {
+      ts.num_ints = 0;
+    }
+    if (ts.num_ints > max_tag_nums) {
+      ts.num_ints = max_tag_nums;
+    }
 
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = parseInt(&token);
-      }
+    if (ts.num_reals < 0) {
+      ts.num_reals = 0;
+    }
+    if (ts.num_reals > max_tag_nums) {
+      ts.num_reals = max_tag_nums;
+    }
 
-      tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
-        tag.floatValues[i] = parseReal(&token);
-      }
+    if (ts.num_strings < 0) {
+      ts.num_strings = 0;
+    }
+    if (ts.num_strings > max_tag_nums) {
+      ts.num_strings = max_tag_nums;
+    }
 
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        tag.stringValues[i] = parseString(&token);
-      }
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
 
-      tags.push_back(tag);
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+      tag.intValues[i] = parseInt(&token);
+    }
 
-      continue;
+    tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
+      tag.floatValues[i] = parseReal(&token);
     }
 
-    if (token[0] == 's' && IS_SPACE(token[1])) {
-      // smoothing group id
-      token += 2;
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+      tag.stringValues[i] = parseString(&token);
+    }
 
-      // skip space.
-      token += strspn(token, " \t");  // skip space
+    tags.push_back(tag);
 
-      if (token[0] == '\0') {
-        continue;
-      }
+    return true;
+  }
 
-      if (token[0] == '\r' || token[1] == '\n') {
-        continue;
-      }
+  if (token[0] == 's' && IS_SPACE(token[1])) {
+    // smoothing group id
+    token += 2;
+
+    // skip space.
+    token += strspn(token, " \t");  // skip space
 
-      if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
-          token[2] == 'f') {
+    if (token[0] == '\0') {
+      return true;
+    }
+
+    if (token[0] == '\r' || token[1] == '\n') {
+      return true;
+    }
+
+    if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
+        token[2] == 'f') {
+      current_smoothing_id = 0;
+    } else {
+      // assume number
+      int smGroupId = parseInt(&token);
+      if (smGroupId < 0) {
+        // parse error. force set to 0.
+        // FIXME(syoyo): Report warning.
         current_smoothing_id = 0;
       } else {
-        // assume number
-        int smGroupId = parseInt(&token);
-        if (smGroupId < 0) {
-          // parse error. force set to 0.
-          // FIXME(syoyo): Report warning.
-          current_smoothing_id = 0;
-        } else {
-          current_smoothing_id = static_cast<unsigned int>(smGroupId);
-        }
+        current_smoothing_id = static_cast<unsigned int>(smGroupId);
       }
+    }
 
-      continue;
-    }  // smoothing group id
+    return true;
+  }  // smoothing group id
 
-    // Ignore unknown command.
-  }
+  // Ignore unknown command.
+  return true;
+}
+
+// Flushes the last primitive group and moves the parsed data into `attrib`.
+static void FinishObjParse(obj_parse_state *st, attrib_t *attrib,
+                           std::vector<shape_t> *shapes, std::string *warn,
+                           bool triangulate, bool default_vcols_fallback) {
+  std::vector<real_t> &v = st->v;
+  std::vector<real_t> &vn = st->vn;
+  std::vector<real_t> &vt = st->vt;
+  std::vector<real_t> &vc = st->vc;
+  const std::vector<tag_t> &tags = st->tags;
+  PrimGroup &prim_group = st->prim_group;
+  const std::string &name = st->name;
+  const int material = st->material;
+  shape_t &shape = st->shape;
+  const size_t line_num = st->line_num;
+  const int greatest_v_idx = st->greatest_v_idx;
+  const int greatest_vn_idx = st->greatest_vn_idx;
+  const int greatest_vt_idx = st->greatest_vt_idx;
 
   // not all vertices have colors, no default colors desired? -> clear colors
-  if (!found_all_colors && !default_vcols_fallback) {
+  if (!st->found_all_colors && !default_vcols_fallback) {
     vc.clear();
   }
 
@@ -2666,16 +2828,434 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
   }
   prim_group.clear();  // for safety
 
-  if (err) {
-    (*err) += errss.str();
-  }
-
   attrib->vertices.swap(v);
   attrib->vertex_weights.swap(v);
   attrib->normals.swap(vn);
   attrib->texcoords.swap(vt);
   attrib->texcoord_ws.swap(vt);
   attrib->colors.swap(vc);
+}
+
+bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
+             std::vector<material_t> *materials, std::string *warn,
+             std::string *err, std::istream *inStream,
+             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
+             bool default_vcols_fallback) {
+  obj_parse_state st;
+
+  std::string linebuf;
+  while (inStream->peek() != -1) {
+    safeGetline(*inStream, linebuf);
+
+    st.line_num++;
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\n')
+        linebuf.erase(linebuf.size() - 1);
+    }
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\r')
+        linebuf.erase(linebuf.size() - 1);
+    }
+
+    // Skip if empty line.
+    if (linebuf.empty()) {
+      continue;
+    }
+
+    // Skip leading space.
+    const char *token = linebuf.c_str();
+    token += strspn(token, " \t");
+
+    assert(token);
+    if (!ParseObjLine(&st, token, shapes, materials, warn, err, readMatFn,
+                      triangulate, default_vcols_fallback)) {
+      return false;
+    }
+  }
+
+  FinishObjParse(&st, attrib, shapes, warn, triangulate,
+                 default_vcols_fallback);
+
+  return true;
+}
+
+// Smallest chunk handed to a worker thread by LoadObjParallel().
+#ifndef TINYOBJLOADER_PARALLEL_MIN_CHUNK
+#define TINYOBJLOADER_PARALLEL_MIN_CHUNK (64 * 1024)
+#endif
+
+// Face index as written in the .obj file.
+// fixIndex() is applied while merging, since relative indices depend on the
+// number of vertices read so far.
+struct raw_vertex_index_t {
+  int v_idx, vt_idx, vn_idx;
+  bool has_vt, has_vn;
+};
+
+enum obj_line_kind {
+  OBJ_LINE_V = 0,
+  OBJ_LINE_VN,
+  OBJ_LINE_VT,
+  OBJ_LINE_F,
+  OBJ_LINE_OTHER  // parsed by ParseObjLine() while merging
+};
+
+struct obj_line_record {
+  unsigned char kind;
+  bool found_color;          // OBJ_LINE_V
+  unsigned int num_indices;  // OBJ_LINE_F
+  size_t line_num;           // 1-based line number inside the chunk
+  const char *token;         // OBJ_LINE_OTHER
+};
+
+// Newline aligned part of the .obj text, tokenized by one worker.
+struct obj_chunk {
+  char *begin;
+  char *end;
+  size_t num_lines;
+
+  std::vector<real_t> v;   // xyz of `v` lines
+  std::vector<real_t> vc;  // rgb of `v` lines
+  std::vector<real_t> vn;
+  std::vector<real_t> vt;
+  std::vector<raw_vertex_index_t> indices;
+  std::vector<obj_line_record> records;
+
+  obj_chunk() : begin(NULL), end(NULL), num_lines(0) {}
+};
+
+// Same grammar as parseTriple(), but keeps the raw index values.
+static void parseRawFaceTriple(const char **token, raw_vertex_index_t *ret) {
+  ret->v_idx = atoi((*token));
+  ret->vt_idx = 0;
+  ret->vn_idx = 0;
+  ret->has_vt = false;
+  ret->has_vn = false;
+
+  (*token) += strcspn((*token), "/ \t\r");
+  if ((*token)[0] != '/') {
+    return;
+  }
+  (*token)++;
+
+  // i//k
+  if ((*token)[0] == '/') {
+    (*token)++;
+    ret->vn_idx = atoi((*token));
+    ret->has_vn = true;
+    (*token) += strcspn((*token), "/ \t\r");
+    return;
+  }
+
+  // i/j/k or i/j
+  ret->vt_idx = atoi((*token));
+  ret->has_vt = true;
+  (*token) += strcspn((*token), "/ \t\r");
+  if ((*token)[0] != '/') {
+    return;
+  }
+
+  // i/j/k
+  (*token)++;  // skip '/'
+  ret->vn_idx = atoi((*token));
+  ret->has_vn = true;
+  (*token) += strcspn((*token), "/ \t\r");
+}
+
+// Worker: splits the chunk into '\0' terminated lines(same line breaks as
+// safeGetline()) and parses the numeric payload of `v`/`vn`/`vt`/`f`.
+static void TokenizeObjChunk(obj_chunk *chunk) {
+  char *p = chunk->begin;
+  size_t line_num = 0;
+
+  while (p < chunk->end) {
+    char *line = p;
+    while ((p < chunk->end) && (*p != '\n') && (*p != '\r')) {
+      p++;
+    }
+    if (p < chunk->end) {
+      bool crlf = (*p == '\r') && (p + 1 < chunk->end) && (p[1] == '\n');
+      (*p) = '\0';
+      p += crlf ? 2 : 1;
+    }
+    line_num++;
+
+    const char *token = line;
+    token += strspn(token, " \t");
+
+    if (token[0] == '\0') continue;  // empty line
+    if (token[0] == '#') continue;   // comment line
+
+    obj_line_record rec;
+    rec.kind = OBJ_LINE_OTHER;
+    rec.found_color = false;
+    rec.num_indices = 0;
+    rec.line_num = line_num;
+    rec.token = token;
+
+    if (token[0] == 'v' && IS_SPACE((token[1]))) {
+      token += 2;
+      real_t x, y, z;
+      real_t r, g, b;
+      rec.kind = OBJ_LINE_V;
+      rec.found_color =
+          parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+      chunk->v.push_back(x);
+      chunk->v.push_back(y);
+      chunk->v.push_back(z);
+      chunk->vc.push_back(r);
+      chunk->vc.push_back(g);
+      chunk->vc.push_back(b);
+    } else if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y, z;
+      parseReal3(&x, &y, &z, &token);
+      rec.kind = OBJ_LINE_VN;
+      chunk->vn.push_back(x);
+      chunk->vn.push_back(y);
+      chunk->vn.push_back(z);
+    } else if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y;
+      parseReal2(&x, &y, &token);
+      rec.kind = OBJ_LINE_VT;
+      chunk->vt.push_back(x);
+      chunk->vt.push_back(y);
+    } else if (token[0] == 'f' && IS_SPACE((token[1]))) {
+      token += 2;
+      token += strspn(token, " \t");
+      rec.kind = OBJ_LINE_F;
+      while (!IS_NEW_LINE(token[0])) {
+        raw_vertex_index_t vi;
+        parseRawFaceTriple(&token, &vi);
+        chunk->indices.push_back(vi);
+        rec.num_indices++;
+        size_t n = strspn(token, " \t\r");
+        token += n;
+      }
+    }
+
+    chunk->records.push_back(rec);
+  }
+
+  chunk->num_lines = line_num;
+}
+
+bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                     std::vector<material_t> *materials, std::string *warn,
+                     std::string *err, const char *filename,
+                     const char *mtl_basedir, bool triangulate,
+                     bool default_vcols_fallback, unsigned int num_threads) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+  if (!ifs) {
+    std::stringstream errss;
+    errss << "Cannot open file [" << filename << "]" << std::endl;
+    if (err) {
+      (*err) = errss.str();
+    }
+    return false;
+  }
+
+  ifs.seekg(0, std::ios::end);
+  const size_t file_size = static_cast<size_t>(ifs.tellg());
+  ifs.seekg(0, std::ios::beg);
+
+  // +1 for the '\0' which terminates the last line.
+  std::vector<char> text(file_size + 1, '\0');
+  if (file_size > 0) {
+    ifs.read(&text[0], static_cast<std::streamsize>(file_size));
+  }
+  ifs.close();
+
+  std::string baseDir = mtl_basedir ? mtl_basedir : "";
+  if (!baseDir.empty()) {
+#ifndef _WIN32
+    const char dirsep = '/';
+#else
+    const char dirsep = '\\';
+#endif
+    if (baseDir[baseDir.length() - 1] != dirsep) baseDir += dirsep;
+  }
+  MaterialFileReader matFileReader(baseDir);
+
+  return LoadObjParallel(attrib, shapes, materials, warn, err, &text[0],
+                         file_size, &matFileReader, triangulate,
+                         default_vcols_fallback, num_threads);
+}
+
+bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                     std::vector<material_t> *materials, std::string *warn,
+                     std::string *err, char *text, size_t file_size,
+                     MaterialReader *readMatFn, bool triangulate,
+                     bool default_vcols_fallback, unsigned int num_threads) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+#ifndef TINYOBJLOADER_NO_THREADS
+  if (num_threads == 0) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+#endif
+  if (num_threads == 0) {
+    num_threads = 1;
+  }
+
+  size_t num_chunks = file_size / TINYOBJLOADER_PARALLEL_MIN_CHUNK;
+  if (num_chunks > num_threads) num_chunks = num_threads;
+  if (num_chunks < 1) num_chunks = 1;
+
+  // Chunk boundaries are placed just after a '\n', which always ends a line.
+  std::vector<obj_chunk> chunks(num_chunks);
+  char *text_begin = text;
+  char *text_end = text_begin + file_size;
+  char *cur = text_begin;
+  for (size_t i = 0; i < num_chunks; i++) {
+    char *next = text_end;
+    if (i + 1 < num_chunks) {
+      next = text_begin + (file_size * (i + 1)) / num_chunks;
+      if (next < cur) next = cur;
+      while ((next < text_end) && (*next != '\n')) next++;
+      if (next < text_end) next++;
+    }
+    chunks[i].begin = cur;
+    chunks[i].end = next;
+    cur = next;
+  }
+
+#ifndef TINYOBJLOADER_NO_THREADS
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < num_chunks; i++) {
+    workers.push_back(std::thread(TokenizeObjChunk, &chunks[i]));
+  }
+  TokenizeObjChunk(&chunks[0]);
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+#else
+  for (size_t i = 0; i < num_chunks; i++) {
+    TokenizeObjChunk(&chunks[i]);
+  }
+#endif
+
+  // Merge in file order.
+  obj_parse_state st;
+  {
+    size_t num_v = 0, num_vn = 0, num_vt = 0;
+    for (size_t i = 0; i < num_chunks; i++) {
+      num_v += chunks[i].v.size();
+      num_vn += chunks[i].vn.size();
+      num_vt += chunks[i].vt.size();
+    }
+    st.v.reserve(num_v);
+    st.vc.reserve(num_v);
+    st.vn.reserve(num_vn);
+    st.vt.reserve(num_vt);
+  }
+
+  size_t line_base = 0;
+  for (size_t i = 0; i < num_chunks; i++) {
+    const obj_chunk &chunk = chunks[i];
+    size_t v_pos = 0, vn_pos = 0, vt_pos = 0, index_pos = 0;
+
+    for (size_t r = 0; r < chunk.records.size(); r++) {
+      const obj_line_record &rec = chunk.records[r];
+      st.line_num = line_base + rec.line_num;
+
+      switch (rec.kind) {
+        case OBJ_LINE_V:
+          st.found_all_colors &= rec.found_color;
+          st.v.push_back(chunk.v[v_pos + 0]);
+          st.v.push_back(chunk.v[v_pos + 1]);
+          st.v.push_back(chunk.v[v_pos + 2]);
+          if (st.found_all_colors || default_vcols_fallback) {
+            st.vc.push_back(chunk.vc[v_pos + 0]);
+            st.vc.push_back(chunk.vc[v_pos + 1]);
+            st.vc.push_back(chunk.vc[v_pos + 2]);
+          }
+          v_pos += 3;
+          break;
+
+        case OBJ_LINE_VN:
+          st.vn.push_back(chunk.vn[vn_pos + 0]);
+          st.vn.push_back(chunk.vn[vn_pos + 1]);
+          st.vn.push_back(chunk.vn[vn_pos + 2]);
+          vn_pos += 3;
+          break;
+
+        case OBJ_LINE_VT:
+          st.vt.push_back(chunk.vt[vt_pos + 0]);
+          st.vt.push_back(chunk.vt[vt_pos + 1]);
+          vt_pos += 2;
+          break;
+
+        case OBJ_LINE_F: {
+          face_t face;
+
+          face.smoothing_group_id = st.current_smoothing_id;
+          face.vertex_indices.reserve(3);
+
+          const int vsize = static_cast<int>(st.v.size() / 3);
+          const int vnsize = static_cast<int>(st.vn.size() / 3);
+          const int vtsize = static_cast<int>(st.vt.size() / 2);
+
+          for (unsigned int k = 0; k < rec.num_indices; k++) {
+            const raw_vertex_index_t &raw = chunk.indices[index_pos + k];
+            vertex_index_t vi(-1);
+            if (!fixIndex(raw.v_idx, vsize, &(vi.v_idx)) ||
+                (raw.has_vt && !fixIndex(raw.vt_idx, vtsize, &(vi.vt_idx))) ||
+                (raw.has_vn && !fixIndex(raw.vn_idx, vnsize, &(vi.vn_idx)))) {
+              if (err) {
+                std::stringstream ss;
+                ss << "Failed parse `f' line(e.g. zero value for face index. "
+                      "line "
+                   << st.line_num << ".)\n";
+                (*err) += ss.str();
+              }
+              return false;
+            }
+
+            st.greatest_v_idx =
+                st.greatest_v_idx > vi.v_idx ? st.greatest_v_idx : vi.v_idx;
+            st.greatest_vn_idx =
+                st.greatest_vn_idx > vi.vn_idx ? st.greatest_vn_idx : vi.vn_idx;
+            st.greatest_vt_idx =
+                st.greatest_vt_idx > vi.vt_idx ? st.greatest_vt_idx : vi.vt_idx;
+
+            face.vertex_indices.push_back(vi);
+          }
+          index_pos += rec.num_indices;
+
+          st.prim_group.faceGroup.push_back(face);
+          break;
+        }
+
+        default:
+          if (!ParseObjLine(&st, rec.token, shapes, materials, warn, err,
+                            readMatFn, triangulate,
+                            default_vcols_fallback)) {
+            return false;
+          }
+          break;
+      }
+    }
+
+    line_base += chunk.num_lines;
+  }
+  st.line_num = line_base;
+
+  FinishObjParse(&st, attrib, shapes, warn, triangulate,
+                 default_vcols_fallback);
 
   return true;
 }
@@ -2728,7 +3308,12 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
     // vertex
     if (token[0] == 'v' && IS_SPACE((token[1]))) {
       token += 2;
-      // TODO(syoyo): Support parsing vertex color extension.
+      if (callback.vertex_color_cb) {
+        real_t x, y, z, r, g, b;
+        parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+        callback.vertex_color_cb(user_data, x, y, z, r, g, b);
+        continue;
+      }
       real_t x, y, z, w;  // w is optional. default = 1.0
       parseV(&x, &y, &z, &w, &token);
       if (callback.vertex_cb) {
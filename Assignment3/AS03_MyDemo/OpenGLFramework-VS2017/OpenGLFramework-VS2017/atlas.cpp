@@ -0,0 +1,113 @@
+#include "atlas.h"
+
+#include <string.h>
+#include <algorithm>
+
+int AtlasLevelCount(int gutter)
+{
+	int levels = 1;
+	while ((1 << levels) <= gutter)
+		levels++;
+	return levels;
+}
+
+// Cell side of an image side: the image rounded up to the grid, plus a
+// gutter before and after
+static int CellSize(int size, int gutter)
+{
+	return (size + gutter - 1) / gutter * gutter + 2 * gutter;
+}
+
+// Shelves of width atlas_width, tallest cells first; returns the height
+// used, with x and y of rects filled in
+static int PackShelves(std::vector<AtlasRect>& rects, const std::vector<int>& order, int gutter, int atlas_width)
+{
+	int shelf_y = 0, shelf_height = 0, x = 0;
+	for (int i = 0; i < order.size(); i++)
+	{
+		AtlasRect& rect = rects[order[i]];
+		int cell_width = CellSize(rect.width, gutter);
+		int cell_height = CellSize(rect.height, gutter);
+		if (x + cell_width > atlas_width)
+		{
+			shelf_y += shelf_height;
+			shelf_height = 0;
+			x = 0;
+		}
+		rect.x = x + gutter;
+		rect.y = shelf_y + gutter;
+		x += cell_width;
+		shelf_height = std::max(shelf_height, cell_height);
+	}
+	return shelf_y + shelf_height;
+}
+
+bool PackAtlas(std::vector<AtlasRect>& rects, int gutter, int max_size, int* atlas_width, int* atlas_height)
+{
+	std::vector<int> order(rects.size());
+	int widest = 0;
+	for (int i = 0; i < rects.size(); i++)
+	{
+		order[i] = i;
+		widest = std::max(widest, CellSize(rects[i].width, gutter));
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		if (rects[a].height != rects[b].height)
+			return rects[a].height > rects[b].height;
+		return rects[a].width > rects[b].width;
+	});
+
+	// every grid aligned width that holds the widest cell, keeping the one
+	// with the least area, then the squarest
+	int best_width = 0, best_height = 0;
+	for (int width = widest; width <= max_size; width += gutter)
+	{
+		int height = PackShelves(rects, order, gutter, width);
+		if (height > max_size)
+			continue;
+		size_t area = (size_t)width * height, best_area = (size_t)best_width * best_height;
+		if (best_width == 0 || area < best_area || (area == best_area && std::max(width, height) < std::max(best_width, best_height)))
+		{
+			best_width = width;
+			best_height = height;
+		}
+	}
+	if (best_width == 0)
+		return false;
+
+	PackShelves(rects, order, gutter, best_width);
+	*atlas_width = best_width;
+	*atlas_height = best_height;
+	return true;
+}
+
+void BlitAtlasImage(unsigned char* atlas, int atlas_width, const AtlasRect& rect, int gutter, const unsigned char* pixels)
+{
+	int cell_width = CellSize(rect.width, gutter);
+	int cell_height = CellSize(rect.height, gutter);
+	int cell_x = rect.x - gutter, cell_y = rect.y - gutter;
+	for (int y = 0; y < cell_height; y++)
+	{
+		int src_y = std::min(std::max(y - gutter, 0), rect.height - 1);
+		const unsigned char* src = pixels + (size_t)src_y * rect.width * 4;
+		unsigned char* dst = atlas + ((size_t)(cell_y + y) * atlas_width + cell_x) * 4;
+
+		// left gutter, the row, then the right gutter and grid padding
+		for (int x = 0; x < gutter; x++)
+			memcpy(dst + x * 4, src, 4);
+		memcpy(dst + gutter * 4, src, (size_t)rect.width * 4);
+		for (int x = gutter + rect.width; x < cell_width; x++)
+			memcpy(dst + x * 4, src + (size_t)(rect.width - 1) * 4, 4);
+	}
+}
+
+void MapToAtlas(const AtlasRect& rect, int atlas_width, int atlas_height, float* texcoords, size_t count)
+{
+	for (size_t i = 0; i < count; i++, texcoords += 2)
+	{
+		float u = std::min(std::max(texcoords[0], 0.0f), 1.0f);
+		float v = std::min(std::max(texcoords[1], 0.0f), 1.0f);
+		texcoords[0] = (rect.x + u * rect.width) / atlas_width;
+		texcoords[1] = (rect.y + v * rect.height) / atlas_height;
+	}
+}
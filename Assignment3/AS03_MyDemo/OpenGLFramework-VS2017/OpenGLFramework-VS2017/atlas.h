@@ -0,0 +1,40 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <stddef.h>
+#include <vector>
+
+// Several RGBA8 images packed into one texture, so shapes that differ only
+// in their diffuse image can share a texture and a draw call.
+//
+// Each image sits in a cell of its own: the image plus gutter texels on
+// every side, filled by repeating its edge texels. Cells are placed on a
+// grid of gutter texels, so level n of the mip chain still keeps every
+// image apart by gutter >> n texels and nothing bleeds in from a neighbour
+// up to level AtlasLevelCount - 1. gutter must be a power of two.
+
+struct AtlasRect
+{
+	int x;		// of the image's first texel, in atlas texels
+	int y;
+	int width;
+	int height;
+};
+
+// Levels 0 .. AtlasLevelCount(gutter) - 1 are free of bleeding
+int AtlasLevelCount(int gutter);
+
+// Places the images whose width and height are in rects, filling in x and
+// y, into an atlas of at most max_size on a side, choosing the smallest
+// area; false if they do not fit.
+bool PackAtlas(std::vector<AtlasRect>& rects, int gutter, int max_size, int* atlas_width, int* atlas_height);
+
+// Copies a rect.width x rect.height image into its cell of the atlas,
+// gutter included
+void BlitAtlasImage(unsigned char* atlas, int atlas_width, const AtlasRect& rect, int gutter, const unsigned char* pixels);
+
+// Moves count texcoord pairs from [0, 1] of the image into the atlas;
+// coordinates outside [0, 1] are clamped
+void MapToAtlas(const AtlasRect& rect, int atlas_width, int atlas_height, float* texcoords, size_t count);
+
+#endif
@@ -0,0 +1,410 @@
+#include "bcenc.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Mean and principal axis of the 16 pixels of a tile over the first
+// channels channels, the axis by power iteration on the covariance
+static void FitAxis(const unsigned char* tile, int channels, float mean[4], float axis[4])
+{
+	for (int c = 0; c < 4; c++)
+	{
+		mean[c] = 0.0f;
+		axis[c] = 0.0f;
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < channels; c++)
+			mean[c] += tile[i * 4 + c];
+	}
+	for (int c = 0; c < channels; c++)
+		mean[c] /= 16.0f;
+
+	float cov[4][4] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		float d[4];
+		for (int c = 0; c < channels; c++)
+			d[c] = tile[i * 4 + c] - mean[c];
+		for (int a = 0; a < channels; a++)
+		{
+			for (int b = 0; b < channels; b++)
+				cov[a][b] += d[a] * d[b];
+		}
+	}
+
+	// start from the channel with the largest spread
+	int widest = 0;
+	for (int c = 1; c < channels; c++)
+	{
+		if (cov[c][c] > cov[widest][widest])
+			widest = c;
+	}
+	axis[widest] = 1.0f;
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {};
+		float length = 0.0f;
+		for (int a = 0; a < channels; a++)
+		{
+			for (int b = 0; b < channels; b++)
+				next[a] += cov[a][b] * axis[b];
+			length += next[a] * next[a];
+		}
+		if (length == 0.0f)
+			return;
+		length = sqrtf(length);
+		for (int c = 0; c < channels; c++)
+			axis[c] = next[c] / length;
+	}
+}
+
+// The extremes of the tile along axis, as the two starting endpoints
+static void AxisEndpoints(const unsigned char* tile, int channels, const float mean[4], const float axis[4], float e0[4], float e1[4])
+{
+	float low = 0.0f, high = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < channels; c++)
+			t += (tile[i * 4 + c] - mean[c]) * axis[c];
+		low = t < low ? t : low;
+		high = t > high ? t : high;
+	}
+	for (int c = 0; c < 4; c++)
+	{
+		e0[c] = mean[c] + axis[c] * high;
+		e1[c] = mean[c] + axis[c] * low;
+	}
+}
+
+// Least squares endpoints for fixed picks: pixel i is weights[i] * e0 +
+// (1 - weights[i]) * e1. False if every pixel has the same weight.
+static bool RefineEndpoints(const unsigned char* tile, int channels, const float weights[16], float e0[4], float e1[4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float w = weights[i];
+		aa += w * w;
+		ab += w * (1.0f - w);
+		bb += (1.0f - w) * (1.0f - w);
+	}
+	float det = aa * bb - ab * ab;
+	if (det < 1e-6f)
+		return false;
+
+	for (int c = 0; c < channels; c++)
+	{
+		float ax = 0.0f, bx = 0.0f;
+		for (int i = 0; i < 16; i++)
+		{
+			ax += weights[i] * tile[i * 4 + c];
+			bx += (1.0f - weights[i]) * tile[i * 4 + c];
+		}
+		e0[c] = (ax * bb - bx * ab) / det;
+		e1[c] = (bx * aa - ax * ab) / det;
+	}
+	return true;
+}
+
+static int Clamp(int v, int low, int high)
+{
+	return v < low ? low : v > high ? high : v;
+}
+
+// BC1
+
+static unsigned int Pack565(const float rgb[3])
+{
+	int r = Clamp((int)(rgb[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+	int g = Clamp((int)(rgb[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+	int b = Clamp((int)(rgb[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+	return (r << 11) | (g << 5) | b;
+}
+
+static void Unpack565(unsigned int c, int rgb[3])
+{
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Picks for endpoints c0, c1 in the four color mode, which needs c0 > c1;
+// they are swapped if not, and equal endpoints leave a single color.
+// Returns the squared error of the block as the decoder will see it.
+static int PickBc1(const unsigned char* tile, unsigned int& c0, unsigned int& c1, unsigned int indices[16])
+{
+	if (c0 < c1)
+	{
+		unsigned int t = c0;
+		c0 = c1;
+		c1 = t;
+	}
+	int palette[4][3];
+	Unpack565(c0, palette[0]);
+	Unpack565(c1, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+	int colors = c0 == c1 ? 1 : 4;
+
+	int error = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, best_error = 1 << 30;
+		for (int p = 0; p < colors; p++)
+		{
+			int e = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				int d = tile[i * 4 + c] - palette[p][c];
+				e += d * d;
+			}
+			if (e < best_error)
+			{
+				best = p;
+				best_error = e;
+			}
+		}
+		indices[i] = best;
+		error += best_error;
+	}
+	return error;
+}
+
+void EncodeBc1Block(const unsigned char tile[64], unsigned char block[8])
+{
+	static const float kWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+	float mean[4], axis[4], e0[4], e1[4];
+	FitAxis(tile, 3, mean, axis);
+	AxisEndpoints(tile, 3, mean, axis, e0, e1);
+
+	unsigned int best_c0 = 0, best_c1 = 0, best_indices[16] = {};
+	int best_error = 1 << 30;
+	for (int iteration = 0; iteration < 3; iteration++)
+	{
+		unsigned int c0 = Pack565(e0), c1 = Pack565(e1), indices[16];
+		int error = PickBc1(tile, c0, c1, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_c0 = c0;
+			best_c1 = c1;
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+		if (error == 0)
+			break;
+
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = kWeights[indices[i]];
+		if (!RefineEndpoints(tile, 3, weights, e0, e1))
+			break;
+	}
+
+	block[0] = (unsigned char)(best_c0 & 0xff);
+	block[1] = (unsigned char)(best_c0 >> 8);
+	block[2] = (unsigned char)(best_c1 & 0xff);
+	block[3] = (unsigned char)(best_c1 >> 8);
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= best_indices[i] << (2 * i);
+	for (int i = 0; i < 4; i++)
+		block[4 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+// BC7 mode 6
+
+static const int kBc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// An 8 bit endpoint is 7 bits per channel plus a p-bit shared by its four
+// channels; picks the p-bit that lands closest
+static void QuantizeMode6(const float e[4], int q[4])
+{
+	int best_error = 1 << 30;
+	for (int p = 0; p < 2; p++)
+	{
+		int candidate[4], error = 0;
+		for (int c = 0; c < 4; c++)
+		{
+			candidate[c] = Clamp((int)((e[c] - p) / 2.0f + 0.5f), 0, 127) * 2 + p;
+			int d = (int)(e[c] + 0.5f) - candidate[c];
+			error += d * d;
+		}
+		if (error < best_error)
+		{
+			best_error = error;
+			memcpy(q, candidate, sizeof(candidate));
+		}
+	}
+}
+
+static int PickMode6(const unsigned char* tile, const int q0[4], const int q1[4], unsigned int indices[16])
+{
+	int palette[16][4];
+	for (int p = 0; p < 16; p++)
+	{
+		for (int c = 0; c < 4; c++)
+			palette[p][c] = ((64 - kBc7Weights4[p]) * q0[c] + kBc7Weights4[p] * q1[c] + 32) >> 6;
+	}
+
+	int error = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, best_error = 1 << 30;
+		for (int p = 0; p < 16; p++)
+		{
+			int e = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				int d = tile[i * 4 + c] - palette[p][c];
+				e += d * d;
+			}
+			if (e < best_error)
+			{
+				best = p;
+				best_error = e;
+			}
+		}
+		indices[i] = best;
+		error += best_error;
+	}
+	return error;
+}
+
+struct Bc7Writer
+{
+	uint64_t lo = 0;
+	uint64_t hi = 0;
+	int pos = 0;
+
+	void Write(unsigned int value, int bits)
+	{
+		for (int i = 0; i < bits; i++, pos++)
+		{
+			uint64_t bit = (value >> i) & 1;
+			if (pos < 64)
+				lo |= bit << pos;
+			else
+				hi |= bit << (pos - 64);
+		}
+	}
+};
+
+void EncodeBc7Block(const unsigned char tile[64], unsigned char block[16])
+{
+	float mean[4], axis[4], e0[4], e1[4];
+	FitAxis(tile, 4, mean, axis);
+	AxisEndpoints(tile, 4, mean, axis, e0, e1);
+
+	// indices give the weight of q1, so e1 of the fit is q0
+	int best_q0[4] = {}, best_q1[4] = {};
+	unsigned int best_indices[16] = {};
+	int best_error = 1 << 30;
+	for (int iteration = 0; iteration < 3; iteration++)
+	{
+		int q0[4], q1[4];
+		unsigned int indices[16];
+		QuantizeMode6(e1, q0);
+		QuantizeMode6(e0, q1);
+		int error = PickMode6(tile, q0, q1, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			memcpy(best_q0, q0, sizeof(q0));
+			memcpy(best_q1, q1, sizeof(q1));
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+		if (error == 0)
+			break;
+
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = kBc7Weights4[indices[i]] / 64.0f;
+		if (!RefineEndpoints(tile, 4, weights, e0, e1))
+			break;
+	}
+
+	// pixel 0 is stored without the top bit of its index, so it must be < 8;
+	// the weights are symmetric, so swapping the endpoints mirrors the picks
+	if (best_indices[0] >= 8)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			int t = best_q0[c];
+			best_q0[c] = best_q1[c];
+			best_q1[c] = t;
+		}
+		for (int i = 0; i < 16; i++)
+			best_indices[i] = 15 - best_indices[i];
+	}
+
+	Bc7Writer bits;
+	bits.Write(1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		bits.Write(best_q0[c] >> 1, 7);
+		bits.Write(best_q1[c] >> 1, 7);
+	}
+	bits.Write(best_q0[0] & 1, 1);
+	bits.Write(best_q1[0] & 1, 1);
+	bits.Write(best_indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		bits.Write(best_indices[i], 4);
+	for (int i = 0; i < 8; i++)
+	{
+		block[i] = (unsigned char)(bits.lo >> (8 * i));
+		block[8 + i] = (unsigned char)(bits.hi >> (8 * i));
+	}
+}
+
+void EncodeDdsLevel(DdsFormat format, const unsigned char* rgba, int width, int height, unsigned char* blocks, unsigned int threads)
+{
+	int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+	size_t block_bytes = DdsBlockBytes(format);
+	std::atomic<int> next_row(0);
+
+	auto worker = [&]()
+	{
+		unsigned char tile[64];
+		for (int by = next_row++; by < blocks_y; by = next_row++)
+		{
+			unsigned char* out = blocks + (size_t)by * blocks_x * block_bytes;
+			for (int bx = 0; bx < blocks_x; bx++, out += block_bytes)
+			{
+				for (int y = 0; y < 4; y++)
+				{
+					int sy = by * 4 + y < height ? by * 4 + y : height - 1;
+					for (int x = 0; x < 4; x++)
+					{
+						int sx = bx * 4 + x < width ? bx * 4 + x : width - 1;
+						memcpy(tile + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+					}
+				}
+				if (format == DDS_BC1)
+					EncodeBc1Block(tile, out);
+				else
+					EncodeBc7Block(tile, out);
+			}
+		}
+	};
+
+	// small levels are not worth a thread
+	if (threads > (unsigned int)blocks_y)
+		threads = blocks_y;
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; i++)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (int i = 0; i < pool.size(); i++)
+		pool[i].join();
+}
@@ -0,0 +1,25 @@
+#ifndef BCENC_H
+#define BCENC_H
+
+#include <stddef.h>
+
+#include "dds.h"
+
+// CPU encoders for BC1 and BC7, used offline by the texture cooker. Both
+// fit endpoints along the principal axis of the block's colors, pick the
+// closest palette entry per pixel and refine the endpoints by least squares
+// on those picks.
+//
+// BC1 ignores alpha and always uses the four color mode. BC7 writes mode 6
+// only: one subset, RGBA endpoints with a p-bit each, 4 bit indices.
+
+// tile is 4x4 RGBA8, row by row
+void EncodeBc1Block(const unsigned char tile[64], unsigned char block[8]);
+void EncodeBc7Block(const unsigned char tile[64], unsigned char block[16]);
+
+// Encodes width * height RGBA8 pixels, top-down, into the blocks of one
+// level; a partial block repeats its last row and column. Rows of blocks
+// are shared out over threads workers.
+void EncodeDdsLevel(DdsFormat format, const unsigned char* rgba, int width, int height, unsigned char* blocks, unsigned int threads);
+
+#endif
@@ -0,0 +1,918 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <STB/stb_image.h>
+
+#include "objfile.h"
+#include "bcenc.h"
+#include "texturecache.h"
+#include "modeldata.h"
+
+using namespace std;
+
+// Single threaded tinyobj parse of model_path, the reference for LoadObjParallel
+static bool LoadObjSerial(const string& model_path, tinyobj::attrib_t* attrib, vector<tinyobj::shape_t>* shapes, vector<tinyobj::material_t>* materials)
+{
+	string warn, err;
+	ifstream ifs(model_path.c_str());
+	if (!ifs)
+		return false;
+
+	tinyobj::MaterialFileReader matFileReader(GetBaseDir(model_path) + "/");
+	return tinyobj::LoadObj(attrib, shapes, materials, &warn, &err, &ifs, &matFileReader);
+}
+
+static bool SameObj(const tinyobj::attrib_t& a, const vector<tinyobj::shape_t>& as, const tinyobj::attrib_t& b, const vector<tinyobj::shape_t>& bs)
+{
+	if (a.vertices != b.vertices || a.normals != b.normals || a.texcoords != b.texcoords || a.colors != b.colors || as.size() != bs.size())
+		return false;
+
+	for (size_t s = 0; s < as.size(); s++)
+	{
+		const tinyobj::mesh_t& ma = as[s].mesh;
+		const tinyobj::mesh_t& mb = bs[s].mesh;
+		if (as[s].name != bs[s].name || ma.indices.size() != mb.indices.size() || ma.num_face_vertices != mb.num_face_vertices || ma.material_ids != mb.material_ids)
+			return false;
+
+		for (size_t i = 0; i < ma.indices.size(); i++)
+		{
+			if (ma.indices[i].vertex_index != mb.indices[i].vertex_index || ma.indices[i].normal_index != mb.indices[i].normal_index || ma.indices[i].texcoord_index != mb.indices[i].texcoord_index)
+				return false;
+		}
+	}
+	return true;
+}
+
+// `--bench-parse`: serial vs threaded OBJ parse of every model in model_list
+void BenchmarkObjParse()
+{
+	const int rounds = 5;
+	unsigned int thread_counts[] = { 1, 2, 4, 0 };
+
+	for (string model_path : model_list)
+	{
+		tinyobj::attrib_t ref_attrib;
+		vector<tinyobj::shape_t> ref_shapes;
+		vector<tinyobj::material_t> ref_materials;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			if (!LoadObjSerial(model_path, &ref_attrib, &ref_shapes, &ref_materials))
+			{
+				cout << "BenchmarkObjParse: Cannot load " << model_path << endl;
+				break;
+			}
+		}
+		double serial_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+		printf("%s\n  serial            %8.2f ms\n", model_path.c_str(), serial_ms);
+
+		for (unsigned int threads : thread_counts)
+		{
+			tinyobj::attrib_t attrib;
+			vector<tinyobj::shape_t> shapes;
+			vector<tinyobj::material_t> materials;
+			string warn, err;
+
+			start = chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++)
+			{
+				tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), (GetBaseDir(model_path) + "/").c_str(), true, true, threads);
+			}
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+
+			printf("  %2u threads%s  %8.2f ms  x%.2f  %s\n", threads, threads == 0 ? "(auto)" : "      ", ms, serial_ms / ms,
+				SameObj(ref_attrib, ref_shapes, attrib, shapes) ? "identical" : "MISMATCH");
+		}
+	}
+}
+
+// `--bench-cache`: text path (parse + normalization) vs mapped mesh cache
+// for every model in model_list, checking both produce the same streams
+void BenchmarkMeshCache()
+{
+	const int rounds = 5;
+
+	for (string model_path : model_list)
+	{
+		MeshCacheData data;
+		MeshCacheView text_view;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			data = MeshCacheData();
+			if (!BuildModelData(model_path, data))
+				break;
+		}
+		double text_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+		if (data.shapes.empty())
+		{
+			cout << "BenchmarkMeshCache: Cannot load " << model_path << endl;
+			continue;
+		}
+		MakeMeshCacheView(data, &text_view);
+
+		string cache_path = MeshCachePath(model_path, MESH_CACHE_TAG);
+		if (!WriteMeshCache(cache_path, model_path, MESH_CACHE_TAG, data))
+		{
+			cout << "BenchmarkMeshCache: Cannot write " << cache_path << endl;
+			continue;
+		}
+
+		// touch every page so the mapped timing includes faulting the streams in,
+		// as glBufferData would
+		bool hit = true;
+		volatile float sink = 0;
+		start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds && hit; r++)
+		{
+			MappedFile cache_file;
+			MeshCacheView view;
+			hit = ReadMeshCache(cache_path, model_path, MESH_CACHE_TAG, &cache_file, &view);
+			for (size_t i = 0; hit && i < cache_file.size(); i += 4096)
+				sink += cache_file.data()[i];
+		}
+		double cache_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+
+		MappedFile cache_file;
+		MeshCacheView cache_view;
+		bool same = hit && ReadMeshCache(cache_path, model_path, MESH_CACHE_TAG, &cache_file, &cache_view) && SameMeshCacheView(text_view, cache_view);
+
+		printf("%s\n  text   %8.2f ms\n  cache  %8.2f ms  x%.2f  %zu bytes  %s\n", model_path.c_str(), text_ms, cache_ms, text_ms / cache_ms,
+			cache_file.size(), same ? "identical" : "MISMATCH");
+	}
+}
+
+// Peak resident memory of the whole process so far, in bytes
+static size_t PeakMemoryBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// `--bench-ingest`: BuildModelDataFromAttrib vs BuildModelDataStreaming load
+// time for every model in model_list, checking both produce the same streams.
+// The vertex cache pass is left out since it is the same for both.
+// `--bench-ingest attrib|stream` builds every model with one path only and
+// reports the peak memory; the peak cannot be reset, so run each separately.
+void BenchmarkIngest(const string& only)
+{
+	if (!only.empty())
+	{
+		size_t baseline = PeakMemoryBytes();
+		for (string model_path : model_list)
+		{
+			MeshCacheData data;
+			if (only == "attrib" ? !BuildModelDataFromAttrib(model_path, data, false) : !BuildModelDataStreaming(model_path, data, false))
+				cout << "BenchmarkIngest: Cannot load " << model_path << endl;
+		}
+		printf("%s: peak memory %.2f MB (%.2f MB before loading)\n", only.c_str(), PeakMemoryBytes() / 1048576.0, baseline / 1048576.0);
+		return;
+	}
+
+	const int rounds = 5;
+
+	for (string model_path : model_list)
+	{
+		MeshCacheData attrib_data, stream_data;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			attrib_data = MeshCacheData();
+			if (!BuildModelDataFromAttrib(model_path, attrib_data, false))
+				break;
+		}
+		double attrib_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+
+		start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			stream_data = MeshCacheData();
+			if (!BuildModelDataStreaming(model_path, stream_data, false))
+				break;
+		}
+		double stream_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+
+		if (attrib_data.shapes.empty())
+		{
+			cout << "BenchmarkIngest: Cannot load " << model_path << endl;
+			continue;
+		}
+
+		MeshCacheView attrib_view, stream_view;
+		MakeMeshCacheView(attrib_data, &attrib_view);
+		MakeMeshCacheView(stream_data, &stream_view);
+
+		printf("%s\n  attrib  %8.2f ms\n  stream  %8.2f ms  x%.2f  %s\n", model_path.c_str(), attrib_ms, stream_ms, attrib_ms / stream_ms,
+			SameMeshCacheView(attrib_view, stream_view) ? "identical" : "MISMATCH");
+	}
+}
+
+// Every diffuse texture of the TextureModels set: the images named by the
+// .mtl of each model in Model_List.txt, once per material
+static vector<string> ListModelTextures(const string& dir, int* mtl_count)
+{
+	ifstream list((dir + "Model_List.txt").c_str());
+	vector<string> image_paths;
+	string line;
+	*mtl_count = 0;
+	while (getline(list, line))
+	{
+		size_t slash = line.find_last_of("/\\");
+		string name = line.substr(slash == string::npos ? 0 : slash + 1);
+		if (name.size() < 4 || name.compare(name.size() - 4, 4, ".obj") != 0)
+			continue;
+		name.erase(name.size() - 4);
+
+		vector<tinyobj::material_t> materials;
+		map<string, int> material_map;
+		string warn, err;
+		MappedMaterialReader reader(dir);
+		if (!reader(name + ".obj.mtl", &materials, &material_map, &warn, &err) && !reader(name + ".mtl", &materials, &material_map, &warn, &err))
+			continue;
+		(*mtl_count)++;
+		for (int i = 0; i < materials.size(); i++)
+		{
+			if (!materials[i].diffuse_texname.empty())
+				image_paths.push_back(dir + materials[i].diffuse_texname);
+		}
+	}
+	return image_paths;
+}
+
+// Acquires every image of image_paths and decodes the misses on the
+// workers, into heap buffers. The caller releases handles and frees buffers.
+static double LoadTexturesOnWorkers(const vector<string>& image_paths, vector<int>& handles, vector<unsigned char*>& buffers)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int i = 0; i < image_paths.size(); i++)
+		handles.push_back(AcquireTexture(image_paths[i]));
+	DecodeWaitingTextures(buffers);
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// --bench-textures: every texture of ListModelTextures through the texture
+// cache and the decode workers, against decoding each image in turn on one
+// thread. Heap buffers stand in for the PBOs the render thread maps, so no
+// GL is needed.
+// The last run then loads the whole set again while the first is held.
+// Images with a .dds next to them are loaded from it as on a context with
+// every BCn format, and the .dds files are listed with their software decode.
+void BenchmarkTextureCache()
+{
+	int mtl_count;
+	vector<string> image_paths = ListModelTextures("../TextureModels/", &mtl_count);
+
+	size_t uncached_bytes = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int i = 0; i < image_paths.size(); i++)
+	{
+		MappedFile file;
+		DecodedImage image;
+		if (file.Open(image_paths[i]) && DecodeTextureImage(image_paths[i], file, image))
+		{
+			uncached_bytes += MipChainBytes(image.width, image.height);
+			stbi_image_free(image.data);
+		}
+	}
+	double uncached_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	printf("%d .mtl files, %zu textured materials\n", mtl_count, image_paths.size());
+	printf("  serial decode     %8.2f ms  %.2f MB GPU\n", uncached_ms, uncached_bytes / (1024.0 * 1024.0));
+
+	vector<string> dds_paths;
+	for (int i = 0; i < image_paths.size(); i++)
+	{
+		string dds_path = DdsSiblingPath(image_paths[i]);
+		MappedFile file;
+		DdsImage dds;
+		if (find(dds_paths.begin(), dds_paths.end(), dds_path) != dds_paths.end() || !file.Open(dds_path) || !ParseDds(file.data(), file.size(), dds))
+			continue;
+		dds_paths.push_back(dds_path);
+
+		vector<unsigned char> rgba(DdsRgbaBytes(dds));
+		start = chrono::steady_clock::now();
+		size_t offset = 0;
+		for (int l = 0; l < dds.levels.size(); l++)
+		{
+			DecodeDdsLevel(dds.format, (const unsigned char*)file.data() + dds.levels[l].offset, dds.levels[l].width, dds.levels[l].height, &rgba[offset]);
+			offset += (size_t)dds.levels[l].width * dds.levels[l].height * 4;
+		}
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		printf("  %s: %s %dx%d, %zu levels, %.2f MB vs %.2f MB RGBA8, software decode %.2f ms\n", dds_path.c_str(), DdsFormatName(dds.format),
+			dds.width, dds.height, dds.levels.size(), DdsBytes(dds) / (1024.0 * 1024.0), DdsRgbaBytes(dds) / (1024.0 * 1024.0), ms);
+	}
+	for (int f = DDS_BC1; f <= DDS_BC7; f++)
+		dds_format_supported[f] = true;
+
+	const unsigned int thread_counts[] = { 1, 2, 4, 0 };
+	for (unsigned int threads : thread_counts)
+	{
+		ResetTextureCacheStats();
+		decode_threads = threads;
+		StartTextureDecoders();
+
+		vector<int> handles;
+		vector<unsigned char*> buffers;
+		double ms = LoadTexturesOnWorkers(image_paths, handles, buffers);
+		printf("  %u threads%s  %8.2f ms  x%.2f\n", threads, threads == 0 ? "(auto)" : "      ", ms, uncached_ms / ms);
+
+		if (threads == 0)
+		{
+			start = chrono::steady_clock::now();
+			for (int i = 0; i < image_paths.size(); i++)
+				handles.push_back(AcquireTexture(image_paths[i]));
+			ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			printf("  reloaded          %8.2f ms  x%.2f\n  ", ms, uncached_ms / ms);
+			PrintTextureCacheStats();
+		}
+
+		StopTextureDecoders();
+		// Nothing was uploaded, so releasing makes no GL calls
+		for (int i = 0; i < handles.size(); i++)
+			ReleaseTexture(handles[i]);
+		for (int i = 0; i < buffers.size(); i++)
+			free(buffers[i]);
+	}
+}
+
+// --cook-textures [bc1|bc7] [box|kaiser] [--force] [--threads N]: encodes
+// every texture of ListModelTextures, with a full mip chain built in linear
+// light by the given filter, to the .dds next to it, which AcquireTexture
+// then prefers over the image. A cooked texture loads with no decode and no
+// glGenerateMipmap. Existing .dds files are kept unless --force is given,
+// which also rewrites the shipped earth.dds and moon.dds.
+void CookTextures(DdsFormat format, MipFilter filter, bool force, unsigned int threads)
+{
+	if (threads == 0)
+		threads = max(thread::hardware_concurrency(), 1u);
+	// DDS rows are top-down, as the image files are
+	stbi_set_flip_vertically_on_load(false);
+
+	int mtl_count;
+	vector<string> image_paths = ListModelTextures("../TextureModels/", &mtl_count);
+	sort(image_paths.begin(), image_paths.end());
+	image_paths.erase(unique(image_paths.begin(), image_paths.end()), image_paths.end());
+	printf("Cooking %zu textures to %s, %s filtered mips, on %u threads\n", image_paths.size(), DdsFormatName(format), MipFilterName(filter), threads);
+
+	size_t total_pixels = 0, total_source = 0, total_rgba = 0, total_dds = 0;
+	double total_ms = 0.0;
+	for (int i = 0; i < image_paths.size(); i++)
+	{
+		string dds_path = DdsSiblingPath(image_paths[i]);
+		string name = image_paths[i].substr(image_paths[i].find_last_of("/\\") + 1);
+		MappedFile existing;
+		if (!force && existing.Open(dds_path))
+		{
+			printf("  %-22s kept %s\n", name.c_str(), dds_path.c_str());
+			continue;
+		}
+
+		MappedFile file;
+		DecodedImage image;
+		if (!file.Open(image_paths[i]) || !DecodeTextureImage(image_paths[i], file, image))
+			continue;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		vector<MipLevel> levels;
+		BuildMipChain(image.data, image.width, image.height, levels, filter);
+		double mip_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		size_t block_bytes = DdsBlockBytes(format), dds_bytes = 0, pixels = 0;
+		for (int l = 0; l < levels.size(); l++)
+		{
+			dds_bytes += (size_t)((levels[l].width + 3) / 4) * ((levels[l].height + 3) / 4) * block_bytes;
+			pixels += (size_t)levels[l].width * levels[l].height;
+		}
+		vector<unsigned char> blocks(dds_bytes);
+		start = chrono::steady_clock::now();
+		size_t offset = 0;
+		for (int l = 0; l < levels.size(); l++)
+		{
+			EncodeDdsLevel(format, &levels[l].pixels[0], levels[l].width, levels[l].height, &blocks[offset], threads);
+			offset += (size_t)((levels[l].width + 3) / 4) * ((levels[l].height + 3) / 4) * block_bytes;
+		}
+		double encode_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		// error of the top level as the GPU will sample it, RGB only
+		vector<unsigned char> decoded((size_t)image.width * image.height * 4);
+		DecodeDdsLevel(format, &blocks[0], image.width, image.height, &decoded[0]);
+		double squared = 0.0;
+		for (size_t p = 0; p < decoded.size(); p++)
+		{
+			if ((p & 3) != 3)
+				squared += (double)(decoded[p] - image.data[p]) * (decoded[p] - image.data[p]);
+		}
+		double mse = squared / ((double)image.width * image.height * 3);
+		double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+
+		if (!WriteDds(dds_path.c_str(), format, image.width, image.height, (int)levels.size(), &blocks[0], blocks.size()))
+		{
+			cout << "CookTextures: Cannot write " << dds_path << endl;
+			stbi_image_free(image.data);
+			continue;
+		}
+
+		size_t rgba_bytes = MipChainBytes(image.width, image.height);
+		printf("  %-22s %4dx%-4d %2zu levels  mips %6.2f ms  encode %7.2f ms  %6.2f MPix/s  PSNR %5.2f dB  %7.1f KB file, %7.1f KB RGBA8 -> %7.1f KB (x%.1f)\n",
+			name.c_str(), image.width, image.height, levels.size(), mip_ms, encode_ms, pixels / (encode_ms * 1000.0), psnr,
+			file.size() / 1024.0, rgba_bytes / 1024.0, dds_bytes / 1024.0, (double)rgba_bytes / dds_bytes);
+		stbi_image_free(image.data);
+
+		total_pixels += pixels;
+		total_source += file.size();
+		total_rgba += rgba_bytes;
+		total_dds += dds_bytes;
+		total_ms += encode_ms;
+	}
+
+	if (total_dds > 0)
+	{
+		printf("Cooked %.2f MPix in %.1f ms (%.2f MPix/s): %.2f MB of images, %.2f MB as RGBA8 with mips -> %.2f MB of %s (x%.1f)\n",
+			total_pixels / 1e6, total_ms, total_pixels / (total_ms * 1000.0), total_source / (1024.0 * 1024.0),
+			total_rgba / (1024.0 * 1024.0), total_dds / (1024.0 * 1024.0), DdsFormatName(format), (double)total_rgba / total_dds);
+	}
+}
+
+// Upload of the decoded set on the current context, finished: level 0 and
+// glGenerateMipmap, or every level of chains when given
+static double UploadMipmapsTimed(const vector<DecodedImage>& images, const vector<vector<unsigned char> >* chains)
+{
+	vector<GLuint> textures(images.size());
+	glGenTextures((GLsizei)textures.size(), &textures[0]);
+	glFinish();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int i = 0; i < images.size(); i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		if (chains == NULL)
+		{
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, images[i].width, images[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, images[i].data);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			continue;
+		}
+		int width = images[i].width, height = images[i].height, levels = MipLevelCount(width, height);
+		const unsigned char* pixels = &(*chains)[i][0];
+		for (int l = 0; l < levels; l++)
+		{
+			glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+			pixels += (size_t)width * height * 4;
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	}
+	glFinish();
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glDeleteTextures((GLsizei)textures.size(), &textures[0]);
+	return ms;
+}
+
+// --bench-mipmaps: GenerateMipChain over the images of ListModelTextures,
+// each filter scalar and with SIMD, then the texture cache loading the set
+// with the mips left to GL and made by the decode workers. Last, on a hidden
+// window if one can be made, glGenerateMipmap against uploading the CPU
+// levels.
+void BenchmarkMipmaps()
+{
+	int mtl_count;
+	vector<string> image_paths = ListModelTextures("../TextureModels/", &mtl_count);
+	sort(image_paths.begin(), image_paths.end());
+	image_paths.erase(unique(image_paths.begin(), image_paths.end()), image_paths.end());
+
+	vector<DecodedImage> images;
+	size_t pixels = 0, chain_bytes = 0, npot = 0;
+	for (int i = 0; i < image_paths.size(); i++)
+	{
+		MappedFile file;
+		DecodedImage image;
+		if (!file.Open(image_paths[i]) || !DecodeTextureImage(image_paths[i], file, image))
+			continue;
+		images.push_back(image);
+		pixels += (size_t)image.width * image.height;
+		chain_bytes += MipChainBytes(image.width, image.height);
+		if ((image.width & (image.width - 1)) != 0 || (image.height & (image.height - 1)) != 0)
+			npot++;
+	}
+	printf("%zu textures (%zu non power of two), %.2f MPix, %.2f MB as RGBA8 with mips; SIMD: %s\n",
+		images.size(), npot, pixels / 1e6, chain_bytes / (1024.0 * 1024.0), MipSimdName());
+
+	vector<vector<unsigned char> > chains(images.size());
+	for (int i = 0; i < images.size(); i++)
+		chains[i].resize(MipChainBytes(images[i].width, images[i].height));
+	const MipFilter filters[] = { MIP_FILTER_BOX, MIP_FILTER_KAISER };
+	for (MipFilter filter : filters)
+	{
+		double ms[2];
+		for (int simd = 0; simd < 2; simd++)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (int i = 0; i < images.size(); i++)
+			{
+				memcpy(&chains[i][0], images[i].data, (size_t)images[i].width * images[i].height * 4);
+				GenerateMipChain(&chains[i][0], images[i].width, images[i].height, filter, simd == 1);
+			}
+			ms[simd] = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		}
+		printf("  %-6s scalar %8.2f ms  %s %8.2f ms  %6.2f MPix/s  x%.2f\n", MipFilterName(filter), ms[0], MipSimdName(), ms[1],
+			pixels / (ms[1] * 1000.0), ms[0] / ms[1]);
+	}
+
+	// the chains are box filtered again for the upload below
+	for (int i = 0; i < images.size(); i++)
+	{
+		memcpy(&chains[i][0], images[i].data, (size_t)images[i].width * images[i].height * 4);
+		GenerateMipChain(&chains[i][0], images[i].width, images[i].height, MIP_FILTER_BOX);
+	}
+
+	prefer_dds_textures = false;
+	decode_threads = 0;
+	StartTextureDecoders();
+	const char* modes[] = { "gl", "box", "kaiser" };
+	for (int m = 0; m < 3; m++)
+	{
+		cpu_mipmaps = m > 0;
+		mipmap_filter = m == 2 ? MIP_FILTER_KAISER : MIP_FILTER_BOX;
+		vector<int> handles;
+		vector<unsigned char*> buffers;
+		double ms = LoadTexturesOnWorkers(image_paths, handles, buffers);
+		printf("  decode workers, --mipmaps %-6s %8.2f ms\n", modes[m], ms);
+		for (int i = 0; i < handles.size(); i++)
+			ReleaseTexture(handles[i]);
+		for (int i = 0; i < buffers.size(); i++)
+			free(buffers[i]);
+	}
+	StopTextureDecoders();
+	cpu_mipmaps = false;
+	mipmap_filter = MIP_FILTER_BOX;
+
+	GLFWwindow* window = NULL;
+	if (glfwInit())
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(64, 64, "mipmaps", NULL, NULL);
+	}
+	if (window == NULL)
+	{
+		printf("  no GL context, glGenerateMipmap comparison skipped\n");
+	}
+	else
+	{
+		glfwMakeContextCurrent(window);
+		if (gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+		{
+			UploadMipmapsTimed(images, NULL); // first use of the driver paths
+			double gl_ms = UploadMipmapsTimed(images, NULL);
+			double cpu_ms = UploadMipmapsTimed(images, &chains);
+			printf("  %s\n  level 0 + glGenerateMipmap %8.2f ms\n  every level (box, CPU)     %8.2f ms on the render thread\n",
+				(const char*)glGetString(GL_RENDERER), gl_ms, cpu_ms);
+		}
+		else
+		{
+			printf("  cannot load GL, glGenerateMipmap comparison skipped\n");
+		}
+		glfwDestroyWindow(window);
+	}
+	glfwTerminate();
+
+	for (int i = 0; i < images.size(); i++)
+		stbi_image_free(images[i].data);
+}
+
+// --bench-batching: every model of model_list prepared with no batching,
+// with atlases and with texture arrays before atlases, their textures
+// decoded on the workers as in --bench-textures. The per-model lines come
+// from MergeBatchedMaterials; the totals sum the draw calls and binds of one
+// frame of each model.
+void BenchmarkBatching()
+{
+	decode_threads = 0;
+	StartTextureDecoders();
+	const char* pass_names[] = { "No batching (--no-atlas)", "Atlases", "Texture arrays, then atlases (--texture-arrays)" };
+	for (int pass = 0; pass < 3; pass++)
+	{
+		texture_atlases = pass > 0;
+		texture_arrays = pass == 2;
+		printf("%s\n", pass_names[pass]);
+
+		vector<unique_ptr<PreparedModel> > prepared;
+		vector<unsigned char*> buffers;
+		int shapes = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int i = 0; i < model_list.size(); i++)
+		{
+			prepared.push_back(unique_ptr<PreparedModel>(new PreparedModel));
+			if (!PrepareModel(model_list[i], *prepared.back()))
+			{
+				prepared.pop_back();
+				continue;
+			}
+			shapes += (int)prepared.back()->view.shapes.size();
+		}
+		DecodeWaitingTextures(buffers);
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		size_t bytes;
+		int textures = CountDecodedTextures(&bytes);
+		printf("  %zu models, %d shapes: %d draw calls and %d texture binds, %d textures (%.2f MB), prepared and decoded in %.2f ms\n",
+			prepared.size(), shapes, 2 * shapes, shapes, textures, bytes / (1024.0 * 1024.0), ms);
+
+		// Nothing was uploaded, so releasing makes no GL calls
+		for (int i = 0; i < prepared.size(); i++)
+		{
+			for (int m = 0; m < prepared[i]->textures.size(); m++)
+				ReleaseTexture(prepared[i]->textures[m]);
+		}
+		for (int i = 0; i < buffers.size(); i++)
+			free(buffers[i]);
+	}
+	StopTextureDecoders();
+	texture_atlases = true;
+	texture_arrays = false;
+}
+
+// --bench-residency [MB]: the textures of every model of model_list under a
+// budget of MB, 16 by default, against no budget, viewing each model in
+// turn for a few frames, twice round. Every load lands in the frame it is
+// planned, so this measures PlanResidency alone: nothing is decoded or
+// uploaded, the sizes are those of the texture cache entries as
+// PrepareModel leaves them, their tails resident.
+void BenchmarkResidency(double budget_mb)
+{
+	const int kFramesPerModel = 4;
+	texture_budget = (size_t)(budget_mb * 1024 * 1024);
+	vector<unique_ptr<PreparedModel> > prepared;
+	for (int i = 0; i < model_list.size(); i++)
+	{
+		prepared.push_back(unique_ptr<PreparedModel>(new PreparedModel));
+		if (!PrepareModel(model_list[i], *prepared.back()))
+			prepared.pop_back();
+	}
+
+	vector<TextureResidency> textures;
+	int texture_count = 0;
+	size_t full_bytes = 0, tail_bytes = 0;
+	DescribeTextureCache(textures);
+	for (int i = 0; i < textures.size(); i++)
+	{
+		if (!textures[i].busy)
+		{
+			texture_count++;
+			full_bytes += ResidentBytes(textures[i], 0);
+			tail_bytes += ResidentBytes(textures[i], textures[i].base_level);
+		}
+	}
+	printf("%zu models, %d textures: %.2f MB at full resolution, %.2f MB as tails of %d texels\n",
+		prepared.size(), texture_count, full_bytes / (1024.0 * 1024.0), tail_bytes / (1024.0 * 1024.0), kStreamTailSize);
+
+	const char* pass_names[] = { "No budget", "Budget" };
+	for (int pass = 0; pass < 2; pass++)
+	{
+		vector<TextureResidency> planned = textures;
+		size_t budget = pass == 0 ? (size_t)-1 : texture_budget;
+		vector<ResidencyChange> changes;
+		vector<int> bases(planned.size());
+		int frame = 0, promotions = 0, trims = 0, sharp_frames = 0;
+		size_t loaded_bytes = 0, peak_bytes = 0;
+		for (int round = 0; round < 2; round++)
+		{
+			for (int m = 0; m < prepared.size(); m++)
+			{
+				for (int f = 0; f < kFramesPerModel; f++)
+				{
+					frame++;
+					for (int t = 0; t < prepared[m]->textures.size(); t++)
+					{
+						if (prepared[m]->textures[t] >= 0)
+							planned[prepared[m]->textures[t]].last_used = frame;
+					}
+					for (int i = 0; i < planned.size(); i++)
+						bases[i] = planned[i].base_level;
+					changes.clear();
+					PlanResidency(planned, budget, frame, changes);
+
+					for (int i = 0; i < changes.size(); i++)
+					{
+						const TextureResidency& texture = planned[changes[i].texture];
+						if (changes[i].base_level > bases[changes[i].texture])
+						{
+							trims++;
+							continue;
+						}
+						promotions++;
+						loaded_bytes += ResidentBytes(texture, changes[i].base_level) - ResidentBytes(texture, bases[changes[i].texture]);
+					}
+					size_t committed = 0;
+					bool sharp = true;
+					for (int i = 0; i < planned.size(); i++)
+					{
+						committed += ResidentBytes(planned[i], planned[i].base_level);
+						if (planned[i].last_used == frame && planned[i].base_level > planned[i].finest_level)
+							sharp = false;
+					}
+					peak_bytes = max(peak_bytes, committed);
+					sharp_frames += sharp ? 1 : 0;
+				}
+			}
+		}
+		if (pass == 0)
+			printf("%s\n", pass_names[pass]);
+		else
+			printf("%s of %.2f MB\n", pass_names[pass], budget / (1024.0 * 1024.0));
+		printf("  peak %.2f MB resident, %d promotions (%.2f MB loaded), %d trims, viewed model at full resolution in %d of %d frames\n",
+			peak_bytes / (1024.0 * 1024.0), promotions, loaded_bytes / (1024.0 * 1024.0), trims, sharp_frames, frame);
+	}
+
+	// Nothing was uploaded, so releasing makes no GL calls
+	for (int i = 0; i < prepared.size(); i++)
+	{
+		for (int t = 0; t < prepared[i]->textures.size(); t++)
+			ReleaseTexture(prepared[i]->textures[t]);
+	}
+	texture_budget = 0;
+}
+
+// The per-material rescan SplitShapeByMaterial replaced, kept as the
+// reference for --bench-split
+static vector<MeshCacheShape> SplitShapeByMaterialScan(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, int material_count)
+{
+	vector<MeshCacheShape> res;
+	for (int m = 0; m < material_count; m++)
+	{
+		MeshCacheShape tmp_shape;
+		vector<GLfloat>& m_vertices = tmp_shape.streams[MESHCACHE_POSITION];
+		vector<GLfloat>& m_colors = tmp_shape.streams[MESHCACHE_COLOR];
+		vector<GLfloat>& m_normals = tmp_shape.streams[MESHCACHE_NORMAL];
+		vector<GLfloat>& m_textureCoords = tmp_shape.streams[MESHCACHE_TEXCOORD];
+		for (int v = 0; v < material_id.size(); v++) 
+		{
+			// extract all vertices with same material id and create a new shape for it.
+			if (material_id[v] == m)
+			{
+				m_vertices.push_back(vertices[v * 3 + 0]);
+				m_vertices.push_back(vertices[v * 3 + 1]);
+				m_vertices.push_back(vertices[v * 3 + 2]);
+
+				m_colors.push_back(colors[v * 3 + 0]);
+				m_colors.push_back(colors[v * 3 + 1]);
+				m_colors.push_back(colors[v * 3 + 2]);
+
+				m_normals.push_back(normals[v * 3 + 0]);
+				m_normals.push_back(normals[v * 3 + 1]);
+				m_normals.push_back(normals[v * 3 + 2]);
+
+				m_textureCoords.push_back(textureCoords[v * 2 + 0]);
+				m_textureCoords.push_back(textureCoords[v * 2 + 1]);
+			}
+		}
+
+		if (!m_vertices.empty())
+		{
+			tmp_shape.material_id = m;
+			res.push_back(tmp_shape);
+		}
+	}
+
+	return res;
+}
+
+// `--bench-split`: counting sort vs per-material rescan split of every model
+// in model_list, plus the whole text path load time
+void BenchmarkSplit()
+{
+	const int rounds = 5;
+
+	for (string model_path : model_list)
+	{
+		tinyobj::attrib_t attrib;
+		vector<tinyobj::shape_t> shapes;
+		vector<tinyobj::material_t> materials;
+		string warn, err;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		MeshCacheData data;
+		if (!BuildModelData(model_path, data))
+		{
+			cout << "BenchmarkSplit: Cannot load " << model_path << endl;
+			continue;
+		}
+		double load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), (GetBaseDir(model_path) + "/").c_str());
+		normalization(attrib.vertices);
+
+		double scan_ms = 0, sort_ms = 0;
+		bool same = true;
+		for (int i = 0; i < shapes.size(); i++)
+		{
+			vector<GLfloat> vertices, colors, normals, textureCoords;
+			vector<int> material_id;
+			ExpandShapeCorners(&attrib, &shapes[i], vertices, colors, normals, textureCoords, material_id);
+
+			vector<MeshCacheShape> scan, sorted;
+			start = chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++)
+				scan = SplitShapeByMaterialScan(vertices, colors, normals, textureCoords, material_id, materials.size());
+			scan_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+
+			start = chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++)
+				sorted = SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, materials.size());
+			sort_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / rounds;
+
+			same = same && scan.size() == sorted.size();
+			for (int b = 0; same && b < scan.size(); b++)
+			{
+				same = scan[b].material_id == sorted[b].material_id;
+				for (int k = 0; same && k < MESHCACHE_STREAM_COUNT; k++)
+					same = scan[b].streams[k] == sorted[b].streams[k];
+			}
+		}
+
+		printf("%s\n  %d materials  load %8.2f ms\n  split scan  %8.2f ms\n  split sort  %8.2f ms  x%.2f  %s\n", model_path.c_str(), int(materials.size()), load_ms,
+			scan_ms, sort_ms, scan_ms / sort_ms, same ? "identical" : "MISMATCH");
+	}
+}
+
+// `--bench-vcache`: ACMR (shaded vertices per triangle) and ATVR (shaded
+// vertices per unique vertex) of every model in model_list before and
+// after OptimizeVertexCache
+void BenchmarkVertexCache()
+{
+	for (string model_path : model_list)
+	{
+		MeshCacheData data;
+		if (!BuildModelData(model_path, data, false))
+		{
+			cout << "BenchmarkVertexCache: Cannot load " << model_path << endl;
+			continue;
+		}
+
+		int triangles = 0, vertices = 0, before = 0, after = 0;
+		MeshCacheView view;
+		MakeMeshCacheView(data, &view);
+		for (int i = 0; i < view.shapes.size(); i++)
+		{
+			triangles += view.shapes[i].index_count / 3;
+			vertices += view.shapes[i].stream_sizes[MESHCACHE_POSITION] / 3;
+			before += SimulateVertexCache(view.shapes[i], VERTEX_CACHE_SIZE);
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int i = 0; i < data.shapes.size(); i++)
+		{
+			OptimizeVertexCache(data.shapes[i]);
+		}
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		MakeMeshCacheView(data, &view);
+		for (int i = 0; i < view.shapes.size(); i++)
+		{
+			after += SimulateVertexCache(view.shapes[i], VERTEX_CACHE_SIZE);
+		}
+
+		printf("%s\n  %d triangles  %d vertices  %.2f ms\n  ACMR %.3f -> %.3f\n  ATVR %.3f -> %.3f\n", model_path.c_str(), triangles, vertices, ms,
+			(double)before / triangles, (double)after / triangles, (double)before / vertices, (double)after / vertices);
+	}
+}
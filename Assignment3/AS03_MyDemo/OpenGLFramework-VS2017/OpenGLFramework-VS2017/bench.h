@@ -0,0 +1,26 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+
+#include "dds.h"
+#include "mipmap.h"
+
+// Command line modes run by main instead of the viewer: the benchmarks, over
+// every model of model_list or every texture its .mtl files name, and the
+// offline texture cooker. Each prints its results and returns.
+
+void BenchmarkObjParse();					// --bench-parse
+void BenchmarkMeshCache();					// --bench-cache
+void BenchmarkIngest(const std::string& only);	// --bench-ingest [attrib|stream]
+void BenchmarkTextureCache();				// --bench-textures
+void BenchmarkMipmaps();					// --bench-mipmaps
+void BenchmarkBatching();					// --bench-batching
+void BenchmarkResidency(double budget_mb);	// --bench-residency [MB]
+void BenchmarkSplit();						// --bench-split
+void BenchmarkVertexCache();				// --bench-vcache
+
+// --cook-textures [bc1|bc7] [box|kaiser] [--force] [--threads N]
+void CookTextures(DdsFormat format, MipFilter filter, bool force, unsigned int threads);
+
+#endif
@@ -0,0 +1,516 @@
+#include "dds.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Byte offsets into the file: "DDS ", the 124 byte DDS_HEADER and, when the
+// FourCC says DX10, the 20 byte DDS_HEADER_DXT10 before the data
+static const size_t kDdsHeaderSize = 4 + 124;
+static const size_t kDdsDx10HeaderSize = 20;
+
+static const uint32_t kDdsdCaps = 0x1;
+static const uint32_t kDdsdHeight = 0x2;
+static const uint32_t kDdsdWidth = 0x4;
+static const uint32_t kDdsdPixelFormat = 0x1000;
+static const uint32_t kDdsdMipMapCount = 0x20000;
+static const uint32_t kDdsdLinearSize = 0x80000;
+static const uint32_t kDdsCapsComplex = 0x8;
+static const uint32_t kDdsCapsTexture = 0x1000;
+static const uint32_t kDdsCapsMipMap = 0x400000;
+static const uint32_t kDdpfFourCC = 0x4;
+static const uint32_t kDdsCaps2CubeMap = 0x200;
+static const uint32_t kDdsCaps2Volume = 0x200000;
+static const uint32_t kD3d10ResourceTexture2D = 3;
+static const uint32_t kD3d10MiscTextureCube = 0x4;
+
+static uint32_t ReadU32(const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint32_t FourCC(const char* s)
+{
+	return ReadU32(s);
+}
+
+static bool FormatFromFourCC(uint32_t fourcc, DdsFormat* format)
+{
+	if (fourcc == FourCC("DXT1"))
+		*format = DDS_BC1;
+	else if (fourcc == FourCC("DXT5"))
+		*format = DDS_BC3;
+	else if (fourcc == FourCC("ATI2") || fourcc == FourCC("BC5U"))
+		*format = DDS_BC5;
+	else
+		return false;
+	return true;
+}
+
+// DXGI_FORMAT_BC1_TYPELESS .. BC1_UNORM_SRGB and so on
+static bool FormatFromDxgi(uint32_t dxgi, DdsFormat* format)
+{
+	if (dxgi >= 70 && dxgi <= 72)
+		*format = DDS_BC1;
+	else if (dxgi >= 76 && dxgi <= 78)
+		*format = DDS_BC3;
+	else if (dxgi >= 82 && dxgi <= 84)
+		*format = DDS_BC5;
+	else if (dxgi >= 97 && dxgi <= 99)
+		*format = DDS_BC7;
+	else
+		return false;
+	return true;
+}
+
+bool ParseDds(const char* data, size_t size, DdsImage& image)
+{
+	if (size < kDdsHeaderSize || memcmp(data, "DDS ", 4) != 0 || ReadU32(data + 4) != 124)
+		return false;
+
+	uint32_t flags = ReadU32(data + 8);
+	int height = (int)ReadU32(data + 12);
+	int width = (int)ReadU32(data + 16);
+	uint32_t mip_count = ReadU32(data + 28);
+	uint32_t pf_flags = ReadU32(data + 80);
+	uint32_t fourcc = ReadU32(data + 84);
+	uint32_t caps2 = ReadU32(data + 112);
+	if (width <= 0 || height <= 0 || (caps2 & (kDdsCaps2CubeMap | kDdsCaps2Volume)) != 0 || (pf_flags & kDdpfFourCC) == 0)
+		return false;
+
+	size_t offset = kDdsHeaderSize;
+	if (fourcc == FourCC("DX10"))
+	{
+		if (size < kDdsHeaderSize + kDdsDx10HeaderSize)
+			return false;
+		const char* dx10 = data + kDdsHeaderSize;
+		if (!FormatFromDxgi(ReadU32(dx10), &image.format) || ReadU32(dx10 + 4) != kD3d10ResourceTexture2D ||
+			(ReadU32(dx10 + 8) & kD3d10MiscTextureCube) != 0 || ReadU32(dx10 + 12) > 1)
+			return false;
+		offset += kDdsDx10HeaderSize;
+	}
+	else if (!FormatFromFourCC(fourcc, &image.format))
+	{
+		return false;
+	}
+
+	// a count of 0, or no DDSD_MIPMAPCOUNT, means the top level only
+	if ((flags & kDdsdMipMapCount) == 0 || mip_count == 0)
+		mip_count = 1;
+
+	image.width = width;
+	image.height = height;
+	image.levels.clear();
+	size_t block_bytes = DdsBlockBytes(image.format);
+	for (uint32_t i = 0; i < mip_count; i++)
+	{
+		DdsLevel level;
+		level.width = width;
+		level.height = height;
+		level.offset = offset;
+		level.size = (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_bytes;
+		if (level.size > size - offset)
+			return false;
+		image.levels.push_back(level);
+		offset += level.size;
+		if (width == 1 && height == 1)
+			break;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return true;
+}
+
+static void WriteU32(char* p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (char)(v >> (8 * i));
+}
+
+bool WriteDds(const char* path, DdsFormat format, int width, int height, int level_count, const unsigned char* blocks, size_t size)
+{
+	static const char* fourccs[] = { "DXT1", "DXT5", "ATI2", "DX10" };
+	char header[kDdsHeaderSize + kDdsDx10HeaderSize] = {};
+	memcpy(header, "DDS ", 4);
+	WriteU32(header + 4, 124);
+	WriteU32(header + 8, kDdsdCaps | kDdsdHeight | kDdsdWidth | kDdsdPixelFormat | kDdsdLinearSize | (level_count > 1 ? kDdsdMipMapCount : 0));
+	WriteU32(header + 12, height);
+	WriteU32(header + 16, width);
+	WriteU32(header + 20, (uint32_t)(((width + 3) / 4) * ((height + 3) / 4) * DdsBlockBytes(format)));
+	WriteU32(header + 28, level_count);
+	WriteU32(header + 76, 32);
+	WriteU32(header + 80, kDdpfFourCC);
+	memcpy(header + 84, fourccs[format], 4);
+	WriteU32(header + 108, kDdsCapsTexture | (level_count > 1 ? kDdsCapsComplex | kDdsCapsMipMap : 0));
+	size_t header_size = kDdsHeaderSize;
+	if (format == DDS_BC7)
+	{
+		WriteU32(header + kDdsHeaderSize, 98); // DXGI_FORMAT_BC7_UNORM
+		WriteU32(header + kDdsHeaderSize + 4, kD3d10ResourceTexture2D);
+		WriteU32(header + kDdsHeaderSize + 12, 1);
+		header_size += kDdsDx10HeaderSize;
+	}
+
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL)
+		return false;
+	bool ok = fwrite(header, 1, header_size, fp) == header_size && fwrite(blocks, 1, size, fp) == size;
+	return fclose(fp) == 0 && ok;
+}
+
+const char* DdsFormatName(DdsFormat format)
+{
+	static const char* names[] = { "BC1", "BC3", "BC5", "BC7" };
+	return names[format];
+}
+
+size_t DdsBlockBytes(DdsFormat format)
+{
+	return format == DDS_BC1 ? 8 : 16;
+}
+
+// Block decoders. Each writes a 4x4 tile of RGBA8, row by row.
+
+static void Expand565(unsigned int c, unsigned char rgb[3])
+{
+	unsigned int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	rgb[0] = (unsigned char)((r << 3) | (r >> 2));
+	rgb[1] = (unsigned char)((g << 2) | (g >> 4));
+	rgb[2] = (unsigned char)((b << 3) | (b >> 2));
+}
+
+// The color half of BC1 and BC3. BC3 always uses the four color mode.
+static void DecodeColorBlock(const unsigned char* block, bool four_color_only, unsigned char tile[64])
+{
+	unsigned int c0 = block[0] | (block[1] << 8);
+	unsigned int c1 = block[2] | (block[3] << 8);
+	unsigned char colors[4][4];
+	Expand565(c0, colors[0]);
+	Expand565(c1, colors[1]);
+	colors[0][3] = colors[1][3] = colors[2][3] = 255;
+	if (c0 > c1 || four_color_only)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			colors[2][c] = (unsigned char)((2 * colors[0][c] + colors[1][c]) / 3);
+			colors[3][c] = (unsigned char)((colors[0][c] + 2 * colors[1][c]) / 3);
+		}
+		colors[3][3] = 255;
+	}
+	else
+	{
+		for (int c = 0; c < 3; c++)
+			colors[2][c] = (unsigned char)((colors[0][c] + colors[1][c]) / 2);
+		// punch-through: transparent black
+		colors[3][0] = colors[3][1] = colors[3][2] = colors[3][3] = 0;
+	}
+
+	uint32_t indices = ReadU32((const char*)block + 4);
+	for (int i = 0; i < 16; i++)
+		memcpy(tile + i * 4, colors[(indices >> (2 * i)) & 3], 4);
+}
+
+// A BC4 block (BC3 alpha, each BC5 channel) into tile[i * 4 + channel]
+static void DecodeChannelBlock(const unsigned char* block, unsigned char* tile, int channel)
+{
+	unsigned int a0 = block[0], a1 = block[1];
+	unsigned char values[8];
+	values[0] = (unsigned char)a0;
+	values[1] = (unsigned char)a1;
+	if (a0 > a1)
+	{
+		for (int i = 1; i < 7; i++)
+			values[i + 1] = (unsigned char)(((7 - i) * a0 + i * a1) / 7);
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++)
+			values[i + 1] = (unsigned char)(((5 - i) * a0 + i * a1) / 5);
+		values[6] = 0;
+		values[7] = 255;
+	}
+
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++)
+		indices |= (uint64_t)block[2 + i] << (8 * i);
+	for (int i = 0; i < 16; i++)
+		tile[i * 4 + channel] = values[(indices >> (3 * i)) & 7];
+}
+
+// BC7, after the Direct3D 11 format specification
+
+struct Bc7Mode
+{
+	int subsets;
+	int partition_bits;
+	int rotation_bits;
+	int index_selection_bits;
+	int color_bits;
+	int alpha_bits;
+	int endpoint_pbits;	// one per endpoint
+	int shared_pbits;	// one per subset
+	int index_bits;
+	int index_bits2;	// second index set of modes 4 and 5
+};
+
+static const Bc7Mode kBc7Modes[8] =
+{
+	{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+	{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+	{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+	{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+	{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+	{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+	{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+	{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+// Two subset partitions, bit i set if pixel i is in subset 1
+static const uint16_t kBc7Partitions2[64] =
+{
+	0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+	0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+	0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+	0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+	0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+	0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+	0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+	0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+
+// Three subset partitions, the subset of pixel i in bits 2i and 2i + 1
+static const uint32_t kBc7Partitions3[64] =
+{
+	0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050, 0x5555a0a0, 0x5a5a5050,
+	0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090, 0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250,
+	0xa5945040, 0x0a425054, 0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+	0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414, 0x50a4a450, 0x6a5a0200,
+	0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424, 0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50,
+	0x500aa550, 0xaaaa4444, 0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+	0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580, 0xaa141414, 0x96960000,
+	0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000, 0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254,
+};
+
+// Anchor pixel of subset 1 (two subsets), and of subsets 1 and 2 (three);
+// subset 0 always anchors at pixel 0
+static const unsigned char kBc7Anchors2[64] =
+{
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+	15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+	 6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+};
+
+static const unsigned char kBc7Anchors3a[64] =
+{
+	 3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+	 3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+	 8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+	 3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3,
+};
+
+static const unsigned char kBc7Anchors3b[64] =
+{
+	15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+	15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+	15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+	15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8,
+};
+
+static const unsigned char kBc7Weights2[4] = { 0, 21, 43, 64 };
+static const unsigned char kBc7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const unsigned char kBc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Little endian bit reader over one 16 byte block
+struct Bc7Bits
+{
+	uint64_t lo;
+	uint64_t hi;
+
+	explicit Bc7Bits(const unsigned char* block)
+	{
+		lo = hi = 0;
+		for (int i = 0; i < 8; i++)
+		{
+			lo |= (uint64_t)block[i] << (8 * i);
+			hi |= (uint64_t)block[8 + i] << (8 * i);
+		}
+	}
+
+	unsigned int Read(int bits)
+	{
+		if (bits == 0)
+			return 0;
+		unsigned int value = (unsigned int)(lo & ((1ULL << bits) - 1));
+		lo = (lo >> bits) | (hi << (64 - bits));
+		hi >>= bits;
+		return value;
+	}
+};
+
+static unsigned char Bc7Interpolate(unsigned int e0, unsigned int e1, unsigned int index, int bits)
+{
+	const unsigned char* weights = bits == 2 ? kBc7Weights2 : bits == 3 ? kBc7Weights3 : kBc7Weights4;
+	unsigned int w = weights[index];
+	return (unsigned char)(((64 - w) * e0 + w * e1 + 32) >> 6);
+}
+
+static void DecodeBc7Block(const unsigned char* block, unsigned char tile[64])
+{
+	int mode = 0;
+	while (mode < 8 && (block[0] & (1 << mode)) == 0)
+		mode++;
+	if (mode == 8)
+	{
+		// reserved mode, decodes to transparent black
+		memset(tile, 0, 64);
+		return;
+	}
+
+	const Bc7Mode& m = kBc7Modes[mode];
+	Bc7Bits bits(block);
+	bits.Read(mode + 1);
+	unsigned int partition = bits.Read(m.partition_bits);
+	unsigned int rotation = bits.Read(m.rotation_bits);
+	unsigned int index_selection = bits.Read(m.index_selection_bits);
+
+	int endpoint_count = m.subsets * 2;
+	unsigned int endpoints[6][4];
+	for (int c = 0; c < 3; c++)
+	{
+		for (int e = 0; e < endpoint_count; e++)
+			endpoints[e][c] = bits.Read(m.color_bits);
+	}
+	for (int e = 0; e < endpoint_count; e++)
+		endpoints[e][3] = m.alpha_bits > 0 ? bits.Read(m.alpha_bits) : 255;
+
+	// the p-bit becomes the lowest bit of every channel of its endpoint
+	int color_bits = m.color_bits, alpha_bits = m.alpha_bits;
+	if (m.endpoint_pbits || m.shared_pbits)
+	{
+		unsigned int pbits[6];
+		for (int e = 0; e < endpoint_count; e++)
+			pbits[e] = m.endpoint_pbits ? bits.Read(1) : ((e & 1) == 0 ? bits.Read(1) : pbits[e - 1]);
+		for (int e = 0; e < endpoint_count; e++)
+		{
+			for (int c = 0; c < 3; c++)
+				endpoints[e][c] = (endpoints[e][c] << 1) | pbits[e];
+			if (alpha_bits > 0)
+				endpoints[e][3] = (endpoints[e][3] << 1) | pbits[e];
+		}
+		color_bits++;
+		if (alpha_bits > 0)
+			alpha_bits++;
+	}
+	for (int e = 0; e < endpoint_count; e++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			int n = c < 3 ? color_bits : alpha_bits;
+			if (n > 0 && n < 8)
+				endpoints[e][c] = (endpoints[e][c] << (8 - n)) | (endpoints[e][c] >> (2 * n - 8));
+		}
+	}
+
+	unsigned int subset_of[16];
+	bool anchor[16];
+	for (int i = 0; i < 16; i++)
+	{
+		if (m.subsets == 1)
+			subset_of[i] = 0;
+		else if (m.subsets == 2)
+			subset_of[i] = (kBc7Partitions2[partition] >> i) & 1;
+		else
+			subset_of[i] = (kBc7Partitions3[partition] >> (2 * i)) & 3;
+		anchor[i] = i == 0;
+	}
+	if (m.subsets == 2)
+		anchor[kBc7Anchors2[partition]] = true;
+	else if (m.subsets == 3)
+		anchor[kBc7Anchors3a[partition]] = anchor[kBc7Anchors3b[partition]] = true;
+
+	// anchors drop the top bit of their index, which is always 0
+	unsigned int indices[16], indices2[16];
+	for (int i = 0; i < 16; i++)
+		indices[i] = bits.Read(m.index_bits - (anchor[i] ? 1 : 0));
+	for (int i = 0; i < 16; i++)
+		indices2[i] = m.index_bits2 > 0 ? bits.Read(m.index_bits2 - (i == 0 ? 1 : 0)) : 0;
+
+	for (int i = 0; i < 16; i++)
+	{
+		const unsigned int* e0 = endpoints[subset_of[i] * 2];
+		const unsigned int* e1 = endpoints[subset_of[i] * 2 + 1];
+		unsigned int color_index = indices[i], alpha_index = indices[i];
+		int color_index_bits = m.index_bits, alpha_index_bits = m.index_bits;
+		if (m.index_bits2 > 0)
+		{
+			alpha_index = indices2[i];
+			alpha_index_bits = m.index_bits2;
+			if (index_selection)
+			{
+				unsigned int t = color_index;
+				color_index = alpha_index;
+				alpha_index = t;
+				color_index_bits = m.index_bits2;
+				alpha_index_bits = m.index_bits;
+			}
+		}
+
+		unsigned char* p = tile + i * 4;
+		for (int c = 0; c < 3; c++)
+			p[c] = Bc7Interpolate(e0[c], e1[c], color_index, color_index_bits);
+		p[3] = Bc7Interpolate(e0[3], e1[3], alpha_index, alpha_index_bits);
+		if (rotation > 0)
+		{
+			unsigned char t = p[3];
+			p[3] = p[rotation - 1];
+			p[rotation - 1] = t;
+		}
+	}
+}
+
+static void DecodeBlock(DdsFormat format, const unsigned char* block, unsigned char tile[64])
+{
+	switch (format)
+	{
+	case DDS_BC1:
+		DecodeColorBlock(block, false, tile);
+		break;
+	case DDS_BC3:
+		DecodeColorBlock(block + 8, true, tile);
+		DecodeChannelBlock(block, tile, 3);
+		break;
+	case DDS_BC5:
+		for (int i = 0; i < 16; i++)
+		{
+			tile[i * 4 + 2] = 0;
+			tile[i * 4 + 3] = 255;
+		}
+		DecodeChannelBlock(block, tile, 0);
+		DecodeChannelBlock(block + 8, tile, 1);
+		break;
+	case DDS_BC7:
+		DecodeBc7Block(block, tile);
+		break;
+	}
+}
+
+void DecodeDdsLevel(DdsFormat format, const unsigned char* blocks, int width, int height, unsigned char* rgba)
+{
+	size_t block_bytes = DdsBlockBytes(format);
+	unsigned char tile[64];
+	for (int by = 0; by < height; by += 4)
+	{
+		int rows = height - by < 4 ? height - by : 4;
+		for (int bx = 0; bx < width; bx += 4)
+		{
+			int cols = width - bx < 4 ? width - bx : 4;
+			DecodeBlock(format, blocks, tile);
+			blocks += block_bytes;
+			// the blocks of a level smaller than 4x4 still cover 4x4 pixels
+			for (int y = 0; y < rows; y++)
+				memcpy(rgba + ((size_t)(by + y) * width + bx) * 4, tile + y * 16, cols * 4);
+		}
+	}
+}
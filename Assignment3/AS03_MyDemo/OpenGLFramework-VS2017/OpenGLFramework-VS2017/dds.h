@@ -0,0 +1,56 @@
+#ifndef DDS_H
+#define DDS_H
+
+#include <stddef.h>
+#include <vector>
+
+// Block compressed textures in a .dds container. Only what a diffuse map
+// needs is read: a 2D texture (no array, cube or volume) in BC1, BC3, BC5 or
+// BC7, from a legacy FourCC header or a DX10 one, with its mip chain as
+// stored. sRGB variants are read as their UNORM format.
+//
+// Rows are stored top-down, the opposite of what glTexImage2D expects, and
+// the blocks are uploaded as they are; the material flips its v instead.
+
+enum DdsFormat
+{
+	DDS_BC1 = 0,	// DXT1, RGB + 1 bit alpha, 8 bytes per 4x4 block
+	DDS_BC3 = 1,	// DXT5, RGBA, 16 bytes per block
+	DDS_BC5 = 2,	// ATI2 / RGTC2, two channels, 16 bytes per block
+	DDS_BC7 = 3,	// BPTC, RGBA, 16 bytes per block
+};
+
+struct DdsLevel
+{
+	int width;
+	int height;
+	size_t offset;	// of the first block, from the start of the file
+	size_t size;	// in bytes, whole blocks
+};
+
+struct DdsImage
+{
+	DdsFormat format;
+	int width;
+	int height;
+	std::vector<DdsLevel> levels;	// the mips follow each other in the file
+};
+
+// Fills image from the header; false if the file is not a texture listed
+// above or is shorter than its header says.
+bool ParseDds(const char* data, size_t size, DdsImage& image);
+
+const char* DdsFormatName(DdsFormat format);
+size_t DdsBlockBytes(DdsFormat format);
+
+// Writes a .dds of level_count levels laid out as ParseDds reads them, back
+// to back from the top level in blocks. BC7 gets a DX10 header, the others
+// their legacy FourCC.
+bool WriteDds(const char* path, DdsFormat format, int width, int height, int level_count, const unsigned char* blocks, size_t size);
+
+// Software path for contexts without the format: decodes one level into
+// width * height RGBA8 pixels, top-down like the blocks. BC5 gives
+// (r, g, 0, 255).
+void DecodeDdsLevel(DdsFormat format, const unsigned char* blocks, int width, int height, unsigned char* rgba);
+
+#endif
@@ -1,11 +1,31 @@
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <map>
 #include <math.h>
+#if defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define USE_SSE
+#endif
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "textfile.h"
+#include "objfile.h"
+#include "dds.h"
+#include "mipmap.h"
+#include "atlas.h"
+#include "residency.h"
+#include "texturestate.h"
+#include "texturecache.h"
+#include "modeldata.h"
+#include "bench.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include <STB/stb_image.h>
 
@@ -14,6 +34,8 @@
 #include "Matrices.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
+#include "meshcache.h"
+#include "shadervariant.h"
 
 #ifndef max
 # define max(a,b) (((a)>(b))?(a):(b))
@@ -35,6 +57,38 @@ bool mouse_pressed = false;
 int starting_press_x = -1;
 int starting_press_y = -1;
 
+// Render on demand: a frame is drawn only once something has changed what
+// it shows, otherwise the loop sleeps in glfwWaitEventsTimeout and the last
+// frame stays on screen. --continuous draws every iteration, for timing
+// the frame itself.
+bool render_on_demand = true;
+bool scene_dirty = true; // the frame on screen is out of date
+// Longest sleep of the idle loop; input wakes it at once, so this is only
+// a backstop and may be long
+const double kIdleWait = 0.5; // seconds
+// Sleep while the model loader or the texture cache has work in flight,
+// which the loop services at about the rate it used to draw frames
+const double kBusyWait = 1.0 / 60.0; // seconds
+
+// --loop-stats: the main thread's time outside the event wait, which is
+// what the loop costs the CPU, and the frames drawn, printed at exit
+chrono::steady_clock::time_point loop_start;
+double loop_busy_ms = 0.0;
+int loop_wakeups = 0, loop_frames = 0;
+
+void PrintRenderLoopStats()
+{
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - loop_start).count();
+	printf("Render loop (%s): %d frames in %.1f s (%.1f per second), %d wakeups, main thread busy %.1f%% of the time\n",
+		render_on_demand ? "on demand" : "continuous", loop_frames, seconds, loop_frames / seconds, loop_wakeups, 100.0 * loop_busy_ms / (seconds * 1000.0));
+}
+
+// The window system lost the frame on screen, as when the window is uncovered
+void WindowRefresh(GLFWwindow*)
+{
+	scene_dirty = true;
+}
+
 enum TransMode
 {
 	GeoTranslation = 0,
@@ -66,6 +120,9 @@ typedef struct
 	Vector3 Ks;
 
 	GLuint diffuseTexture;
+	int textureHandle; // texture cache handle, -1 for none
+	int flipTexV; // 1 if the texture rows are stored top-down (DDS)
+	int textureArray; // 1 if textureHandle is a texture array, layered by vertex
 
 	// eye texture coordinate 
 	GLuint isEye;
@@ -83,8 +140,10 @@ typedef struct
 	int vertex_count;
 	GLuint p_normal;
 	GLuint p_texCoord;
+	GLuint p_layer; // texture array layer per vertex, 0 if not layered
 	PhongMaterial material;
 	int indexCount;
+	GLenum indexType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
 } Shape;
 
 struct model
@@ -98,8 +157,17 @@ struct model
 	bool hasEye;
 	GLint max_eye_offset = 7;
 	GLint cur_eye_offset_idx = 0;
+
+	unsigned int transform_version = 1; // bumped with position, scale or rotation
+	GLuint material_ubo = 0; // a MaterialBlock per shape, material_stride apart
+	unsigned int material_version = 0; // frame_state.shininess material_ubo holds
 };
 vector<model> models;
+// Mesh cache tag, bump when normalization(), ExpandShapeCorners() or the
+// streams uploaded change
+const char* MESH_CACHE_TAG = "as03v4";
+// Floats per vertex of each MeshCacheStream
+const int MESH_STREAM_WIDTHS[MESHCACHE_STREAM_COUNT] = { 3, 3, 3, 2 };
 
 struct camera
 {
@@ -148,7 +216,7 @@ int light_idx = 1;
 int cur_idx = 0; // represent which model should be rendered now
 vector<string> model_list{ "../TextureModels/Fushigidane.obj", "../TextureModels/Mew.obj","../TextureModels/Nyarth.obj","../TextureModels/Zenigame.obj", "../TextureModels/laurana500.obj", "../TextureModels/Nala.obj", "../TextureModels/Square.obj" };
 
-GLuint program;
+GLuint program; // the variant bound
 
 // Shader attributes for uniform variables
 GLint iLocP; //projection matrix
@@ -156,17 +224,10 @@ GLint iLocV; //viewing matrix
 GLint iLocModelMatrix; // T * R * S
 GLint iLocMV; // view_matrix * T * R * S;
 GLint iLocNormTrans; // MV.invert().transpose()
-GLint iLocTexTrans;
 
 GLint iLocLightIdx;
 
-// material properties
-GLint iLocKa;
-GLint iLocKd;
-GLint iLocKs;
-GLint iLocShininess;
-
-GLuint iLocVertex_or_perpixel;
+GLint iLocVertex_or_perpixel;
 
 struct Uniform
 {
@@ -176,27 +237,10 @@ Uniform uniform;
 
 // Texture
 GLint iLocTex;
-
-// properties for light source in GPU
-struct iLocLightInfo
-{
-	// lighting properties (general)
-	GLuint position;
-	GLuint ambient;
-	GLuint diffuse;
-	GLuint specular;
-
-	// lighting properties (spot light)
-	GLuint spotDirection;
-	GLuint spotExponent;
-	GLuint spotCutoff;
-
-	// attenuation
-	GLuint constantAttenuation;
-	GLuint linearAttenuation;
-	GLuint quadraticAttenuation;
-
-}iLocLightInfo[3];
+GLint iLocFlipTexV;
+GLint iLocUseTexArray;
+GLint iLocIsEye;
+GLint iLocEyeOffset;
 
 struct LightInfo
 {
@@ -212,6 +256,121 @@ struct LightInfo
 	float quadraticAttenuation;
 }lightInfo[3];
 
+// std140 images of the Lights and Material uniform blocks that
+// shader.vs.glsl and shader.fs.glsl share: every vec4 on a 16 byte boundary,
+// the floats of a LightInfo packed after its vec4s and each struct padded
+// to 16 bytes
+struct LightBlockEntry
+{
+	GLfloat position[4];
+	GLfloat La[4];
+	GLfloat Ld[4];
+	GLfloat Ls[4];
+	GLfloat spotDirection[4];
+	GLfloat spotExponent;
+	GLfloat spotCutoff;
+	GLfloat constantAttenuation;
+	GLfloat linearAttenuation;
+	GLfloat quadraticAttenuation;
+	GLfloat pad[3];
+};
+static_assert(sizeof(LightBlockEntry) == 112, "LightInfo is 112 bytes in std140");
+
+struct MaterialBlock
+{
+	GLfloat Ka[4];
+	GLfloat Kd[4];
+	GLfloat Ks[4];
+	GLfloat shininess;
+	GLfloat pad[3];
+};
+static_assert(sizeof(MaterialBlock) == 64, "MaterialInfo is 64 bytes in std140");
+
+const GLuint kLightsBinding = 0; // uniform buffer binding points of the blocks
+const GLuint kMaterialBinding = 1;
+GLuint lights_ubo = 0;
+GLintptr material_stride = 0; // sizeof(MaterialBlock) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+int uniform_calls = 0; // this frame: glUniform*, uniform buffer uploads and binds
+int draw_calls = 0; // this frame
+
+// How RenderScene draws the two halves, vertex lighting at LHS and pixel
+// lighting at RHS. The single pass paths submit each shape once as two
+// instances, gl_InstanceID picking the lighting and the half; the values
+// are the shaders' split_path.
+enum SplitViewPath
+{
+	SplitTwoPass = 0,		// glViewport and a draw per half, --two-pass
+	SplitClipPlanes = 1,	// the shader squeezes each instance into its half, gl_ClipDistance cuts it off there
+	SplitViewportIndex = 2,	// the shader writes gl_ViewportIndex into a viewport array
+};
+SplitViewPath split_path = SplitClipPlanes; // set in setupRC
+bool force_two_pass = false;
+GLint iLocSplitPath;
+
+// The lighting a program variant draws, see UseShaderVariant; the values
+// are the shaders' vertex_or_perpixel where they have one
+enum ShadingVariant
+{
+	ShadingGouraud = 0,		// the two pass path's LHS
+	ShadingPhong = 1,		// and its RHS
+	ShadingByInstance = 2,	// both, by gl_InstanceID, for the single pass paths
+};
+// What a shape's program samples, by the texture DrawShapes binds for it
+enum TextureVariant
+{
+	Untextured = 0,		// the placeholder, white, so nothing is sampled
+	Textured2D = 1,
+	TexturedArray = 2,	// a texture array, by the layer of each vertex
+};
+// --uber-shader: the one program branching on lightIdx, vertex_or_perpixel
+// and split_path at run time, to compare the variants against
+bool use_uber_shader = false;
+MappedFile vs_source, fs_source; // kept open for the variants built later
+
+// Versions of what a frame is drawn from. The input callbacks, and the
+// functions that set view_matrix and project_matrix, bump the counter of
+// whatever they change. The program keeps its uniforms and buffers between
+// frames, so each group of them remembers the versions it was built from
+// and is worked out and sent again only once one of those has moved.
+struct FrameState
+{
+	unsigned int view = 1; // view_matrix
+	unsigned int projection = 1; // project_matrix
+	unsigned int light_idx = 1;
+	unsigned int lights = 1; // lightInfo
+	unsigned int shininess = 1;
+	int recomputed = 0; // uniform groups rebuilt and sent, over the run
+	int skipped = 0; // and left as the program had them
+};
+FrameState frame_state;
+
+// The versions each uniform group of setUniforms was last sent from.
+// Uniforms belong to a program, so every ShaderVariant keeps its own.
+struct UniformsSent
+{
+	unsigned int model[4];
+	unsigned int camera[2];
+	unsigned int light_idx;
+};
+UniformsSent* uniforms_sent; // the bound variant's
+
+// True if the versions in key are the count the group was built from;
+// otherwise records them in sent for the rebuild that follows
+static bool Unchanged(unsigned int* sent, const unsigned int* key, int count)
+{
+	bool unchanged = true;
+	for (int i = 0; i < count; i++)
+	{
+		unchanged = unchanged && sent[i] == key[i];
+		sent[i] = key[i];
+	}
+	if (unchanged)
+		frame_state.skipped++;
+	else
+		frame_state.recomputed++;
+	return unchanged;
+}
+
 static GLvoid Normalize(GLfloat v[3])
 {
 	GLfloat l;
@@ -334,6 +493,7 @@ void setViewingMatrix()
 	view_matrix[15] = 1;
 
 	view_matrix = view_matrix * translate(-main_camera.position);
+	frame_state.view++;
 }
 
 void setOrthogonal()
@@ -358,6 +518,7 @@ void setOrthogonal()
 	project_matrix[13] = 0;
 	project_matrix[14] = 0;
 	project_matrix[15] = 1;
+	frame_state.projection++;
 }
 
 void setPerspective()
@@ -381,6 +542,7 @@ void setPerspective()
 	project_matrix[13] = 0;
 	project_matrix[14] = -1;
 	project_matrix[15] = 0;
+	frame_state.projection++;
 }
 
 // Call back function for window reshape
@@ -388,6 +550,7 @@ void ChangeSize(GLFWwindow* window, int width, int height)
 {
 	// glViewport(0, 0, width, height);
 	proj.aspect = (float)(width / 2) / (float)height;
+	scene_dirty = true;
 	if (cur_proj_mode == Perspective) {
 		setPerspective();
 	}
@@ -411,163 +574,322 @@ void setGLMatrix(GLfloat* glm, Matrix4& m) {
 	glm[3] = m[12];  glm[7] = m[13];  glm[11] = m[14];   glm[15] = m[15];
 }
 
-void setUniforms() {
-	model cur_model = models[cur_idx];
-	// [TODO] update translation, rotation and scaling
-	Matrix4 T = translate(cur_model.position),
-		R = rotate(cur_model.rotation),
-		S = scaling(cur_model.scale);
-
-	// matrix for shader, type: GLfloat
-	GLfloat temp[16];
-
-	// pass Model matrix 
-	Matrix4 model_matrix = T * R * S;
-	setGLMatrix(temp, model_matrix);
-	glUniformMatrix4fv(iLocModelMatrix, 1, GL_FALSE, temp);
-
-	// pass MV matrix
-	Matrix4 MV = view_matrix * T * R * S;
-	setGLMatrix(temp, MV);
-	glUniformMatrix4fv(iLocMV, 1, GL_FALSE, temp);
+// The filter modes as sampler objects, [magfilter_mode][minfilter_mode],
+// made in setupRC; they override the filter and wrap of any bound texture
+GLuint texture_samplers[2][2];
+bool use_samplers = true; // false with --no-samplers: glTexParameteri per draw
 
-	// MVP = project_matrix * (view_matrix * T * R * S); 
-	Matrix4 MVP = project_matrix * MV;
-	setGLMatrix(temp, MVP);
-	glUniformMatrix4fv(uniform.iLocMVP, 1, GL_FALSE, temp);
+void CreateTextureSamplers()
+{
+	const GLenum mag_filters[2] = { GL_NEAREST, GL_LINEAR };
+	const GLenum min_filters[2] = { GL_NEAREST_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR };
+	glGenSamplers(4, &texture_samplers[0][0]);
+	for (int mag = 0; mag < 2; mag++)
+	{
+		for (int min = 0; min < 2; min++)
+		{
+			GLuint sampler = texture_samplers[mag][min];
+			glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, mag_filters[mag]);
+			glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, min_filters[min]);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		}
+	}
+}
 
-	// pass normal transformation matrix
-	Matrix4 NORM_TRANS = MV.invert().transpose();
-	setGLMatrix(temp, NORM_TRANS);
-	glUniformMatrix4fv(iLocNormTrans, 1, GL_FALSE, temp);
+// The per-draw texture setup samplers replaced, behind --no-samplers to
+// compare call counts
+static void SetTextureParameters(GLenum target)
+{
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, magfilter_mode ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, minfilter_mode ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	texture_state.issued += 4;
+}
 
-	// pass project/viewing matrix to shader
-	glUniformMatrix4fv(iLocP, 1, GL_FALSE, project_matrix.getTranspose());
-	glUniformMatrix4fv(iLocV, 1, GL_FALSE, view_matrix.getTranspose());
+// Prints the texture state calls of a frame once they settle on a new
+// count, as after switching models or filters
+static void ReportTextureStateCalls(int shapes)
+{
+	static int last_issued = -1, last_skipped = -1, reported_issued = -1, reported_skipped = -1;
+	if (texture_state.issued == last_issued && texture_state.skipped == last_skipped &&
+		(texture_state.issued != reported_issued || texture_state.skipped != reported_skipped))
+	{
+		printf("RenderScene: %d shapes, %d texture state calls per frame (%d skipped)%s\n", shapes, texture_state.issued, texture_state.skipped,
+			use_samplers ? "" : ", glTexParameteri per draw");
+		reported_issued = texture_state.issued;
+		reported_skipped = texture_state.skipped;
+	}
+	last_issued = texture_state.issued;
+	last_skipped = texture_state.skipped;
+}
 
-	// pass light index
-	glUniform1i(iLocLightIdx, light_idx);
+// set properties to uniform variable in shader, those whose inputs have
+// changed since they were last sent
+void setUniforms() {
+	const model& cur_model = models[cur_idx];
+	// matrix for shader, type: GLfloat
+	GLfloat temp[16];
 
-	for (int i = 0; i < 3; ++i) {
-		// direct, point, spot light
-		glUniform4f(iLocLightInfo[i].ambient, lightInfo[i].ambient.x, lightInfo[i].ambient.y, lightInfo[i].ambient.z, lightInfo[i].ambient.w);
-		glUniform4f(iLocLightInfo[i].diffuse, lightInfo[i].diffuse.x, lightInfo[i].diffuse.y, lightInfo[i].diffuse.z, lightInfo[i].diffuse.w);
-		glUniform4f(iLocLightInfo[i].specular, lightInfo[i].specular.x, lightInfo[i].specular.y, lightInfo[i].specular.z, lightInfo[i].specular.w);
-		glUniform4f(iLocLightInfo[i].position, lightInfo[i].position.x, lightInfo[i].position.y, lightInfo[i].position.z, lightInfo[i].position.w);
+	unsigned int model_key[4] = { (unsigned int)cur_idx, cur_model.transform_version, frame_state.view, frame_state.projection };
+	if (!Unchanged(uniforms_sent->model, model_key, 4))
+	{
+		// [TODO] update translation, rotation and scaling
+		Matrix4 T = translate(cur_model.position),
+			R = rotate(cur_model.rotation),
+			S = scaling(cur_model.scale);
+
+		// pass Model matrix 
+		Matrix4 model_matrix = T * R * S;
+		setGLMatrix(temp, model_matrix);
+		glUniformMatrix4fv(iLocModelMatrix, 1, GL_FALSE, temp);
+
+		// pass MV matrix
+		Matrix4 MV = view_matrix * model_matrix;
+		setGLMatrix(temp, MV);
+		glUniformMatrix4fv(iLocMV, 1, GL_FALSE, temp);
+
+		// MVP = project_matrix * (view_matrix * T * R * S); 
+		Matrix4 MVP = project_matrix * MV;
+		setGLMatrix(temp, MVP);
+		glUniformMatrix4fv(uniform.iLocMVP, 1, GL_FALSE, temp);
+
+		// pass normal transformation matrix
+		Matrix4 NORM_TRANS = MV.invert().transpose();
+		setGLMatrix(temp, NORM_TRANS);
+		glUniformMatrix4fv(iLocNormTrans, 1, GL_FALSE, temp);
+		uniform_calls += 4;
 	}
 
-	for (int i = 1; i <= 2; ++i) {
-		// point, spot light
-		glUniform1f(iLocLightInfo[i].constantAttenuation, lightInfo[i].constantAttenuation);
-		glUniform1f(iLocLightInfo[i].linearAttenuation, lightInfo[i].linearAttenuation);
-		glUniform1f(iLocLightInfo[i].quadraticAttenuation, lightInfo[i].quadraticAttenuation);
+	unsigned int camera_key[2] = { frame_state.view, frame_state.projection };
+	if (!Unchanged(uniforms_sent->camera, camera_key, 2))
+	{
+		// pass project/viewing matrix to shader
+		glUniformMatrix4fv(iLocP, 1, GL_FALSE, project_matrix.getTranspose());
+		glUniformMatrix4fv(iLocV, 1, GL_FALSE, view_matrix.getTranspose());
+		uniform_calls += 2;
 	}
 
-	glUniform4f(iLocLightInfo[2].spotDirection, lightInfo[2].spotDirection.x, lightInfo[2].spotDirection.y, lightInfo[2].spotDirection.z, lightInfo[2].spotDirection.w);
-	glUniform1f(iLocLightInfo[2].spotExponent, lightInfo[2].spotExponent);
-	glUniform1f(iLocLightInfo[2].spotCutoff, lightInfo[2].spotCutoff);
+	if (!Unchanged(&uniforms_sent->light_idx, &frame_state.light_idx, 1))
+	{
+		// pass light index
+		glUniform1i(iLocLightIdx, light_idx);
+		uniform_calls++;
+	}
+}
 
+// The Lights buffer, bound for the whole run, and the spacing of material
+// slots, whose offsets glBindBufferRange needs aligned
+void CreateUniformBuffers()
+{
+	GLint alignment;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	material_stride = (sizeof(MaterialBlock) + alignment - 1) / alignment * alignment;
+
+	glGenBuffers(1, &lights_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, lights_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, 3 * sizeof(LightBlockEntry), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, kLightsBinding, lights_ubo);
 }
 
-// Render function for display rendering
-void RenderScene(int per_vertex_or_per_pixel) {	
+static void CopyVector4(const Vector4& v, GLfloat dst[4])
+{
+	dst[0] = v.x;
+	dst[1] = v.y;
+	dst[2] = v.z;
+	dst[3] = v.w;
+}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+// lightInfo into the Lights block, in one call for both views in a frame
+// it has changed
+void UploadLights()
+{
+	static unsigned int lights_sent;
+	if (Unchanged(&lights_sent, &frame_state.lights, 1))
+		return;
 
-	setUniforms();
+	LightBlockEntry block[3] = {};
+	for (int i = 0; i < 3; i++)
+	{
+		CopyVector4(lightInfo[i].position, block[i].position);
+		CopyVector4(lightInfo[i].ambient, block[i].La);
+		CopyVector4(lightInfo[i].diffuse, block[i].Ld);
+		CopyVector4(lightInfo[i].specular, block[i].Ls);
+		CopyVector4(lightInfo[i].spotDirection, block[i].spotDirection);
+		block[i].spotExponent = lightInfo[i].spotExponent;
+		block[i].spotCutoff = lightInfo[i].spotCutoff;
+		block[i].constantAttenuation = lightInfo[i].constantAttenuation;
+		block[i].linearAttenuation = lightInfo[i].linearAttenuation;
+		block[i].quadraticAttenuation = lightInfo[i].quadraticAttenuation;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, lights_ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), block);
+	uniform_calls++;
+}
 
-	//Vector3 modelPos = models[cur_idx].position;
+// A MaterialBlock per shape of m at the current shininess
+void UploadModelMaterials(model& m)
+{
+	vector<unsigned char> slots(m.shapes.size() * material_stride);
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		const PhongMaterial& material = m.shapes[i].material;
+		MaterialBlock* block = (MaterialBlock*)&slots[i * material_stride];
+		CopyVector4(Vector4(material.Ka.x, material.Ka.y, material.Ka.z, 1.0f), block->Ka);
+		CopyVector4(Vector4(material.Kd.x, material.Kd.y, material.Kd.z, 1.0f), block->Kd);
+		CopyVector4(Vector4(material.Ks.x, material.Ks.y, material.Ks.z, 1.0f), block->Ks);
+		block->shininess = shininess;
+	}
+	if (m.material_ubo == 0)
+		glGenBuffers(1, &m.material_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, m.material_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, slots.size(), &slots[0], GL_STATIC_DRAW);
+	uniform_calls++;
+}
 
-	//Matrix4 T, R, S;
-	//T = translate(models[cur_idx].position);
-	//R = rotate(models[cur_idx].rotation);
-	//S = scaling(models[cur_idx].scale);
+// Prints the uniform calls of a frame and its CPU submit time, averaged
+// over the first kReportFrames frames after the call count changes, as it
+// does when switching models
+static void ReportFrameSubmit(int shapes, double submit_ms)
+{
+	const int kReportFrames = 120;
+	static int last_calls = -1, frames = 0;
+	static double total_ms = 0.0;
+	if (uniform_calls != last_calls)
+	{
+		last_calls = uniform_calls;
+		frames = 0;
+		total_ms = 0.0;
+	}
+	total_ms += submit_ms;
+	if (++frames == kReportFrames)
+		printf("RenderScene: %d shapes, %d draw calls and %d uniform calls per frame, %.3f ms CPU submit (mean of %d frames); %d uniform groups rebuilt, %d skipped so far\n",
+			shapes, draw_calls, uniform_calls, total_ms / frames, frames, frame_state.recomputed, frame_state.skipped);
+}
 
-	// render object
-	//Matrix4 model_matrix = T * R * S;
-	//glUniformMatrix4fv(iLocM, 1, GL_FALSE, model_matrix.getTranspose());
-	//glUniformMatrix4fv(iLocV, 1, GL_FALSE, view_matrix.getTranspose());
-	//glUniformMatrix4fv(iLocP, 1, GL_FALSE, project_matrix.getTranspose());
+void UseShaderVariant(int light, ShadingVariant shading, TextureVariant texturing); // with setUniformVariables below
 
+// Draws the shapes of the current model with the programs for shading and
+// what each samples, either into the viewport of its half or as two
+// instances, one per half
+static void DrawShapes(ShadingVariant shading)
+{
+	GLuint set_up = 0; // the program setUniforms last ran for in this call
 	for (int i = 0; i < models[cur_idx].shapes.size(); i++) 
 	{
+		// a texture array goes on unit 1, the sampler2DArray's; until it is
+		// resident the shape has the placeholder like any other, which only
+		// the uber shader samples
+		GLuint texture = models[cur_idx].shapes[i].material.diffuseTexture;
+		int layered = models[cur_idx].shapes[i].material.textureArray && texture != placeholder_texture ? 1 : 0;
+		UseShaderVariant(light_idx, shading, texture == placeholder_texture ? Untextured : layered ? TexturedArray : Textured2D);
+		if (program != set_up)
+		{
+			set_up = program;
+			setUniforms();
+			if (shading != ShadingByInstance && iLocVertex_or_perpixel != -1)
+			{
+				// the uber shader's lighting for this half
+				glUniform1i(iLocVertex_or_perpixel, shading);
+				uniform_calls++;
+			}
+		}
+
 		// material properties
-		glUniform4f(iLocKa, models[cur_idx].shapes[i].material.Ka.x, models[cur_idx].shapes[i].material.Ka.y, models[cur_idx].shapes[i].material.Ka.z, 1.0);
-		glUniform4f(iLocKd, models[cur_idx].shapes[i].material.Kd.x, models[cur_idx].shapes[i].material.Kd.y, models[cur_idx].shapes[i].material.Kd.z, 1.0);
-		glUniform4f(iLocKs, models[cur_idx].shapes[i].material.Ks.x, models[cur_idx].shapes[i].material.Ks.y, models[cur_idx].shapes[i].material.Ks.z, 1.0);
-		glUniform1f(iLocShininess, shininess);
+		glBindBufferRange(GL_UNIFORM_BUFFER, kMaterialBinding, models[cur_idx].material_ubo, i * material_stride, sizeof(MaterialBlock));
+		uniform_calls += 3;
 
 		// [TODO] Bind texture and modify texture filtering & wrapping mode
 		// Hint: glActiveTexture, glBindTexture, glTexParameteri
 
 		
-		glUniform1i(glGetUniformLocation(program, "iseye"), models[cur_idx].shapes[i].material.isEye);
+		glUniform1i(iLocIsEye, models[cur_idx].shapes[i].material.isEye);
 		if (models[cur_idx].shapes[i].material.isEye == 1) {
-			glUniform2f(glGetUniformLocation(program, "offset"), models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].x, models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].y);
+			glUniform2f(iLocEyeOffset, models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].x, models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].y);
+			uniform_calls++;
 		}
+		glUniform1i(iLocFlipTexV, models[cur_idx].shapes[i].material.flipTexV);
 		
-		
-		glActiveTexture(GL_TEXTURE0);//
-		glBindTexture(GL_TEXTURE_2D, models[cur_idx].shapes[i].material.diffuseTexture);
-
-		if (magfilter_mode == false)
+		if (iLocUseTexArray != -1)
 		{
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
+			// the uber shader's, the variants have it built in
+			glUniform1i(iLocUseTexArray, layered);
+			uniform_calls++;
 		}
-		else
+		if (use_samplers)
 		{
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			BindSampler(layered, texture_samplers[magfilter_mode][minfilter_mode]);
+			if (layered)
+				BindTextureArray(1, texture);
+			else
+				BindTexture2D(0, texture);
 		}
-
-		if (minfilter_mode == false)
+		else if (layered)
 		{
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+			BindTextureArray(1, texture);
+			SetTextureParameters(GL_TEXTURE_2D_ARRAY);
 		}
 		else
 		{
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			BindTexture2D(0, texture);
+			SetTextureParameters(GL_TEXTURE_2D);
 		}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		
+		glBindVertexArray(models[cur_idx].shapes[i].vao);
+		if (shading == ShadingByInstance)
+			glDrawElementsInstanced(GL_TRIANGLES, models[cur_idx].shapes[i].indexCount, models[cur_idx].shapes[i].indexType, 0, 2);
+		else
+			glDrawElements(GL_TRIANGLES, models[cur_idx].shapes[i].indexCount, models[cur_idx].shapes[i].indexType, 0);
+		draw_calls++;
+	}
+}
 
-		// set texture transformation matrix
-		Matrix4 TEX_TRANS;
-		auto curr_model = models[cur_idx];
-		if (models[cur_idx].shapes[i].material.isEye) 
-		{
-			auto offset = curr_model.shapes[i].material.offsets[curr_model.cur_eye_offset_idx];
-			TEX_TRANS = translate(Vector3(offset.x, offset.y, 0));
-		}
-		else 
-		{
-			TEX_TRANS = translate(Vector3(0, 0, 0));
-		}
-		GLfloat temp[16];
-		setGLMatrix(temp, TEX_TRANS);
-		glUniformMatrix4fv(iLocTexTrans, 1, GL_FALSE, temp);
+// Render function for display rendering
+void RenderScene(void) {	
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	texture_state.issued = 0;
+	texture_state.skipped = 0;
 
+	// filled once the model's shapes have loaded, then again whenever the
+	// scroll wheel has changed the shininess
+	if (!models[cur_idx].shapes.empty() && !Unchanged(&models[cur_idx].material_version, &frame_state.shininess, 1))
+		UploadModelMaterials(models[cur_idx]);
+
+	if (split_path == SplitTwoPass)
+	{
 		// Vertex lighting at LHS
-		glViewport(0, 0, (GLsizei)(WINDOW_WIDTH / 2), WINDOW_HEIGHT);
-		glBindVertexArray(models[cur_idx].shapes[i].vao);
-		glUniform1i(iLocVertex_or_perpixel, 0);
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
+		glViewport(0, 0, screenWidth / 2, screenHeight);
+		DrawShapes(ShadingGouraud);
 
 		// Pixel lighting at RHS
-		glViewport((GLsizei)(WINDOW_WIDTH / 2), 0, (GLsizei)(WINDOW_WIDTH / 2), WINDOW_HEIGHT);
-		glBindVertexArray(models[cur_idx].shapes[i].vao);
-		glUniform1i(iLocVertex_or_perpixel, 1);
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
-
+		glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
+		DrawShapes(ShadingPhong);
+	}
+	else
+	{
+		if (split_path == SplitViewportIndex)
+		{
+			glViewportIndexedf(0, 0, 0, screenWidth / 2, screenHeight);
+			glViewportIndexedf(1, screenWidth / 2, 0, screenWidth / 2, screenHeight);
+		}
+		else
+		{
+			// both halves, so the shader's half is exactly the two pass viewport
+			glViewport(0, 0, screenWidth / 2 * 2, screenHeight);
+		}
+		// Vertex lighting at LHS and pixel lighting at RHS, one draw per shape
+		DrawShapes(ShadingByInstance);
 	}
+	ReportTextureStateCalls((int)models[cur_idx].shapes.size());
 }
 
 // Call back function for keyboard
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	if (action == GLFW_PRESS) {
+		scene_dirty = true;
 		switch (key)
 		{
 		case GLFW_KEY_ESCAPE:
@@ -626,10 +948,12 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 
 		case GLFW_KEY_I:
 			cout << endl;
+			PrintTextureCacheStats();
 			break;
 
 		case GLFW_KEY_L:
 			light_idx = (light_idx + 1) % 3;
+			frame_state.light_idx++;
 			cout << " Light Mode: " << ((light_idx == 0) ? "Directional" : (light_idx == 1) ? "Point" : "Spot") << " Light" << endl;
 			break;
 
@@ -674,6 +998,7 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 	float cutoff_changing_factor = 0.5;
 	float diffuse_changing_factor = 0.1;
 
+	scene_dirty = true;
 	// scroll up positive, otherwise it would be negtive
 	switch (cur_trans_mode)
 	{
@@ -697,21 +1022,26 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 
 	case GeoTranslation:
 		models[cur_idx].position.z += 0.1 * (float)yoffset;
+		models[cur_idx].transform_version++;
 		break;
 
 	case GeoScaling:
 		models[cur_idx].scale.z += 0.01 * (float)yoffset;
+		models[cur_idx].transform_version++;
 		break;
 
 	case GeoRotation:
 		models[cur_idx].rotation.z += (acosf(-1.0f) / 180.0) * 5 * (float)yoffset;
+		models[cur_idx].transform_version++;
 		break;
 
 	case ShininessEdit:
 		shininess = max(shininess + yoffset * shininess_changing_factor, 1);
+		frame_state.shininess++;
 		break;
 
 	case LightEdit:
+		frame_state.lights++;
 		if (light_idx == 2) { // spotlight mode 
 			lightInfo[2].spotCutoff += yoffset * cutoff_changing_factor * PI / 180.0;
 		}
@@ -740,6 +1070,7 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 {
 	if (mouse_pressed) {
+		scene_dirty = true;
 		if (starting_press_x < 0 || starting_press_y < 0) {
 			starting_press_x = (int)xpos;
 			starting_press_y = (int)ypos;
@@ -772,14 +1103,17 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 			case GeoTranslation:
 				models[cur_idx].position.x += -diff_x * (1.0 / 400.0);
 				models[cur_idx].position.y += diff_y * (1.0 / 400.0);
+				models[cur_idx].transform_version++;
 				break;
 			case GeoScaling:
 				models[cur_idx].scale.x += diff_x * 0.001;
 				models[cur_idx].scale.y += diff_y * 0.001;
+				models[cur_idx].transform_version++;
 				break;
 			case GeoRotation:
 				models[cur_idx].rotation.x += acosf(-1.0f) / 180.0*diff_y*(45.0 / 400.0);
 				models[cur_idx].rotation.y += acosf(-1.0f) / 180.0*diff_x*(45.0 / 400.0);
+				models[cur_idx].transform_version++;
 				break;
 			}
 		}
@@ -788,169 +1122,131 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 
 void setShaders()
 {
-	GLuint v, f, p;
-	char *vs = NULL;
-	char *fs = NULL;
-
-	v = glCreateShader(GL_VERTEX_SHADER);
-	f = glCreateShader(GL_FRAGMENT_SHADER);
-
-	vs = textFileRead("shader.vs.glsl");
-	fs = textFileRead("shader.fs.glsl");
-
-	glShaderSource(v, 1, (const GLchar**)&vs, NULL);
-	glShaderSource(f, 1, (const GLchar**)&fs, NULL);
-
-	free(vs);
-	free(fs);
-
-	GLint success;
-	char infoLog[1000];
-	// compile vertex shader
-	glCompileShader(v);
-	// check for shader compile errors
-	glGetShaderiv(v, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(v, 1000, NULL, infoLog);
-		std::cout << "ERROR: VERTEX SHADER COMPILATION FAILED\n" << infoLog << std::endl;
-	}
-
-	// compile fragment shader
-	glCompileShader(f);
-	// check for shader compile errors
-	glGetShaderiv(f, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(f, 1000, NULL, infoLog);
-		std::cout << "ERROR: FRAGMENT SHADER COMPILATION FAILED\n" << infoLog << std::endl;
-	}
-
-	// create program object
-	p = glCreateProgram();
-
-	// attach shaders to program object
-	glAttachShader(p,f);
-	glAttachShader(p,v);
-
-	// link program
-	glLinkProgram(p);
-	// check for linking errors
-	glGetProgramiv(p, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(p, 1000, NULL, infoLog);
-		std::cout << "ERROR: SHADER PROGRAM LINKING FAILED\n" << infoLog << std::endl;
-	}
-
-	glDeleteShader(v);
-	glDeleteShader(f);
-
-	if (success)
-		glUseProgram(p);
-    else
-    {
-        system("pause");
-        exit(123);
-    }
+	if (!vs_source.Open("shader.vs.glsl"))
+		cout << "The file \"shader.vs.glsl\" was not opened" << endl;
+	if (!fs_source.Open("shader.fs.glsl"))
+		cout << "The file \"shader.fs.glsl\" was not opened" << endl;
 
-	program = p;
+	// the first frame's program; the others are built as they are drawn with
+	UseShaderVariant(light_idx, split_path == SplitTwoPass ? ShadingGouraud : ShadingByInstance, Textured2D);
 }
 
-void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, tinyobj::shape_t* shape)
+// Min/max of vertex_count interleaved xyz positions. Four vertices are
+// twelve floats, i.e. three SSE registers with lanes x y z x | y z x y | z x y z,
+// so lane i of the reduction always belongs to axis i % 3.
+static void ComputeBounds(const float* xyz, size_t vertex_count, float bmin[3], float bmax[3])
 {
-	vector<float> xVector, yVector, zVector;
-	float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
+	for (int k = 0; k < 3; k++)
+	{
+		bmin[k] = xyz[k];
+		bmax[k] = xyz[k];
+	}
 
-	// find out min and max value of X, Y and Z axis
-	for (int i = 0; i < attrib->vertices.size(); i++)
+	size_t v = 0;
+#ifdef USE_SSE
+	if (vertex_count >= 4)
 	{
-		//maxs = max(maxs, attrib->vertices.at(i));
-		if (i % 3 == 0)
+		__m128 min0 = _mm_loadu_ps(xyz), min1 = _mm_loadu_ps(xyz + 4), min2 = _mm_loadu_ps(xyz + 8);
+		__m128 max0 = min0, max1 = min1, max2 = min2;
+		for (v = 4; v + 4 <= vertex_count; v += 4)
 		{
-
-			xVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minX)
-			{
-				minX = attrib->vertices.at(i);
-			}
-
-			if (attrib->vertices.at(i) > maxX)
-			{
-				maxX = attrib->vertices.at(i);
-			}
+			const float* p = xyz + v * 3;
+			__m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+			min0 = _mm_min_ps(min0, a);
+			min1 = _mm_min_ps(min1, b);
+			min2 = _mm_min_ps(min2, c);
+			max0 = _mm_max_ps(max0, a);
+			max1 = _mm_max_ps(max1, b);
+			max2 = _mm_max_ps(max2, c);
 		}
-		else if (i % 3 == 1)
-		{
-			yVector.push_back(attrib->vertices.at(i));
 
-			if (attrib->vertices.at(i) < minY)
-			{
-				minY = attrib->vertices.at(i);
-			}
-
-			if (attrib->vertices.at(i) > maxY)
-			{
-				maxY = attrib->vertices.at(i);
-			}
-		}
-		else if (i % 3 == 2)
+		float lanes_min[12], lanes_max[12];
+		_mm_storeu_ps(lanes_min, min0);
+		_mm_storeu_ps(lanes_min + 4, min1);
+		_mm_storeu_ps(lanes_min + 8, min2);
+		_mm_storeu_ps(lanes_max, max0);
+		_mm_storeu_ps(lanes_max + 4, max1);
+		_mm_storeu_ps(lanes_max + 8, max2);
+		for (int i = 0; i < 12; i++)
 		{
-			zVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minZ)
-			{
-				minZ = attrib->vertices.at(i);
-			}
-
-			if (attrib->vertices.at(i) > maxZ)
-			{
-				maxZ = attrib->vertices.at(i);
-			}
+			bmin[i % 3] = min(bmin[i % 3], lanes_min[i]);
+			bmax[i % 3] = max(bmax[i % 3], lanes_max[i]);
 		}
 	}
-	
-	float offsetX = (maxX + minX) / 2;
-	float offsetY = (maxY + minY) / 2;
-	float offsetZ = (maxZ + minZ) / 2;
-
-	for (int i = 0; i < attrib->vertices.size(); i++)
+#endif
+	for (; v < vertex_count; v++)
 	{
-		if (offsetX != 0 && i % 3 == 0)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
-		}
-		else if (offsetY != 0 && i % 3 == 1)
+		for (int k = 0; k < 3; k++)
 		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
+			bmin[k] = min(bmin[k], xyz[v * 3 + k]);
+			bmax[k] = max(bmax[k], xyz[v * 3 + k]);
 		}
-		else if (offsetZ != 0 && i % 3 == 2)
+	}
+}
+
+// xyz = (xyz - offset) / scale in place, with the same lane layout as
+// ComputeBounds
+static void CenterAndScale(float* xyz, size_t vertex_count, const float offset[3], float scale)
+{
+	size_t v = 0;
+#ifdef USE_SSE
+	__m128 o0 = _mm_setr_ps(offset[0], offset[1], offset[2], offset[0]);
+	__m128 o1 = _mm_setr_ps(offset[1], offset[2], offset[0], offset[1]);
+	__m128 o2 = _mm_setr_ps(offset[2], offset[0], offset[1], offset[2]);
+	__m128 s = _mm_set1_ps(scale);
+	for (; v + 4 <= vertex_count; v += 4)
+	{
+		float* p = xyz + v * 3;
+		_mm_storeu_ps(p, _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(p), o0), s));
+		_mm_storeu_ps(p + 4, _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(p + 4), o1), s));
+		_mm_storeu_ps(p + 8, _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(p + 8), o2), s));
+	}
+#endif
+	for (; v < vertex_count; v++)
+	{
+		for (int k = 0; k < 3; k++)
 		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+			xyz[v * 3 + k] = (xyz[v * 3 + k] - offset[k]) / scale;
 		}
 	}
+}
 
-	float greatestAxis = maxX - minX;
-	float distanceOfYAxis = maxY - minY;
-	float distanceOfZAxis = maxZ - minZ;
+// Centre the whole model on the origin and scale its longest axis to [-1, 1].
+// Runs once per model on its position pool, before any shape is expanded.
+void normalization(vector<tinyobj::real_t>& positions)
+{
+	size_t vertex_count = positions.size() / 3;
+	if (vertex_count == 0)
+		return;
 
-	if (distanceOfYAxis > greatestAxis)
-	{
-		greatestAxis = distanceOfYAxis;
-	}
+	float bmin[3], bmax[3];
+	ComputeBounds(&positions[0], vertex_count, bmin, bmax);
 
-	if (distanceOfZAxis > greatestAxis)
+	float offset[3];
+	float greatestAxis = 0;
+	for (int k = 0; k < 3; k++)
 	{
-		greatestAxis = distanceOfZAxis;
+		offset[k] = (bmax[k] + bmin[k]) / 2;
+		greatestAxis = max(greatestAxis, bmax[k] - bmin[k]);
 	}
 
 	float scale = greatestAxis / 2;
+	if (scale == 0)
+		scale = 1;
+
+	CenterAndScale(&positions[0], vertex_count, offset, scale);
+}
+
+// Expand the faces of shape into one attribute tuple per face corner
+void ExpandShapeCorners(const tinyobj::attrib_t* attrib, const tinyobj::shape_t* shape, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id)
+{
+	size_t corner_count = shape->mesh.indices.size();
+	vertices.reserve(corner_count * 3);
+	colors.reserve(corner_count * 3);
+	normals.reserve(corner_count * 3);
+	textureCoords.reserve(corner_count * 2);
+	material_id.reserve(corner_count);
 
-	for (int i = 0; i < attrib->vertices.size(); i++)
-	{
-		//std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
-		attrib->vertices.at(i) = attrib->vertices.at(i)/ scale;
-	}
 	size_t index_offset = 0;
 	for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++) {
 		int fv = shape->mesh.num_face_vertices[f];
@@ -980,164 +1276,1068 @@ void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<
 	}
 }
 
-static string GetBaseDir(const string& filepath) {
+string GetBaseDir(const string& filepath) {
 	if (filepath.find_last_of("/\\") != std::string::npos)
 		return filepath.substr(0, filepath.find_last_of("/\\"));
 	return "";
 }
 
-GLuint LoadTextureImage(string image_path)
+// Bucket the corners of a shape by material with a counting sort: one pass
+// to histogram, one pass to scatter into presized streams. Corners keep
+// their order inside a bucket and corners without a material are dropped.
+vector<MeshCacheShape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, int material_count)
 {
-	int channel, width, height;
-	int require_channel = 4;
-	stbi_set_flip_vertically_on_load(true);
-	stbi_uc *data = stbi_load(image_path.c_str(), &width, &height, &channel, require_channel);
-	if (data != NULL)
+	vector<size_t> counts(material_count, 0);
+	for (int v = 0; v < material_id.size(); v++)
 	{
-		GLuint tex = 0;
-
-		// [TODO] Bind the image to texture
-		// Hint: glGenTextures, glBindTexture, glTexImage2D, glGenerateMipmap
-		
-		glGenTextures(1, &tex);
-		glBindTexture(GL_TEXTURE_2D, tex);
+		if (material_id[v] >= 0 && material_id[v] < material_count)
+			counts[material_id[v]]++;
+	}
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		
-		// free the image from memory after binding to texture
-		stbi_image_free(data);
-		return tex;
+	// bucket of each material in res, -1 for materials without corners
+	vector<int> bucket(material_count, -1);
+	vector<MeshCacheShape> res;
+	for (int m = 0; m < material_count; m++)
+	{
+		if (counts[m] == 0)
+			continue;
+
+		bucket[m] = res.size();
+		res.push_back(MeshCacheShape());
+		res.back().material_id = m;
+		res.back().streams[MESHCACHE_POSITION].resize(counts[m] * 3);
+		res.back().streams[MESHCACHE_COLOR].resize(counts[m] * 3);
+		res.back().streams[MESHCACHE_NORMAL].resize(counts[m] * 3);
+		res.back().streams[MESHCACHE_TEXCOORD].resize(counts[m] * 2);
 	}
-	else
+
+	vector<size_t> cursor(res.size(), 0);
+	for (int v = 0; v < material_id.size(); v++)
 	{
-		cout << "LoadTextureImage: Cannot load image from " << image_path << endl;
-		return -1;
+		if (material_id[v] < 0 || material_id[v] >= material_count)
+			continue;
+
+		int b = bucket[material_id[v]];
+		size_t i = cursor[b]++;
+		GLfloat* m_vertices = &res[b].streams[MESHCACHE_POSITION][i * 3];
+		GLfloat* m_colors = &res[b].streams[MESHCACHE_COLOR][i * 3];
+		GLfloat* m_normals = &res[b].streams[MESHCACHE_NORMAL][i * 3];
+		GLfloat* m_textureCoords = &res[b].streams[MESHCACHE_TEXCOORD][i * 2];
+
+		m_vertices[0] = vertices[v * 3 + 0];
+		m_vertices[1] = vertices[v * 3 + 1];
+		m_vertices[2] = vertices[v * 3 + 2];
+
+		m_colors[0] = colors[v * 3 + 0];
+		m_colors[1] = colors[v * 3 + 1];
+		m_colors[2] = colors[v * 3 + 2];
+
+		m_normals[0] = normals[v * 3 + 0];
+		m_normals[1] = normals[v * 3 + 1];
+		m_normals[2] = normals[v * 3 + 2];
+
+		m_textureCoords[0] = textureCoords[v * 2 + 0];
+		m_textureCoords[1] = textureCoords[v * 2 + 1];
 	}
+
+	return res;
 }
 
-vector<Shape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, vector<PhongMaterial>& materials)
+static bool SameVertex(const MeshCacheShape& a, size_t va, const MeshCacheShape& b, size_t vb)
 {
-	vector<Shape> res;
-	for (int m = 0; m < materials.size(); m++)
+	for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
 	{
-		vector<GLfloat> m_vertices, m_colors, m_normals, m_textureCoords;
-		for (int v = 0; v < material_id.size(); v++) 
-		{
-			// extract all vertices with same material id and create a new shape for it.
-			if (material_id[v] == m)
-			{
-				m_vertices.push_back(vertices[v * 3 + 0]);
-				m_vertices.push_back(vertices[v * 3 + 1]);
-				m_vertices.push_back(vertices[v * 3 + 2]);
+		const int width = MESH_STREAM_WIDTHS[k];
+		if (memcmp(&a.streams[k][va * width], &b.streams[k][vb * width], width * sizeof(GLfloat)) != 0)
+			return false;
+	}
+	return true;
+}
+
+// Replaces the de-indexed streams of shape by its unique vertices plus an
+// index buffer. Vertices are merged only if position, color, normal and
+// texcoord are bitwise equal, so the rendered result does not change.
+void WeldShape(MeshCacheShape& shape)
+{
+	size_t corner_count = shape.streams[MESHCACHE_POSITION].size() / 3;
 
-				m_colors.push_back(colors[v * 3 + 0]);
-				m_colors.push_back(colors[v * 3 + 1]);
-				m_colors.push_back(colors[v * 3 + 2]);
+	MeshCacheShape welded;
+	welded.name = shape.name;
+	welded.material_id = shape.material_id;
+	vector<uint32_t> indices(corner_count);
 
-				m_normals.push_back(normals[v * 3 + 0]);
-				m_normals.push_back(normals[v * 3 + 1]);
-				m_normals.push_back(normals[v * 3 + 2]);
+	// open addressing table of unique vertex ids, at most half full
+	size_t table_size = 1;
+	while (table_size < corner_count * 2)
+		table_size <<= 1;
+	vector<uint32_t> table(table_size, UINT32_MAX);
+	uint32_t unique_count = 0;
 
-				m_textureCoords.push_back(textureCoords[v * 2 + 0]);
-				m_textureCoords.push_back(textureCoords[v * 2 + 1]);
+	for (size_t v = 0; v < corner_count; v++)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		{
+			for (int c = 0; c < MESH_STREAM_WIDTHS[k]; c++)
+			{
+				uint32_t bits;
+				memcpy(&bits, &shape.streams[k][v * MESH_STREAM_WIDTHS[k] + c], sizeof(bits));
+				hash = (hash ^ bits) * 1099511628211ULL;
 			}
 		}
 
-		if (!m_vertices.empty())
+		size_t slot = (hash ^ (hash >> 32)) & (table_size - 1);
+		while (table[slot] != UINT32_MAX && !SameVertex(shape, v, welded, table[slot]))
+			slot = (slot + 1) & (table_size - 1);
+
+		if (table[slot] == UINT32_MAX)
 		{
-			Shape tmp_shape;
-			glGenVertexArrays(1, &tmp_shape.vao);
-			glBindVertexArray(tmp_shape.vao);
-
-			glGenBuffers(1, &tmp_shape.vbo);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
-			glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(GL_FLOAT), &m_vertices.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-			tmp_shape.vertex_count = m_vertices.size() / 3;
-
-			glGenBuffers(1, &tmp_shape.p_color);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
-			glBufferData(GL_ARRAY_BUFFER, m_colors.size() * sizeof(GL_FLOAT), &m_colors.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-			glGenBuffers(1, &tmp_shape.p_normal);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_normal);
-			glBufferData(GL_ARRAY_BUFFER, m_normals.size() * sizeof(GL_FLOAT), &m_normals.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-			glGenBuffers(1, &tmp_shape.p_texCoord);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_texCoord);
-			glBufferData(GL_ARRAY_BUFFER, m_textureCoords.size() * sizeof(GL_FLOAT), &m_textureCoords.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-			glEnableVertexAttribArray(0);
-			glEnableVertexAttribArray(1);
-			glEnableVertexAttribArray(2);
-			glEnableVertexAttribArray(3);
-
-			tmp_shape.material = materials[m];
-			res.push_back(tmp_shape);
+			table[slot] = unique_count++;
+			for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+			{
+				const GLfloat* attr = &shape.streams[k][v * MESH_STREAM_WIDTHS[k]];
+				welded.streams[k].insert(welded.streams[k].end(), attr, attr + MESH_STREAM_WIDTHS[k]);
+			}
 		}
+		indices[v] = table[slot];
 	}
 
-	return res;
+	// 16 bit indices whenever every vertex is addressable with them
+	if (unique_count <= 65536)
+		welded.indices16.assign(indices.begin(), indices.end());
+	else
+		welded.indices32.swap(indices);
+
+	shape = welded;
 }
 
-void LoadTexturedModels(string model_path)
+// Vertex shader invocations of an indexed draw, estimated with a FIFO
+// post-transform cache of cache_size entries
+template <typename T>
+static int CountCacheMisses(const T* indices, size_t index_count, int cache_size)
 {
-	vector<tinyobj::shape_t> shapes;
-	vector<tinyobj::material_t> materials;
-	tinyobj::attrib_t attrib;
-	vector<GLfloat> vertices;
-	vector<GLfloat> colors;
-	vector<GLfloat> normals;
-	vector<GLfloat> textureCoords;
-	vector<int> material_id;
+	vector<uint32_t> fifo(cache_size, UINT32_MAX);
+	int head = 0;
+	int invocations = 0;
 
-	string err;
-	string warn;
-
-	string base_dir = GetBaseDir(model_path); // handle .mtl with relative path
+	for (size_t i = 0; i < index_count; i++)
+	{
+		if (find(fifo.begin(), fifo.end(), indices[i]) == fifo.end())
+		{
+			fifo[head] = indices[i];
+			head = (head + 1) % cache_size;
+			invocations++;
+		}
+	}
+	return invocations;
+}
 
-#ifdef _WIN32
-	base_dir += "\\";
-#else
-	base_dir += "/";
-#endif
+int SimulateVertexCache(const MeshCacheShapeView& shape, int cache_size)
+{
+	if (shape.index_size == 2)
+		return CountCacheMisses((const uint16_t*)shape.indices, shape.index_count, cache_size);
+	return CountCacheMisses((const uint32_t*)shape.indices, shape.index_count, cache_size);
+}
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
+// Vertex score of Forsyth's "Linear-Speed Vertex Cache Optimisation"
+static float ForsythVertexScore(int cache_pos, int remaining_tris)
+{
+	if (remaining_tris == 0)
+		return -1.0f;
 
-	if (!warn.empty()) {
-		cout << warn << std::endl;
+	float score = 0.0f;
+	if (cache_pos >= 0)
+	{
+		// the last triangle's vertices get a fixed score, so the next
+		// triangle does not prefer reusing all three of them
+		if (cache_pos < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (float)(cache_pos - 3) / (VERTEX_CACHE_SIZE - 3), 1.5f);
 	}
+	// boost vertices with few triangles left so they get finished off
+	score += 2.0f * powf((float)remaining_tris, -0.5f);
+	return score;
+}
 
-	if (!err.empty()) {
-		cerr << err << std::endl;
+// Reorders the triangles of indices for a VERTEX_CACHE_SIZE entry LRU
+// post-transform cache, greedily emitting the best scoring triangle next.
+void OptimizeTriangleOrder(vector<uint32_t>& indices, uint32_t vertex_count)
+{
+	uint32_t tri_count = indices.size() / 3;
+
+	// triangles still to emit, listed per vertex
+	vector<uint32_t> tri_offsets(vertex_count + 1, 0);
+	for (uint32_t i = 0; i < tri_count * 3; i++)
+		tri_offsets[indices[i] + 1]++;
+	for (uint32_t v = 0; v < vertex_count; v++)
+		tri_offsets[v + 1] += tri_offsets[v];
+
+	vector<uint32_t> remaining(vertex_count, 0);
+	vector<uint32_t> vertex_tris(tri_count * 3);
+	for (uint32_t t = 0; t < tri_count; t++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			uint32_t v = indices[t * 3 + c];
+			vertex_tris[tri_offsets[v] + remaining[v]++] = t;
+		}
 	}
 
-	if (!ret) {
-		exit(1);
+	vector<int> cache_pos(vertex_count, -1);
+	vector<float> vertex_score(vertex_count);
+	for (uint32_t v = 0; v < vertex_count; v++)
+		vertex_score[v] = ForsythVertexScore(-1, remaining[v]);
+
+	vector<float> tri_score(tri_count);
+	vector<bool> emitted(tri_count, false);
+	int best = -1;
+	for (uint32_t t = 0; t < tri_count; t++)
+	{
+		tri_score[t] = vertex_score[indices[t * 3 + 0]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+		if (best < 0 || tri_score[t] > tri_score[best])
+			best = t;
 	}
 
-	printf("Load Models Success ! Shapes size %d Material size %d\n", shapes.size(), materials.size());
-	model tmp_model;
+	vector<uint32_t> cache, new_cache;
+	vector<uint32_t> result;
+	result.reserve(indices.size());
+	uint32_t next_unemitted = 0;
 
-	vector<PhongMaterial> allMaterial;
-	for (int i = 0; i < materials.size(); i++)
+	while (result.size() < tri_count * 3)
 	{
-		PhongMaterial material;
-		material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
-		material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
-		material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
-		
-		
-		cout << string(materials[i].diffuse_texname) << endl;
+		if (best < 0)
+		{
+			// nothing in the cache has triangles left, restart from the
+			// first triangle not emitted yet
+			while (emitted[next_unemitted])
+				next_unemitted++;
+			best = next_unemitted;
+		}
 
-		if (string(materials[i].diffuse_texname).find("Eye") != string::npos)
+		emitted[best] = true;
+		new_cache.clear();
+		for (int c = 0; c < 3; c++)
 		{
-			material.isEye = 1;
-			tmp_model.hasEye = true;
+			uint32_t v = indices[best * 3 + c];
+			result.push_back(v);
+
+			uint32_t* tris = &vertex_tris[tri_offsets[v]];
+			for (uint32_t j = 0; j < remaining[v]; j++)
+			{
+				if (tris[j] == best)
+				{
+					tris[j] = tris[remaining[v] - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+
+			if (find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+				new_cache.push_back(v);
+		}
+		for (int i = 0; i < cache.size(); i++)
+		{
+			if (find(new_cache.begin(), new_cache.end(), cache[i]) == new_cache.end())
+				new_cache.push_back(cache[i]);
+		}
+
+		// rescore every vertex that moved in or fell out of the cache and
+		// pass the change on to its remaining triangles
+		for (int i = 0; i < new_cache.size(); i++)
+		{
+			uint32_t v = new_cache[i];
+			cache_pos[v] = i < VERTEX_CACHE_SIZE ? i : -1;
+			float score = ForsythVertexScore(cache_pos[v], remaining[v]);
+			float delta = score - vertex_score[v];
+			vertex_score[v] = score;
+			for (uint32_t j = 0; j < remaining[v]; j++)
+				tri_score[vertex_tris[tri_offsets[v] + j]] += delta;
+		}
+		if (new_cache.size() > VERTEX_CACHE_SIZE)
+			new_cache.resize(VERTEX_CACHE_SIZE);
+		cache.swap(new_cache);
+
+		best = -1;
+		for (int i = 0; i < cache.size(); i++)
+		{
+			uint32_t v = cache[i];
+			for (uint32_t j = 0; j < remaining[v]; j++)
+			{
+				uint32_t t = vertex_tris[tri_offsets[v] + j];
+				if (best < 0 || tri_score[t] > tri_score[best])
+					best = t;
+			}
+		}
+	}
+
+	indices.swap(result);
+}
+
+// Renumbers the vertices in order of first use by indices and permutes the
+// streams to match, so vertex fetch walks the buffers front to back
+void OptimizeVertexFetch(MeshCacheShape& shape, vector<uint32_t>& indices)
+{
+	uint32_t vertex_count = shape.streams[MESHCACHE_POSITION].size() / 3;
+	vector<uint32_t> remap(vertex_count, UINT32_MAX);
+	vector<GLfloat> streams[MESHCACHE_STREAM_COUNT];
+	uint32_t next = 0;
+
+	for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		streams[k].reserve(shape.streams[k].size());
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		uint32_t v = indices[i];
+		if (remap[v] == UINT32_MAX)
+		{
+			remap[v] = next++;
+			for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+			{
+				const GLfloat* attr = &shape.streams[k][v * MESH_STREAM_WIDTHS[k]];
+				streams[k].insert(streams[k].end(), attr, attr + MESH_STREAM_WIDTHS[k]);
+			}
+		}
+		indices[i] = remap[v];
+	}
+
+	for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		shape.streams[k].swap(streams[k]);
+}
+
+// Triangle reorder followed by vertex fetch reorder of a welded shape
+void OptimizeVertexCache(MeshCacheShape& shape)
+{
+	vector<uint32_t> indices;
+	if (!shape.indices32.empty())
+		indices.swap(shape.indices32);
+	else
+		indices.assign(shape.indices16.begin(), shape.indices16.end());
+
+	if (indices.empty())
+		return;
+
+	// keep the OBJ order if it already suits the cache better, as it does
+	// for meshes exported in strip order
+	vector<uint32_t> reordered = indices;
+	OptimizeTriangleOrder(reordered, shape.streams[MESHCACHE_POSITION].size() / 3);
+	if (CountCacheMisses(&reordered[0], reordered.size(), VERTEX_CACHE_SIZE) < CountCacheMisses(&indices[0], indices.size(), VERTEX_CACHE_SIZE))
+		indices.swap(reordered);
+	OptimizeVertexFetch(shape, indices);
+
+	if (!shape.indices16.empty())
+		shape.indices16.assign(indices.begin(), indices.end());
+	else
+		shape.indices32.swap(indices);
+}
+
+bool geometry_stats = false; // --geometry-stats: ReportIndexedGeometry on each upload
+
+// Print what welding saves for one model: glDrawArrays ran the vertex shader
+// once per face corner and uploaded every corner to the VBOs. It simulates
+// the vertex cache over every index, too slow for a plain load.
+void ReportIndexedGeometry(const string& model_path, const MeshCacheView& view)
+{
+	size_t unindexed_bytes = 0, vbo_bytes = 0, ebo_bytes = 0;
+	int corners = 0, invocations = 0;
+
+	for (int i = 0; i < view.shapes.size(); i++)
+	{
+		const MeshCacheShapeView& shape = view.shapes[i];
+		size_t vertex_bytes = 0;
+		for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		{
+			vertex_bytes += MESH_STREAM_WIDTHS[k] * sizeof(GLfloat);
+			vbo_bytes += shape.stream_sizes[k] * sizeof(GLfloat);
+		}
+		unindexed_bytes += shape.index_count * vertex_bytes;
+		ebo_bytes += shape.index_count * shape.index_size;
+		corners += shape.index_count;
+		invocations += SimulateVertexCache(shape, VERTEX_CACHE_SIZE);
+	}
+
+	printf("%s: VBO %zu -> %zu bytes (+%zu index bytes), vertex shader invocations %d -> %d\n",
+		model_path.c_str(), unindexed_bytes, vbo_bytes, ebo_bytes, corners, invocations);
+}
+
+Shape UploadShape(const MeshCacheShapeView& shape, const PhongMaterial& material, const vector<float>* layers = NULL)
+{
+	Shape tmp_shape;
+	glGenVertexArrays(1, &tmp_shape.vao);
+	glBindVertexArray(tmp_shape.vao);
+
+	glGenBuffers(1, &tmp_shape.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
+	glBufferData(GL_ARRAY_BUFFER, shape.stream_sizes[MESHCACHE_POSITION] * sizeof(GLfloat), shape.streams[MESHCACHE_POSITION], GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	tmp_shape.vertex_count = shape.stream_sizes[MESHCACHE_POSITION] / 3;
+
+	glGenBuffers(1, &tmp_shape.p_color);
+	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
+	glBufferData(GL_ARRAY_BUFFER, shape.stream_sizes[MESHCACHE_COLOR] * sizeof(GLfloat), shape.streams[MESHCACHE_COLOR], GL_STATIC_DRAW);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glGenBuffers(1, &tmp_shape.p_normal);
+	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_normal);
+	glBufferData(GL_ARRAY_BUFFER, shape.stream_sizes[MESHCACHE_NORMAL] * sizeof(GLfloat), shape.streams[MESHCACHE_NORMAL], GL_STATIC_DRAW);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glGenBuffers(1, &tmp_shape.p_texCoord);
+	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_texCoord);
+	glBufferData(GL_ARRAY_BUFFER, shape.stream_sizes[MESHCACHE_TEXCOORD] * sizeof(GLfloat), shape.streams[MESHCACHE_TEXCOORD], GL_STATIC_DRAW);
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+	tmp_shape.p_layer = 0;
+	if (layers != NULL && !layers->empty())
+	{
+		glGenBuffers(1, &tmp_shape.p_layer);
+		glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_layer);
+		glBufferData(GL_ARRAY_BUFFER, layers->size() * sizeof(GLfloat), &(*layers)[0], GL_STATIC_DRAW);
+		glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(4);
+	}
+
+	// element buffer binding is part of the VAO state
+	glGenBuffers(1, &tmp_shape.ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tmp_shape.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, shape.index_count * shape.index_size, shape.indices, GL_STATIC_DRAW);
+	tmp_shape.indexCount = shape.index_count;
+	tmp_shape.indexType = shape.index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glEnableVertexAttribArray(3);
+
+	tmp_shape.material = material;
+	return tmp_shape;
+}
+
+// Parse model_path and build the per-material streams and material table
+// UploadPreparedModel uploads
+void CopyMaterials(const vector<tinyobj::material_t>& materials, MeshCacheData& data)
+{
+	for (int i = 0; i < materials.size(); i++)
+	{
+		MeshCacheMaterial material;
+		material.name = materials[i].name;
+		memcpy(material.ambient, materials[i].ambient, sizeof(material.ambient));
+		memcpy(material.diffuse, materials[i].diffuse, sizeof(material.diffuse));
+		memcpy(material.specular, materials[i].specular, sizeof(material.specular));
+		material.shininess = materials[i].shininess;
+		material.diffuse_texname = materials[i].diffuse_texname;
+		data.materials.push_back(material);
+	}
+}
+
+// The original ingestion: LoadObj into attrib_t + shape_t, then expand every
+// shape's corners and split them by material. Kept as the reference for
+// --bench-ingest and behind --no-streaming.
+bool BuildModelDataFromAttrib(const string& model_path, MeshCacheData& data, bool optimize_vertex_cache, unsigned int parse_threads)
+{
+	vector<tinyobj::shape_t> shapes;
+	vector<tinyobj::material_t> materials;
+	tinyobj::attrib_t attrib;
+	vector<GLfloat> vertices;
+	vector<GLfloat> colors;
+	vector<GLfloat> normals;
+	vector<GLfloat> textureCoords;
+	vector<int> material_id;
+
+	string err;
+	string warn;
+
+	string base_dir = GetBaseDir(model_path); // handle .mtl with relative path
+
+#ifdef _WIN32
+	base_dir += "\\";
+#else
+	base_dir += "/";
+#endif
+
+	bool ret = LoadObjFile(&attrib, &shapes, &materials, &warn, &err, model_path, base_dir, parse_threads);
+
+	if (!warn.empty()) {
+		cout << warn << std::endl;
+	}
+
+	if (!err.empty()) {
+		cerr << err << std::endl;
+	}
+
+	if (!ret) {
+		return false;
+	}
+
+	printf("Load Models Success ! Shapes size %zu Material size %zu\n", shapes.size(), materials.size());
+
+	CopyMaterials(materials, data);
+
+	normalization(attrib.vertices);
+
+	for (int i = 0; i < shapes.size(); i++)
+	{
+		vertices.clear();
+		colors.clear();
+		normals.clear();
+		textureCoords.clear();
+		material_id.clear();
+
+		ExpandShapeCorners(&attrib, &shapes[i], vertices, colors, normals, textureCoords, material_id);
+		// printf("Vertices size: %d", vertices.size() / 3);
+
+		// split current shape into multiple shapes base on material_id.
+		vector<MeshCacheShape> splitedShapeByMaterial = SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, materials.size());
+		for (int s = 0; s < splitedShapeByMaterial.size(); s++)
+		{
+			splitedShapeByMaterial[s].name = shapes[i].name;
+			WeldShape(splitedShapeByMaterial[s]);
+			if (optimize_vertex_cache)
+				OptimizeVertexCache(splitedShapeByMaterial[s]);
+		}
+
+		// concatenate splited shape to model's shape list
+		data.shapes.insert(data.shapes.end(), splitedShapeByMaterial.begin(), splitedShapeByMaterial.end());
+	}
+	return true;
+}
+
+// One `g`/`o` shape of an OBJ being streamed: its triangle corners bucketed
+// by material as the faces are parsed, as zero-based pool indices. Corners
+// without a material are dropped right away, as SplitShapeByMaterial does.
+struct StreamedShape
+{
+	string name;
+	vector<vector<tinyobj::index_t> > corners;
+};
+
+// State shared by the LoadObjWithCallback callbacks of BuildModelDataStreaming.
+// The pools are the only copy of the parsed attributes.
+struct ObjStream
+{
+	vector<tinyobj::real_t> positions;
+	vector<tinyobj::real_t> colors;
+	vector<tinyobj::real_t> normals;
+	vector<tinyobj::real_t> texcoords;
+	vector<tinyobj::material_t> materials;
+	map<string, int> material_map;
+	int material_id = -1;
+	vector<StreamedShape> shapes;
+	bool bad_index = false;
+};
+
+static void StreamVertex(void* user_data, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t r, tinyobj::real_t g, tinyobj::real_t b)
+{
+	ObjStream* stream = (ObjStream*)user_data;
+	tinyobj::real_t xyz[3] = { x, y, z }, rgb[3] = { r, g, b };
+	stream->positions.insert(stream->positions.end(), xyz, xyz + 3);
+	stream->colors.insert(stream->colors.end(), rgb, rgb + 3);
+}
+
+static void StreamNormal(void* user_data, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z)
+{
+	ObjStream* stream = (ObjStream*)user_data;
+	tinyobj::real_t xyz[3] = { x, y, z };
+	stream->normals.insert(stream->normals.end(), xyz, xyz + 3);
+}
+
+// w is dropped: BuildModelDataFromAttrib reads no texcoord_ws either
+static void StreamTexcoord(void* user_data, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t)
+{
+	ObjStream* stream = (ObjStream*)user_data;
+	stream->texcoords.push_back(x);
+	stream->texcoords.push_back(y);
+}
+
+// Raw OBJ index (1-based, negative = relative to the pool so far, 0 = absent)
+// to a pool index, -1 when absent
+static int ResolveObjIndex(int idx, size_t pool_count)
+{
+	if (idx > 0)
+		return idx - 1;
+	if (idx < 0)
+		return (int)pool_count + idx;
+	return -1;
+}
+
+static void StreamFace(void* user_data, tinyobj::index_t* indices, int num_indices)
+{
+	ObjStream* stream = (ObjStream*)user_data;
+	if (stream->material_id < 0 || num_indices < 3)
+		return;
+
+	tinyobj::face_t face;
+	face.vertex_indices.resize(num_indices);
+	for (int k = 0; k < num_indices; k++)
+	{
+		tinyobj::vertex_index_t& vi = face.vertex_indices[k];
+		vi.v_idx = ResolveObjIndex(indices[k].vertex_index, stream->positions.size() / 3);
+		vi.vn_idx = ResolveObjIndex(indices[k].normal_index, stream->normals.size() / 3);
+		vi.vt_idx = ResolveObjIndex(indices[k].texcoord_index, stream->texcoords.size() / 2);
+		if (vi.v_idx < 0)
+			stream->bad_index = true;	// LoadObj rejects a zero position index
+	}
+
+	StreamedShape& shape = stream->shapes.back();
+	if (shape.corners.size() < stream->materials.size())
+		shape.corners.resize(stream->materials.size());
+	vector<tinyobj::index_t>& bucket = shape.corners[stream->material_id];
+
+	if (num_indices == 3)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			tinyobj::index_t idx;
+			idx.vertex_index = face.vertex_indices[k].v_idx;
+			idx.normal_index = face.vertex_indices[k].vn_idx;
+			idx.texcoord_index = face.vertex_indices[k].vt_idx;
+			bucket.push_back(idx);
+		}
+		return;
+	}
+
+	// polygons go through LoadObj's own ear clipping, so they split the same way
+	tinyobj::PrimGroup group;
+	group.faceGroup.push_back(face);
+	tinyobj::shape_t triangles;
+	tinyobj::exportGroupsToShape(&triangles, group, vector<tinyobj::tag_t>(), stream->material_id, "", true, stream->positions);
+	bucket.insert(bucket.end(), triangles.mesh.indices.begin(), triangles.mesh.indices.end());
+}
+
+static void StreamUseMtl(void* user_data, const char* name, int)
+{
+	ObjStream* stream = (ObjStream*)user_data;
+	// LoadObj takes the first word after `usemtl`, LoadObjWithCallback the rest
+	// of the line, and the material id it passes is looked up by that
+	name += strspn(name, " \t");
+	map<string, int>::const_iterator it = stream->material_map.find(string(name, strcspn(name, " \t\r")));
+	stream->material_id = it != stream->material_map.end() ? it->second : -1;
+}
+
+static void StreamMtlLib(void* user_data, const tinyobj::material_t* materials, int num_materials)
+{
+	ObjStream* stream = (ObjStream*)user_data;
+	stream->materials.assign(materials, materials + num_materials);
+	stream->material_map.clear();
+	for (int i = 0; i < num_materials; i++)
+		stream->material_map.insert(make_pair(materials[i].name, i));
+}
+
+// `g` and `o` start a new shape, as in LoadObj
+static void StreamShape(ObjStream* stream, const string& name)
+{
+	bool has_corners = false;
+	for (const vector<tinyobj::index_t>& bucket : stream->shapes.back().corners)
+		has_corners |= !bucket.empty();
+	if (has_corners)
+		stream->shapes.push_back(StreamedShape());
+	stream->shapes.back().name = name;
+}
+
+static void StreamGroup(void* user_data, const char** names, int num_names)
+{
+	string name;
+	for (int i = 0; i < num_names; i++)
+		name += (i > 0 ? " " : "") + string(names[i]);
+	StreamShape((ObjStream*)user_data, name);
+}
+
+static void StreamObject(void* user_data, const char* name)
+{
+	StreamShape((ObjStream*)user_data, name);
+}
+
+// Streaming ingestion: LoadObjWithCallback fills only the attribute pools and
+// the per-material corner buckets, and each bucket is then gathered straight
+// into presized final streams. This skips the shape_t index lists and the
+// expanded and split copies of BuildModelDataFromAttrib, with identical output.
+bool BuildModelDataStreaming(const string& model_path, MeshCacheData& data, bool optimize_vertex_cache)
+{
+	string base_dir = GetBaseDir(model_path); // handle .mtl with relative path
+
+#ifdef _WIN32
+	base_dir += "\\";
+#else
+	base_dir += "/";
+#endif
+
+	tinyobj::callback_t callback;
+	callback.vertex_color_cb = StreamVertex;
+	callback.normal_cb = StreamNormal;
+	callback.texcoord_cb = StreamTexcoord;
+	callback.index_cb = StreamFace;
+	callback.usemtl_cb = StreamUseMtl;
+	callback.mtllib_cb = StreamMtlLib;
+	callback.group_cb = StreamGroup;
+	callback.object_cb = StreamObject;
+
+	ObjStream stream;
+	stream.shapes.push_back(StreamedShape());
+
+	string err;
+	string warn;
+	bool ret = LoadObjFileWithCallback(model_path, base_dir, callback, &stream, &warn, &err);
+
+	if (!warn.empty()) {
+		cout << warn << std::endl;
+	}
+
+	if (!err.empty()) {
+		cerr << err << std::endl;
+	}
+
+	if (!ret || stream.bad_index) {
+		return false;
+	}
+
+	printf("Load Models Success ! Shapes size %zu Material size %zu\n", stream.shapes.size(), stream.materials.size());
+
+	CopyMaterials(stream.materials, data);
+
+	normalization(stream.positions);
+
+	size_t position_count = stream.positions.size() / 3;
+	size_t normal_count = stream.normals.size() / 3;
+	size_t texcoord_count = stream.texcoords.size() / 2;
+
+	for (StreamedShape& streamed : stream.shapes)
+	{
+		for (int m = 0; m < streamed.corners.size(); m++)
+		{
+			vector<tinyobj::index_t>& corners = streamed.corners[m];
+			if (corners.empty())
+				continue;
+
+			data.shapes.push_back(MeshCacheShape());
+			MeshCacheShape& shape = data.shapes.back();
+			shape.name = streamed.name;
+			shape.material_id = m;
+			for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+				shape.streams[k].resize(corners.size() * MESH_STREAM_WIDTHS[k]);
+
+			// out of range indices read as zeros instead of past the pools
+			for (size_t i = 0; i < corners.size(); i++)
+			{
+				const tinyobj::index_t& idx = corners[i];
+				for (int k = 0; k < 3; k++)
+				{
+					bool has_position = idx.vertex_index >= 0 && idx.vertex_index < position_count;
+					bool has_normal = idx.normal_index >= 0 && idx.normal_index < normal_count;
+					shape.streams[MESHCACHE_POSITION][i * 3 + k] = has_position ? stream.positions[idx.vertex_index * 3 + k] : 0;
+					shape.streams[MESHCACHE_COLOR][i * 3 + k] = has_position ? stream.colors[idx.vertex_index * 3 + k] : 0;
+					shape.streams[MESHCACHE_NORMAL][i * 3 + k] = has_normal ? stream.normals[idx.normal_index * 3 + k] : 0;
+				}
+				bool has_texcoord = idx.texcoord_index >= 0 && idx.texcoord_index < texcoord_count;
+				shape.streams[MESHCACHE_TEXCOORD][i * 2 + 0] = has_texcoord ? stream.texcoords[idx.texcoord_index * 2 + 0] : 0;
+				shape.streams[MESHCACHE_TEXCOORD][i * 2 + 1] = has_texcoord ? stream.texcoords[idx.texcoord_index * 2 + 1] : 0;
+			}
+			vector<tinyobj::index_t>().swap(corners);
+
+			WeldShape(shape);
+			if (optimize_vertex_cache)
+				OptimizeVertexCache(shape);
+		}
+	}
+	return true;
+}
+
+// Cleared by --no-streaming to build models through BuildModelDataFromAttrib
+bool streaming_ingest = true;
+
+bool BuildModelData(const string& model_path, MeshCacheData& data, bool optimize_vertex_cache, unsigned int parse_threads)
+{
+	if (streaming_ingest)
+		return BuildModelDataStreaming(model_path, data, optimize_vertex_cache);
+	return BuildModelDataFromAttrib(model_path, data, optimize_vertex_cache, parse_threads);
+}
+
+// Materials whose texture is scrolled through offsets by the eye animation
+static bool IsEyeMaterial(const MeshCacheMaterial& material)
+{
+	return material.diffuse_texname.find("Eye") != string::npos;
+}
+
+static void CopyShapeView(const MeshCacheShapeView& view, MeshCacheShape& shape)
+{
+	shape.name = view.name;
+	shape.material_id = view.material_id;
+	for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		shape.streams[k].assign(view.streams[k], view.streams[k] + view.stream_sizes[k]);
+	if (view.index_size == 2)
+		shape.indices16.assign((const uint16_t*)view.indices, (const uint16_t*)view.indices + view.index_count);
+	else if (view.index_size == 4)
+		shape.indices32.assign((const uint32_t*)view.indices, (const uint32_t*)view.indices + view.index_count);
+}
+
+// Appends the vertices of view to merged and its indices, or the implied
+// 0 .. n - 1 of a non-indexed shape, rebased onto them to indices
+static void AppendShape(const MeshCacheShapeView& view, MeshCacheShape& merged, vector<uint32_t>& indices)
+{
+	uint32_t base = (uint32_t)(merged.streams[MESHCACHE_POSITION].size() / 3);
+	for (int k = 0; k < MESHCACHE_STREAM_COUNT; k++)
+		merged.streams[k].insert(merged.streams[k].end(), view.streams[k], view.streams[k] + view.stream_sizes[k]);
+	uint32_t count = view.index_size == 0 ? view.stream_sizes[MESHCACHE_POSITION] / 3 : view.index_count;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t index = i;
+		if (view.index_size == 2)
+			index = ((const uint16_t*)view.indices)[i];
+		else if (view.index_size == 4)
+			index = ((const uint32_t*)view.indices)[i];
+		indices.push_back(base + index);
+	}
+}
+
+// Batching: materials that differ only in their diffuse image are merged,
+// their images put in one texture and their shapes into one shape, so the
+// model binds one texture and draws once where it drew per material. Two
+// kinds of shared texture:
+// - with --texture-arrays, images of one size become the layers of a
+//   GL_TEXTURE_2D_ARRAY (AcquireArrayTexture), each vertex carrying its
+//   layer in prepared.layers. Texcoords are kept, so they may repeat.
+// - the rest are packed into an atlas (AcquireAtlasTexture) with their
+//   texcoords moved into it, which needs them all in [0, 1].
+//
+// A material qualifies if it has a texture and is not an eye, whose offsets
+// animate the texcoords; the rest stay as they are. Materials merge when Ka,
+// Kd, Ks and shininess are equal. Fills prepared.textures for the merged
+// ones.
+bool texture_atlases = true; // false with --no-atlas
+bool texture_arrays = false; // --texture-arrays
+const float kAtlasTexcoordSlack = 1e-3f; // texcoords this far outside [0, 1] still fit an atlas
+
+static bool SameMaterialParameters(const MeshCacheMaterial& a, const MeshCacheMaterial& b)
+{
+	return memcmp(a.ambient, b.ambient, sizeof(a.ambient)) == 0 && memcmp(a.diffuse, b.diffuse, sizeof(a.diffuse)) == 0 &&
+		memcmp(a.specular, b.specular, sizeof(a.specular)) == 0 && a.shininess == b.shininess;
+}
+
+static void MergeBatchedMaterials(const string& model_path, const string& base_dir, PreparedModel& prepared)
+{
+	const MeshCacheView& view = prepared.view;
+	int material_count = (int)view.materials.size();
+	vector<bool> qualifies(material_count, false), used(material_count, false), fits_atlas(material_count, true);
+	for (int m = 0; m < material_count; m++)
+		qualifies[m] = !view.materials[m].diffuse_texname.empty() && !IsEyeMaterial(view.materials[m]);
+	for (int i = 0; i < view.shapes.size(); i++)
+	{
+		const MeshCacheShapeView& shape = view.shapes[i];
+		if (shape.material_id < 0 || shape.material_id >= material_count)
+			continue;
+		used[shape.material_id] = true;
+		const float* uv = shape.streams[MESHCACHE_TEXCOORD];
+		for (uint32_t k = 0; k < shape.stream_sizes[MESHCACHE_TEXCOORD]; k++)
+		{
+			if (uv[k] < -kAtlasTexcoordSlack || uv[k] > 1.0f + kAtlasTexcoordSlack)
+			{
+				fits_atlas[shape.material_id] = false;
+				break;
+			}
+		}
+	}
+	vector<pair<int, int> > image_sizes(material_count, make_pair(0, 0));
+	if (texture_arrays)
+	{
+		for (int m = 0; m < material_count; m++)
+		{
+			if (qualifies[m] && used[m])
+				ReadImageSize(base_dir + view.materials[m].diffuse_texname, &image_sizes[m].first, &image_sizes[m].second);
+		}
+	}
+
+	// group[m]: the first material of m's group, -1 if m is left alone;
+	// atlas_rects[m] where its image went and atlas_sizes[group[m]] the
+	// atlas, or layers[m] its array layer
+	vector<int> group(material_count, -1);
+	vector<AtlasRect> atlas_rects(material_count);
+	vector<pair<int, int> > atlas_sizes(material_count, make_pair(0, 0));
+	vector<int> layers(material_count, -1);
+	int merged_groups = 0;
+	string notes;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		bool arrays = pass == 0;
+		if ((arrays && !texture_arrays) || (!arrays && !texture_atlases))
+			continue;
+		for (int m = 0; m < material_count; m++)
+		{
+			if (!qualifies[m] || !used[m] || group[m] >= 0 || (arrays ? image_sizes[m].first == 0 : !fits_atlas[m]))
+				continue;
+			vector<int> members(1, m);
+			for (int n = m + 1; n < material_count; n++)
+			{
+				if (qualifies[n] && used[n] && group[n] < 0 && SameMaterialParameters(view.materials[m], view.materials[n]) &&
+					(arrays ? image_sizes[n] == image_sizes[m] : fits_atlas[n]))
+					members.push_back(n);
+			}
+			if (members.size() < 2)
+				continue;
+
+			vector<string> image_paths;
+			vector<int> image_of(members.size());
+			for (int i = 0; i < members.size(); i++)
+			{
+				string image_path = base_dir + view.materials[members[i]].diffuse_texname;
+				vector<string>::iterator it = find(image_paths.begin(), image_paths.end(), image_path);
+				image_of[i] = (int)(it - image_paths.begin());
+				if (it == image_paths.end())
+					image_paths.push_back(image_path);
+			}
+
+			// one image between them needs no atlas or array, only the merge
+			TextureAtlas atlas;
+			int handle;
+			if (image_paths.size() == 1)
+				handle = AcquireTexture(image_paths[0]);
+			else if (arrays)
+				handle = AcquireArrayTexture(image_paths);
+			else
+				handle = AcquireAtlasTexture(image_paths, atlas);
+			if (handle < 0)
+				continue;
+			for (int i = 0; i < members.size(); i++)
+			{
+				group[members[i]] = m;
+				prepared.textures[members[i]] = handle;
+				// a reference per material, as for the ones left alone
+				if (i > 0)
+					RetainTexture(handle);
+				if (image_paths.size() > 1 && arrays)
+					layers[members[i]] = image_of[i];
+				else if (image_paths.size() > 1)
+					atlas_rects[members[i]] = atlas.rects[image_of[i]];
+			}
+			if (image_paths.size() > 1 && arrays)
+			{
+				notes += ", " + to_string(image_paths.size()) + " images in a " + to_string(image_sizes[m].first) + "x" + to_string(image_sizes[m].second) + " array";
+			}
+			else if (image_paths.size() > 1)
+			{
+				atlas_sizes[m] = make_pair(atlas.width, atlas.height);
+				notes += ", " + to_string(image_paths.size()) + " images in a " + to_string(atlas.width) + "x" + to_string(atlas.height) + " atlas";
+			}
+			merged_groups++;
+		}
+	}
+
+	int shapes_before = (int)view.shapes.size();
+	if (merged_groups > 0)
+	{
+		MeshCacheData merged;
+		merged.materials = view.materials;
+		vector<int> merged_shape(material_count, -1); // by group leader
+		vector<vector<uint32_t> > merged_indices;
+		prepared.layers.clear();
+		for (int i = 0; i < view.shapes.size(); i++)
+		{
+			const MeshCacheShapeView& shape = view.shapes[i];
+			int leader = shape.material_id >= 0 && shape.material_id < material_count ? group[shape.material_id] : -1;
+			if (leader < 0)
+			{
+				merged.shapes.push_back(MeshCacheShape());
+				CopyShapeView(shape, merged.shapes.back());
+				merged_indices.push_back(vector<uint32_t>());
+				prepared.layers.push_back(vector<float>());
+				continue;
+			}
+			if (merged_shape[leader] < 0)
+			{
+				merged_shape[leader] = (int)merged.shapes.size();
+				merged.shapes.push_back(MeshCacheShape());
+				merged.shapes.back().name = shape.name;
+				merged.shapes.back().material_id = leader;
+				merged_indices.push_back(vector<uint32_t>());
+				prepared.layers.push_back(vector<float>());
+			}
+			MeshCacheShape& dst = merged.shapes[merged_shape[leader]];
+			size_t first_uv = dst.streams[MESHCACHE_TEXCOORD].size();
+			AppendShape(shape, dst, merged_indices[merged_shape[leader]]);
+			size_t vertex_count = (dst.streams[MESHCACHE_TEXCOORD].size() - first_uv) / 2;
+			if (layers[shape.material_id] >= 0)
+			{
+				vector<float>& dst_layers = prepared.layers[merged_shape[leader]];
+				dst_layers.insert(dst_layers.end(), vertex_count, (float)layers[shape.material_id]);
+			}
+			else if (atlas_sizes[leader].first > 0)
+			{
+				MapToAtlas(atlas_rects[shape.material_id], atlas_sizes[leader].first, atlas_sizes[leader].second,
+					&dst.streams[MESHCACHE_TEXCOORD][first_uv], vertex_count);
+			}
+		}
+		for (int i = 0; i < merged.shapes.size(); i++)
+		{
+			const vector<uint32_t>& indices = merged_indices[i];
+			if (indices.empty())
+				continue;
+			if (merged.shapes[i].streams[MESHCACHE_POSITION].size() / 3 <= 65536)
+				merged.shapes[i].indices16.assign(indices.begin(), indices.end());
+			else
+				merged.shapes[i].indices32 = indices;
+		}
+
+		prepared.data = move(merged);
+		MakeMeshCacheView(prepared.data, &prepared.view);
+	}
+
+	int shapes_after = (int)prepared.view.shapes.size();
+	printf("%s: %d -> %d shapes%s: %d -> %d draw calls and %d -> %d texture binds per frame\n", model_path.c_str(), shapes_before, shapes_after,
+		notes.c_str(), 2 * shapes_before, 2 * shapes_after, shapes_before, shapes_after);
+}
+
+bool PrepareModel(const string& model_path, PreparedModel& prepared, unsigned int parse_threads)
+{
+	string cache_path = MeshCachePath(model_path, MESH_CACHE_TAG);
+
+	if (!ReadMeshCache(cache_path, model_path, MESH_CACHE_TAG, &prepared.cache_file, &prepared.view))
+	{
+		if (!BuildModelData(model_path, prepared.data, true, parse_threads)) {
+			return false;
+		}
+		if (!WriteMeshCache(cache_path, model_path, MESH_CACHE_TAG, prepared.data)) {
+			cout << "PrepareModel: Cannot write mesh cache " << cache_path << endl;
+		}
+		MakeMeshCacheView(prepared.data, &prepared.view);
+	}
+
+	string base_dir = GetBaseDir(model_path);
+
+#ifdef _WIN32
+	base_dir += "\\";
+#else
+	base_dir += "/";
+#endif
+
+	prepared.textures.assign(prepared.view.materials.size(), -1);
+	if (texture_atlases || texture_arrays)
+		MergeBatchedMaterials(model_path, base_dir, prepared);
+	for (int i = 0; i < prepared.view.materials.size(); i++)
+	{
+		cout << prepared.view.materials[i].diffuse_texname << endl;
+		if (prepared.textures[i] < 0)
+			prepared.textures[i] = AcquireTexture(base_dir + prepared.view.materials[i].diffuse_texname);
+	}
+	return true;
+}
+
+// GL side of loading, on the render thread
+void UploadPreparedModel(const string& model_path, PreparedModel& prepared, model& dst)
+{
+	if (geometry_stats)
+		ReportIndexedGeometry(model_path, prepared.view);
+
+	vector<PhongMaterial> allMaterial;
+	for (int i = 0; i < prepared.view.materials.size(); i++)
+	{
+		PhongMaterial material;
+		material.Ka = Vector3(prepared.view.materials[i].ambient[0], prepared.view.materials[i].ambient[1], prepared.view.materials[i].ambient[2]);
+		material.Kd = Vector3(prepared.view.materials[i].diffuse[0], prepared.view.materials[i].diffuse[1], prepared.view.materials[i].diffuse[2]);
+		material.Ks = Vector3(prepared.view.materials[i].specular[0], prepared.view.materials[i].specular[1], prepared.view.materials[i].specular[2]);
+		
+		
+		if (IsEyeMaterial(prepared.view.materials[i]))
+		{
+			material.isEye = 1;
+			dst.hasEye = true;
 
 			Offset offs(0, 0);
 			material.offsets.push_back(offs);
@@ -1172,10 +2372,13 @@ void LoadTexturedModels(string model_path)
 		}
 		
 
-		material.diffuseTexture = LoadTextureImage(base_dir + string(materials[i].diffuse_texname));
+		material.textureHandle = prepared.textures[i];
+		material.diffuseTexture = material.textureHandle < 0 ? -1 : CachedTexture(material.textureHandle);
+		material.flipTexV = material.textureHandle < 0 ? 0 : TextureTopDown(material.textureHandle);
+		material.textureArray = material.textureHandle < 0 ? 0 : TextureLayered(material.textureHandle);
 		if (material.diffuseTexture == -1)
 		{
-			cout << "LoadTexturedModels: Fail to load model's material " << i << endl;
+			cout << "UploadPreparedModel: Fail to load model's material " << i << endl;
 			system("pause");
 			
 		}
@@ -1183,26 +2386,162 @@ void LoadTexturedModels(string model_path)
 		allMaterial.push_back(material);
 	}
 	
-	for (int i = 0; i < shapes.size(); i++)
+	for (int i = 0; i < prepared.view.shapes.size(); i++)
 	{
-		vertices.clear();
-		colors.clear();
-		normals.clear();
-		textureCoords.clear();
-		material_id.clear();
+		const vector<float>* layers = i < prepared.layers.size() ? &prepared.layers[i] : NULL;
+		dst.shapes.push_back(UploadShape(prepared.view.shapes[i], allMaterial[prepared.view.shapes[i].material_id], layers));
+	}
+}
 
-		normalization(&attrib, vertices, colors, normals, textureCoords, material_id, &shapes[i]);
-		// printf("Vertices size: %d", vertices.size() / 3);
+// Lazy loading: the viewed model is loaded before the first frame, the rest
+// are prepared on a background thread in Z order, and the viewed model jumps
+// that queue. GL uploads stay on the render thread (ServiceModelLoader).
+enum ModelState
+{
+	ModelUnloaded = 0,
+	ModelQueued = 1,
+	ModelResident = 2,
+};
+bool lazy_loading = true; // false with --eager: load everything in setupRC
+vector<ModelState> model_state; // render thread only
+
+thread loader_thread;
+mutex loader_mutex;
+condition_variable loader_cv;
+// guarded by loader_mutex
+deque<int> load_requests;
+vector<pair<int, unique_ptr<PreparedModel>>> prepared_models; // null on failure
+bool loader_stop = false;
+
+void ModelLoaderThread()
+{
+	for (;;)
+	{
+		int idx;
+		{
+			unique_lock<mutex> lock(loader_mutex);
+			loader_cv.wait(lock, [] { return loader_stop || !load_requests.empty(); });
+			if (loader_stop)
+				return;
+			idx = load_requests.front();
+			load_requests.pop_front();
+		}
 
-		// split current shape into multiple shapes base on material_id.
-		vector<Shape> splitedShapeByMaterial = SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, allMaterial);
+		// one parse thread: the decode workers already take every core
+		unique_ptr<PreparedModel> prepared(new PreparedModel);
+		if (!PrepareModel(model_list[idx], *prepared, 1))
+			prepared.reset();
 
-		// concatenate splited shape to model's shape list
-		tmp_model.shapes.insert(tmp_model.shapes.end(), splitedShapeByMaterial.begin(), splitedShapeByMaterial.end());
+		lock_guard<mutex> lock(loader_mutex);
+		prepared_models.push_back(make_pair(idx, move(prepared)));
+	}
+}
+
+void StopModelLoader()
+{
+	{
+		lock_guard<mutex> lock(loader_mutex);
+		loader_stop = true;
 	}
-	shapes.clear();
-	materials.clear();
-	models.push_back(tmp_model);
+	loader_cv.notify_one();
+	if (loader_thread.joinable())
+		loader_thread.join();
+}
+
+// Load model idx entirely on the render thread
+void LoadTexturedModel(int idx)
+{
+	PreparedModel prepared;
+	if (!PrepareModel(model_list[idx], prepared)) {
+		exit(1);
+	}
+	UploadPreparedModel(model_list[idx], prepared, models[idx]);
+	model_state[idx] = ModelResident;
+}
+
+void StartModelLoader()
+{
+	LoadTexturedModel(cur_idx);
+
+	{
+		lock_guard<mutex> lock(loader_mutex);
+		for (int i = 1; i < model_list.size(); i++)
+		{
+			int idx = (cur_idx + i) % model_list.size();
+			load_requests.push_back(idx);
+			model_state[idx] = ModelQueued;
+		}
+	}
+	loader_thread = thread(ModelLoaderThread);
+	loader_cv.notify_one();
+	// ESC leaves through exit(), so join from an exit handler
+	atexit(StopModelLoader);
+}
+
+// Called once per loop iteration: move the viewed model to the front of the
+// queue and upload every model the loader has finished. True while models
+// are still queued.
+bool ServiceModelLoader()
+{
+	if (!lazy_loading)
+		return false;
+
+	vector<pair<int, unique_ptr<PreparedModel>>> ready;
+	{
+		lock_guard<mutex> lock(loader_mutex);
+		if (model_state[cur_idx] == ModelQueued)
+		{
+			deque<int>::iterator it = find(load_requests.begin(), load_requests.end(), cur_idx);
+			if (it != load_requests.end())
+			{
+				load_requests.erase(it);
+				load_requests.push_front(cur_idx);
+			}
+		}
+		ready.swap(prepared_models);
+	}
+
+	for (int i = 0; i < ready.size(); i++)
+	{
+		int idx = ready[i].first;
+		if (!ready[i].second) {
+			exit(1);
+		}
+		UploadPreparedModel(model_list[idx], *ready[i].second, models[idx]);
+		model_state[idx] = ModelResident;
+		if (idx == cur_idx)
+			scene_dirty = true;
+	}
+
+	bool queued = count(model_state.begin(), model_state.end(), ModelResident) != model_state.size();
+	if (!ready.empty() && !queued)
+		PrintTextureCacheStats();
+	return queued;
+}
+
+// ServiceTextureUploads swapped in a texture or finer levels of one: points
+// every material of the loaded models that uses handle at tex
+static void TextureArrived(int handle, GLuint tex)
+{
+	for (int m = 0; m < models.size(); m++)
+	{
+		for (int s = 0; s < models[m].shapes.size(); s++)
+		{
+			if (models[m].shapes[s].material.textureHandle == handle)
+				models[m].shapes[s].material.diffuseTexture = tex;
+		}
+	}
+	scene_dirty = true;
+}
+
+// The texture handles the viewed model draws, for UpdateTextureResidency
+static const vector<int>& DrawnTextures()
+{
+	static vector<int> drawn;
+	drawn.clear();
+	for (int s = 0; s < models[cur_idx].shapes.size(); s++)
+		drawn.push_back(models[cur_idx].shapes[s].material.textureHandle);
+	return drawn;
 }
 
 void initParameter()
@@ -1258,6 +2597,7 @@ void setUniformVariables()
 	//iLocM = glGetUniformLocation(program, "um4m");
 
 	iLocVertex_or_perpixel = glGetUniformLocation(program, "vertex_or_perpixel");
+	iLocSplitPath = glGetUniformLocation(program, "split_path");
 
 	iLocP = glGetUniformLocation(program, "project_matrix");
 	iLocV = glGetUniformLocation(program, "view_matrix");
@@ -1268,60 +2608,222 @@ void setUniformVariables()
 
 	iLocLightIdx = glGetUniformLocation(program, "lightIdx");
 
-	iLocKa = glGetUniformLocation(program, "material.Ka");
-	iLocKd = glGetUniformLocation(program, "material.Kd");
-	iLocKs = glGetUniformLocation(program, "material.Ks");
-	iLocShininess = glGetUniformLocation(program, "material.shininess");
-
-	iLocLightInfo[0].position = glGetUniformLocation(program, "light[0].position");
-	iLocLightInfo[0].ambient = glGetUniformLocation(program, "light[0].La");
-	iLocLightInfo[0].diffuse = glGetUniformLocation(program, "light[0].Ld");
-	iLocLightInfo[0].specular = glGetUniformLocation(program, "light[0].Ls");
-	iLocLightInfo[0].spotDirection = glGetUniformLocation(program, "light[0].spotDirection");
-	iLocLightInfo[0].spotCutoff = glGetUniformLocation(program, "light[0].spotCutoff");
-	iLocLightInfo[0].spotExponent = glGetUniformLocation(program, "light[0].spotExponent");
-	iLocLightInfo[0].constantAttenuation = glGetUniformLocation(program, "light[0].constantAttenuation");
-	iLocLightInfo[0].linearAttenuation = glGetUniformLocation(program, "light[0].linearAttenuation");
-	iLocLightInfo[0].quadraticAttenuation = glGetUniformLocation(program, "light[0].quadraticAttenuation");
-
-	iLocLightInfo[1].position = glGetUniformLocation(program, "light[1].position");
-	iLocLightInfo[1].ambient = glGetUniformLocation(program, "light[1].La");
-	iLocLightInfo[1].diffuse = glGetUniformLocation(program, "light[1].Ld");
-	iLocLightInfo[1].specular = glGetUniformLocation(program, "light[1].Ls");
-	iLocLightInfo[1].spotDirection = glGetUniformLocation(program, "light[1].spotDirection");
-	iLocLightInfo[1].spotCutoff = glGetUniformLocation(program, "light[1].spotCutoff");
-	iLocLightInfo[1].spotExponent = glGetUniformLocation(program, "light[1].spotExponent");
-	iLocLightInfo[1].constantAttenuation = glGetUniformLocation(program, "light[1].constantAttenuation");
-	iLocLightInfo[1].linearAttenuation = glGetUniformLocation(program, "light[1].linearAttenuation");
-	iLocLightInfo[1].quadraticAttenuation = glGetUniformLocation(program, "light[1].quadraticAttenuation");
-
-	iLocLightInfo[2].position = glGetUniformLocation(program, "light[2].position");
-	iLocLightInfo[2].ambient = glGetUniformLocation(program, "light[2].La");
-	iLocLightInfo[2].diffuse = glGetUniformLocation(program, "light[2].Ld");
-	iLocLightInfo[2].specular = glGetUniformLocation(program, "light[2].Ls");
-	iLocLightInfo[2].spotDirection = glGetUniformLocation(program, "light[2].spotDirection");
-	iLocLightInfo[2].spotCutoff = glGetUniformLocation(program, "light[2].spotCutoff");
-	iLocLightInfo[2].spotExponent = glGetUniformLocation(program, "light[2].spotExponent");
-	iLocLightInfo[2].constantAttenuation = glGetUniformLocation(program, "light[2].constantAttenuation");
-	iLocLightInfo[2].linearAttenuation = glGetUniformLocation(program, "light[2].linearAttenuation");
-	iLocLightInfo[2].quadraticAttenuation = glGetUniformLocation(program, "light[2].quadraticAttenuation");
+	// the blocks read whatever is bound at these points
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Lights"), kLightsBinding);
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Material"), kMaterialBinding);
 
 	// [TODO] Get uniform location of texture
 	iLocTex = glGetUniformLocation(program, "tex");
+	iLocFlipTexV = glGetUniformLocation(program, "flipTexV");
+	iLocUseTexArray = glGetUniformLocation(program, "useTexArray");
+	iLocIsEye = glGetUniformLocation(program, "iseye");
+	iLocEyeOffset = glGetUniformLocation(program, "offset");
+	// tex stays on unit 0; the two sampler types cannot share a unit
+	glUniform1i(glGetUniformLocation(program, "texArray"), 1);
+	// the uber shader's, the variants have it built in
+	glUniform1i(iLocSplitPath, split_path);
+}
+
+// The location globals setUniformVariables fills in, which every variant
+// keeps a copy of so that switching programs takes no lookups
+GLint* const program_locations[] = { &iLocP, &iLocV, &iLocModelMatrix, &iLocMV, &uniform.iLocMVP, &iLocNormTrans, &iLocLightIdx, &iLocVertex_or_perpixel, &iLocSplitPath,
+	&iLocTex, &iLocFlipTexV, &iLocUseTexArray, &iLocIsEye, &iLocEyeOffset };
+const int kProgramLocations = sizeof(program_locations) / sizeof(program_locations[0]);
+
+struct ShaderVariant
+{
+	GLuint program = 0; // built the first time it is drawn with
+	GLint locations[kProgramLocations];
+	UniformsSent sent = {};
+};
+ShaderVariant shader_variants[3][3][3]; // by light_idx, ShadingVariant and TextureVariant
+ShaderVariant uber_shader;
+
+// The names a variant defines, none for the uber shader
+static string ShaderVariantNames(int light, ShadingVariant shading, TextureVariant texturing)
+{
+	if (use_uber_shader)
+		return "";
+	const char* lights[] = { "LIGHT_DIRECTIONAL", "LIGHT_POINT", "LIGHT_SPOT" };
+	const char* shadings[] = { " SHADING_GOURAUD", " SHADING_PHONG", "" };
+	const char* splits[] = { " SPLIT_TWO_PASS", " SPLIT_CLIP_PLANES", " SPLIT_VIEWPORT_INDEX" };
+	const char* texturings[] = { " UNTEXTURED", " TEXTURED", " TEXTURED TEXTURE_ARRAY" };
+	return string(lights[light]) + shadings[shading] + splits[split_path] + texturings[texturing];
+}
+
+// Builds and binds a variant, then prints its size. GL reports no
+// instruction counts; the active uniforms and, from GL 4.1, the length of
+// the program binary are what shrinks as branches fold away.
+static void BuildVariant(ShaderVariant& variant, int light, ShadingVariant shading, TextureVariant texturing)
+{
+	string names = ShaderVariantNames(light, shading, texturing);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	GLuint p = BuildShaderVariant(vs_source.data(), vs_source.size(), fs_source.data(), fs_source.size(), names);
+	if (p == 0)
+	{
+		system("pause");
+		exit(123);
+	}
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	glUseProgram(p);
+	program = p; // setUniformVariables looks up its uniforms
+	setUniformVariables();
+	variant.program = p;
+	for (int i = 0; i < kProgramLocations; i++)
+		variant.locations[i] = *program_locations[i];
+
+	GLint uniforms = 0, binary_length = 0;
+	glGetProgramiv(p, GL_ACTIVE_UNIFORMS, &uniforms);
+	if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1))
+		glGetProgramiv(p, GL_PROGRAM_BINARY_LENGTH, &binary_length);
+	printf("Shader %s: built in %.1f ms, %d active uniforms", names.empty() ? "uber" : names.c_str(), ms, uniforms);
+	if (binary_length > 0)
+		printf(", %d byte program binary", binary_length);
+	printf("\n");
+}
+
+// Binds the program drawing light with shading and texturing, building it
+// on first use, and points the location globals at its uniforms
+void UseShaderVariant(int light, ShadingVariant shading, TextureVariant texturing)
+{
+	ShaderVariant& variant = use_uber_shader ? uber_shader : shader_variants[light][shading][texturing];
+	if (variant.program == 0)
+	{
+		BuildVariant(variant, light, shading, texturing);
+	}
+	else if (variant.program != program)
+	{
+		glUseProgram(variant.program);
+		for (int i = 0; i < kProgramLocations; i++)
+			*program_locations[i] = variant.locations[i];
+	}
+	program = variant.program;
+	uniforms_sent = &variant.sent;
+}
+
+static bool HasExtension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Which DDS formats the context samples natively, the rest are decoded on
+// the workers
+void DetectCompressedFormats()
+{
+	bool s3tc = HasExtension("GL_EXT_texture_compression_s3tc");
+	bool bptc = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 2) || HasExtension("GL_ARB_texture_compression_bptc");
+	dds_format_supported[DDS_BC1] = s3tc && !force_dds_decode;
+	dds_format_supported[DDS_BC3] = s3tc && !force_dds_decode;
+	dds_format_supported[DDS_BC5] = !force_dds_decode; // RGTC is core since 3.0
+	dds_format_supported[DDS_BC7] = bptc && !force_dds_decode;
+
+	cout << "Compressed textures:";
+	for (int f = DDS_BC1; f <= DDS_BC7; f++)
+		cout << " " << DdsFormatName((DdsFormat)f) << (dds_format_supported[f] ? "" : " (decoded)");
+	cout << endl;
+}
+
+// The vertex shader's gl_ViewportIndex as the shaders reach it: under
+// #version 330, through one of the extensions they enable, written only if
+// its macro is defined. A driver may list an extension its compiler does
+// not take at this version, and the shaders would then draw both views
+// into viewport 0, so this fails to compile instead. It does not replace
+// the extension string: a compiler may also take one the driver leaves out.
+static const GLchar* kViewportIndexProbe =
+	"#version 330\n"
+	"#extension GL_ARB_shader_viewport_layer_array : enable\n"
+	"#extension GL_AMD_vertex_shader_viewport_index : enable\n"
+	"void main()\n"
+	"{\n"
+	"	gl_Position = vec4(0.0);\n"
+	"#if defined(GL_ARB_shader_viewport_layer_array) || defined(GL_AMD_vertex_shader_viewport_index)\n"
+	"	gl_ViewportIndex = gl_InstanceID;\n"
+	"#else\n"
+	"#error no gl_ViewportIndex in the vertex shader\n"
+	"#endif\n"
+	"}\n";
+
+static bool CompilesViewportIndex()
+{
+	GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(shader, 1, &kViewportIndexProbe, NULL);
+	glCompileShader(shader);
+	GLint success;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	glDeleteShader(shader);
+	return success == GL_TRUE;
+}
+
+// The viewport array path needs gl_ViewportIndex in the vertex shader as
+// well as glViewportIndexedf; the clip plane path only core 3.3
+void DetectSplitViewPath()
+{
+	bool viewport_array = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1) || HasExtension("GL_ARB_viewport_array");
+	bool vertex_index = HasExtension("GL_ARB_shader_viewport_layer_array") || HasExtension("GL_AMD_vertex_shader_viewport_index");
+	// glad loads it only with GL 4.1, not from the extension
+	if (viewport_array && glad_glViewportIndexedf == NULL)
+		glad_glViewportIndexedf = (PFNGLVIEWPORTINDEXEDFPROC)glfwGetProcAddress("glViewportIndexedf");
+
+	if (force_two_pass)
+		split_path = SplitTwoPass;
+	else if (viewport_array && vertex_index && glad_glViewportIndexedf != NULL && CompilesViewportIndex())
+		split_path = SplitViewportIndex;
+	else
+		split_path = SplitClipPlanes;
+	if (split_path == SplitClipPlanes)
+		glEnable(GL_CLIP_DISTANCE0);
+
+	const char* names[] = { "two passes", "one pass, clip planes", "one pass, viewport array" };
+	cout << "Side by side views: " << names[split_path] << endl;
 }
 
 void setupRC()
 {
-	// setup shaders
+	// setup shaders, built for the split path
+	DetectSplitViewPath();
 	setShaders();
 	initParameter();
-	setUniformVariables();
+	CreateUniformBuffers();
 
 	// OpenGL States and Values
 	glClearColor(0.2, 0.2, 0.2, 1.0);
 
-	for (string model_path : model_list){
-		LoadTexturedModels(model_path);
+	// set once here instead of per image, stb_image keeps it in a global
+	stbi_set_flip_vertically_on_load(true);
+
+	// White, so a material shows its plain color until its texture is resident
+	const unsigned char white[4] = { 255, 255, 255, 255 };
+	glGenTextures(1, &placeholder_texture);
+	BindTexture2D(0, placeholder_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+
+	CreateTextureSamplers();
+	DetectCompressedFormats();
+	StartTextureDecoders();
+	// registered before the model loader's handler, so it runs after it
+	atexit(StopTextureDecoders);
+
+	models.resize(model_list.size());
+	model_state.assign(model_list.size(), ModelUnloaded);
+	if (lazy_loading)
+	{
+		StartModelLoader();
+	}
+	else
+	{
+		for (int i = 0; i < model_list.size(); i++)
+		{
+			LoadTexturedModel(i);
+		}
+		PrintTextureCacheStats();
 	}
 }
 
@@ -1346,6 +2848,122 @@ void glPrintContextInfo(bool printExtension)
 
 int main(int argc, char **argv)
 {
+	chrono::steady_clock::time_point app_start = chrono::steady_clock::now();
+
+	if (argc > 1 && string(argv[1]) == "--bench-parse")
+	{
+		BenchmarkObjParse();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-cache")
+	{
+		BenchmarkMeshCache();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-vcache")
+	{
+		BenchmarkVertexCache();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-split")
+	{
+		BenchmarkSplit();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-textures")
+	{
+		BenchmarkTextureCache();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-mipmaps")
+	{
+		BenchmarkMipmaps();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-batching")
+	{
+		BenchmarkBatching();
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-residency")
+	{
+		BenchmarkResidency(argc > 2 ? atof(argv[2]) : 16.0);
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--cook-textures")
+	{
+		DdsFormat format = DDS_BC7;
+		MipFilter filter = MIP_FILTER_BOX;
+		bool force = false;
+		unsigned int threads = 0;
+		for (int i = 2; i < argc; i++)
+		{
+			if (string(argv[i]) == "bc1")
+				format = DDS_BC1;
+			else if (string(argv[i]) == "bc7")
+				format = DDS_BC7;
+			else if (string(argv[i]) == "box")
+				filter = MIP_FILTER_BOX;
+			else if (string(argv[i]) == "kaiser")
+				filter = MIP_FILTER_KAISER;
+			else if (string(argv[i]) == "--force")
+				force = true;
+			else if (string(argv[i]) == "--threads" && i + 1 < argc)
+				threads = (unsigned int)atoi(argv[++i]);
+		}
+		CookTextures(format, filter, force, threads);
+		return 0;
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-ingest")
+	{
+		BenchmarkIngest(argc > 2 ? argv[2] : "");
+		return 0;
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		if (string(argv[i]) == "--eager")
+			lazy_loading = false;
+		else if (string(argv[i]) == "--no-streaming")
+			streaming_ingest = false;
+		else if (string(argv[i]) == "--io-stats")
+		{
+			EnableFileIoStats();
+			atexit(PrintFileIoStats);
+		}
+		else if (string(argv[i]) == "--continuous")
+			render_on_demand = false;
+		else if (string(argv[i]) == "--two-pass")
+			force_two_pass = true;
+		else if (string(argv[i]) == "--uber-shader")
+			use_uber_shader = true;
+		else if (string(argv[i]) == "--loop-stats")
+			atexit(PrintRenderLoopStats);
+		else if (string(argv[i]) == "--geometry-stats")
+			geometry_stats = true;
+		else if (string(argv[i]) == "--decode-threads" && i + 1 < argc)
+			decode_threads = (unsigned int)atoi(argv[++i]);
+		else if (string(argv[i]) == "--no-dds")
+			prefer_dds_textures = false;
+		else if (string(argv[i]) == "--decode-dds")
+			force_dds_decode = true;
+		else if (string(argv[i]) == "--no-samplers")
+		{
+			use_samplers = false;
+			texture_state.enabled = false;
+		}
+		else if (string(argv[i]) == "--no-atlas")
+			texture_atlases = false;
+		else if (string(argv[i]) == "--texture-arrays")
+			texture_arrays = true;
+		else if (string(argv[i]) == "--texture-budget" && i + 1 < argc)
+			texture_budget = (size_t)(atof(argv[++i]) * 1024 * 1024);
+		else if (string(argv[i]) == "--mipmaps" && i + 1 < argc)
+		{
+			string mode = argv[++i];
+			cpu_mipmaps = mode != "gl";
+			mipmap_filter = mode == "kaiser" ? MIP_FILTER_KAISER : MIP_FILTER_BOX;
+		}
+	}
 
     // initial glfw
     glfwInit();
@@ -1385,27 +3003,55 @@ int main(int argc, char **argv)
 	glfwSetCursorPosCallback(window, cursor_pos_callback);
 
     glfwSetFramebufferSizeCallback(window, ChangeSize);
+	glfwSetWindowRefreshCallback(window, WindowRefresh);
 	glEnable(GL_DEPTH_TEST);
 	// Setup render context
 	setupRC();
 
+	bool first_frame = true;
+
 	// main loop
+	loop_start = chrono::steady_clock::now();
     while (!glfwWindowShouldClose(window))
     {
-        // render
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-		// render left view
-		glViewport(0, 0, screenWidth / 2, screenHeight);
-        RenderScene(1);
-		// render right view
-		glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
-		RenderScene(0);
-        
-        // swap buffer from back to front
-        glfwSwapBuffers(window);
-        
-        // Poll input event
-        glfwPollEvents();
+		chrono::steady_clock::time_point wake = chrono::steady_clock::now();
+		loop_wakeups++;
+		bool models_queued = ServiceModelLoader();
+		bool textures_in_flight = ServiceTextureUploads(TextureArrived);
+
+		if (scene_dirty || !render_on_demand)
+		{
+			scene_dirty = false;
+			UpdateTextureResidency(DrawnTextures());
+
+			// render
+			chrono::steady_clock::time_point submit_start = chrono::steady_clock::now();
+			uniform_calls = 0;
+			draw_calls = 0;
+			UploadLights();
+			// both views, RenderScene splits the window
+			RenderScene();
+			ReportFrameSubmit((int)models[cur_idx].shapes.size(), chrono::duration<double, milli>(chrono::steady_clock::now() - submit_start).count());
+
+			// swap buffer from back to front
+			glfwSwapBuffers(window);
+			loop_frames++;
+
+			if (first_frame && model_state[cur_idx] == ModelResident)
+			{
+				first_frame = false;
+				printf("Time to first frame: %.1f ms (%s loading)\n", chrono::duration<double, milli>(chrono::steady_clock::now() - app_start).count(), lazy_loading ? "lazy" : "eager");
+			}
+		}
+		loop_busy_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - wake).count();
+
+		// Poll input event, or sleep until there is some; loads in flight
+		// need servicing sooner, uploads finish behind GPU fences that
+		// post no event
+		if (!render_on_demand)
+			glfwPollEvents();
+		else
+			glfwWaitEventsTimeout(models_queued || textures_in_flight ? kBusyWait : kIdleWait);
     }
 	
 	// just for compatibiliy purposes
@@ -0,0 +1,96 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "textfile.h"
+
+// Binary cache of the final, normalized per-shape vertex streams of a model.
+// It is written next to the source .obj on the first load and memory mapped
+// on later loads, so the streams go from disk to glBufferData unparsed.
+//
+// A cache is reused only if its version and tag match and the source .obj,
+// as well as every material library it names with mtllib, still has the
+// recorded size and mtime. When only the mtime differs the content hash
+// decides, so a touched but unchanged file keeps its cache. A library that
+// was missing when the cache was written invalidates it once it appears.
+//
+// Writers go through a temporary file of their own, so several instances
+// may fill the same cache at once; the last rename wins.
+
+#define MESHCACHE_VERSION 3
+
+enum MeshCacheStream
+{
+	MESHCACHE_POSITION = 0,	// 3 floats per vertex
+	MESHCACHE_COLOR = 1,	// 3 floats per vertex
+	MESHCACHE_NORMAL = 2,	// 3 floats per vertex
+	MESHCACHE_TEXCOORD = 3,	// 2 floats per vertex
+	MESHCACHE_STREAM_COUNT = 4,
+};
+
+struct MeshCacheMaterial
+{
+	std::string name;
+	float ambient[3];
+	float diffuse[3];
+	float specular[3];
+	float shininess;
+	std::string diffuse_texname;
+};
+
+struct MeshCacheShape
+{
+	std::string name;
+	int material_id;	// index into MeshCacheData::materials, -1 for none
+	std::vector<float> streams[MESHCACHE_STREAM_COUNT];
+	// Optional index buffer into the streams, at most one of them is filled
+	std::vector<uint16_t> indices16;
+	std::vector<uint32_t> indices32;
+};
+
+// What an app builds from the text path on a cache miss
+struct MeshCacheData
+{
+	std::vector<MeshCacheShape> shapes;
+	std::vector<MeshCacheMaterial> materials;
+};
+
+struct MeshCacheShapeView
+{
+	const char* name;
+	int material_id;
+	const float* streams[MESHCACHE_STREAM_COUNT];
+	uint32_t stream_sizes[MESHCACHE_STREAM_COUNT];	// in floats
+	const void* indices;
+	uint32_t index_count;
+	uint32_t index_size;	// 2 or 4 bytes, 0 for a non-indexed shape
+};
+
+// Read-only view on either a mapped cache file or a MeshCacheData
+struct MeshCacheView
+{
+	float aabb_min[3];
+	float aabb_max[3];
+	std::vector<MeshCacheShapeView> shapes;
+	std::vector<MeshCacheMaterial> materials;
+};
+
+// "<source_path>.<tag>.meshcache"; the tag names the app and its pipeline
+// version, since the same .obj yields different streams in each app.
+std::string MeshCachePath(const std::string& source_path, const char* tag);
+
+// Maps cache_path into file and fills view if the cache is valid for
+// source_path. view points into file, so file must outlive it.
+bool ReadMeshCache(const std::string& cache_path, const std::string& source_path, const char* tag, MappedFile* file, MeshCacheView* view);
+
+bool WriteMeshCache(const std::string& cache_path, const std::string& source_path, const char* tag, const MeshCacheData& data);
+
+void MakeMeshCacheView(const MeshCacheData& data, MeshCacheView* view);
+
+// Bitwise comparison of streams, indices, materials and AABB
+bool SameMeshCacheView(const MeshCacheView& a, const MeshCacheView& b);
+
+#endif
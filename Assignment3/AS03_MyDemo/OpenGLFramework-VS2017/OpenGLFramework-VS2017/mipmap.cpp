@@ -0,0 +1,322 @@
+#include "mipmap.h"
+
+#include <math.h>
+#include <string.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#define USE_AVX
+#endif
+#if defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define USE_SSE
+#endif
+
+static const double kPi = 3.14159265358979323846;
+static const double kKaiserRadius = 2.0;	// in texels of the smaller level
+static const double kKaiserAlpha = 4.0;
+
+static float SrgbToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LinearToSrgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// sRGB byte -> linear float, and linear float in 1/65535 steps -> sRGB
+// byte; the smallest sRGB step is 20 of those
+struct SrgbTables
+{
+	float to_linear[256];
+	unsigned char to_srgb[65536];
+
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; i++)
+			to_linear[i] = SrgbToLinear(i / 255.0f);
+		for (int i = 0; i < 65536; i++)
+			to_srgb[i] = (unsigned char)(LinearToSrgb(i / 65535.0f) * 255.0f + 0.5f);
+	}
+};
+
+static const SrgbTables& Tables()
+{
+	static const SrgbTables tables;
+	return tables;
+}
+
+int MipLevelCount(int width, int height)
+{
+	int levels = 1;
+	while (width > 1 || height > 1)
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		levels++;
+	}
+	return levels;
+}
+
+size_t MipChainBytes(int width, int height)
+{
+	size_t bytes = (size_t)width * height * 4;
+	while (width > 1 || height > 1)
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		bytes += (size_t)width * height * 4;
+	}
+	return bytes;
+}
+
+const char* MipFilterName(MipFilter filter)
+{
+	return filter == MIP_FILTER_KAISER ? "kaiser" : "box";
+}
+
+const char* MipSimdName()
+{
+#if defined(USE_AVX)
+	return "AVX";
+#elif defined(USE_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+// Weights of one axis: destination texel i reads count[i] source texels
+// index[first[i] ..] with weight[first[i] ..], which sum to 1
+struct AxisTaps
+{
+	std::vector<int> first;
+	std::vector<int> count;
+	std::vector<int> index;
+	std::vector<float> weight;
+};
+
+static double BesselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static double Kaiser(double t)
+{
+	if (fabs(t) >= kKaiserRadius)
+		return 0.0;
+	double sinc = t == 0.0 ? 1.0 : sin(kPi * t) / (kPi * t);
+	double r = t / kKaiserRadius;
+	return sinc * BesselI0(kKaiserAlpha * sqrt(1.0 - r * r)) / BesselI0(kKaiserAlpha);
+}
+
+static void BuildTaps(int src_size, int dst_size, MipFilter filter, AxisTaps& taps)
+{
+	taps.first.resize(dst_size);
+	taps.count.resize(dst_size);
+	taps.index.clear();
+	taps.weight.clear();
+	double scale = (double)src_size / dst_size;
+	for (int i = 0; i < dst_size; i++)
+	{
+		taps.first[i] = (int)taps.index.size();
+		double sum = 0.0;
+		if (filter == MIP_FILTER_BOX || src_size == dst_size)
+		{
+			// how much of source texel s lies in [i, i + 1) * scale
+			double begin = i * scale, end = (i + 1) * scale;
+			for (int s = (int)begin; s < src_size && s < end; s++)
+			{
+				double w = (s + 1 < end ? s + 1 : end) - (s > begin ? s : begin);
+				taps.index.push_back(s);
+				taps.weight.push_back((float)w);
+				sum += w;
+			}
+		}
+		else
+		{
+			// source texel centers around this texel's center, in units of
+			// the destination texel
+			double center = (i + 0.5) * scale;
+			int begin = (int)floor(center - kKaiserRadius * scale);
+			int end = (int)ceil(center + kKaiserRadius * scale);
+			for (int s = begin; s <= end; s++)
+			{
+				double w = Kaiser((s + 0.5 - center) / scale);
+				if (w == 0.0)
+					continue;
+				taps.index.push_back(s < 0 ? 0 : s >= src_size ? src_size - 1 : s);
+				taps.weight.push_back((float)w);
+				sum += w;
+			}
+		}
+		taps.count[i] = (int)taps.index.size() - taps.first[i];
+		for (int k = taps.first[i]; k < (int)taps.weight.size(); k++)
+			taps.weight[k] = (float)(taps.weight[k] / sum);
+	}
+}
+
+// Along x: dst (dst_width x height) from src (src_width x height), 4 floats
+// per pixel
+static void FilterRows(const float* src, int src_width, float* dst, int dst_width, int height, const AxisTaps& taps, bool simd)
+{
+	for (int y = 0; y < height; y++)
+	{
+		const float* row = src + (size_t)y * src_width * 4;
+		float* out = dst + (size_t)y * dst_width * 4;
+		for (int x = 0; x < dst_width; x++, out += 4)
+		{
+			const int* index = &taps.index[taps.first[x]];
+			const float* weight = &taps.weight[taps.first[x]];
+			int count = taps.count[x];
+#ifdef USE_SSE
+			if (simd)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (int k = 0; k < count; k++)
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weight[k]), _mm_loadu_ps(row + index[k] * 4)));
+				_mm_storeu_ps(out, sum);
+				continue;
+			}
+#endif
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int k = 0; k < count; k++)
+			{
+				const float* p = row + index[k] * 4;
+				for (int c = 0; c < 4; c++)
+					sum[c] += weight[k] * p[c];
+			}
+			memcpy(out, sum, sizeof(sum));
+		}
+	}
+}
+
+// Along y: each output row is a weighted sum of whole input rows of
+// floats floats
+static void FilterColumns(const float* src, float* dst, int floats, int dst_height, const AxisTaps& taps, bool simd)
+{
+	for (int y = 0; y < dst_height; y++)
+	{
+		const int* index = &taps.index[taps.first[y]];
+		const float* weight = &taps.weight[taps.first[y]];
+		int count = taps.count[y];
+		float* out = dst + (size_t)y * floats;
+		int i = 0;
+#ifdef USE_AVX
+		if (simd)
+		{
+			for (; i + 8 <= floats; i += 8)
+			{
+				__m256 sum = _mm256_setzero_ps();
+				for (int k = 0; k < count; k++)
+					sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weight[k]), _mm256_loadu_ps(src + (size_t)index[k] * floats + i)));
+				_mm256_storeu_ps(out + i, sum);
+			}
+		}
+#endif
+#ifdef USE_SSE
+		if (simd)
+		{
+			for (; i + 4 <= floats; i += 4)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (int k = 0; k < count; k++)
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weight[k]), _mm_loadu_ps(src + (size_t)index[k] * floats + i)));
+				_mm_storeu_ps(out + i, sum);
+			}
+		}
+#endif
+		for (; i < floats; i++)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k < count; k++)
+				sum += weight[k] * src[(size_t)index[k] * floats + i];
+			out[i] = sum;
+		}
+	}
+}
+
+static void ToLinear(const unsigned char* pixels, size_t count, float* linear)
+{
+	const float* to_linear = Tables().to_linear;
+	for (size_t i = 0; i < count; i++, pixels += 4, linear += 4)
+	{
+		linear[0] = to_linear[pixels[0]];
+		linear[1] = to_linear[pixels[1]];
+		linear[2] = to_linear[pixels[2]];
+		linear[3] = pixels[3] / 255.0f;
+	}
+}
+
+static int Quantize(float c, float scale)
+{
+	int v = (int)(c * scale + 0.5f);
+	return v < 0 ? 0 : v > (int)scale ? (int)scale : v;
+}
+
+static void ToSrgb(const float* linear, size_t count, unsigned char* pixels)
+{
+	const unsigned char* to_srgb = Tables().to_srgb;
+	for (size_t i = 0; i < count; i++, pixels += 4, linear += 4)
+	{
+		pixels[0] = to_srgb[Quantize(linear[0], 65535.0f)];
+		pixels[1] = to_srgb[Quantize(linear[1], 65535.0f)];
+		pixels[2] = to_srgb[Quantize(linear[2], 65535.0f)];
+		pixels[3] = (unsigned char)Quantize(linear[3], 255.0f);
+	}
+}
+
+void GenerateMipChain(unsigned char* chain, int width, int height, MipFilter filter, bool simd)
+{
+	std::vector<float> level((size_t)width * height * 4), rows, next;
+	ToLinear(chain, (size_t)width * height, &level[0]);
+	unsigned char* out = chain + (size_t)width * height * 4;
+
+	AxisTaps taps_x, taps_y;
+	while (width > 1 || height > 1)
+	{
+		int dst_width = width > 1 ? width / 2 : 1;
+		int dst_height = height > 1 ? height / 2 : 1;
+		BuildTaps(width, dst_width, filter, taps_x);
+		BuildTaps(height, dst_height, filter, taps_y);
+
+		rows.resize((size_t)dst_width * height * 4);
+		next.resize((size_t)dst_width * dst_height * 4);
+		FilterRows(&level[0], width, &rows[0], dst_width, height, taps_x, simd);
+		FilterColumns(&rows[0], &next[0], dst_width * 4, dst_height, taps_y, simd);
+
+		ToSrgb(&next[0], (size_t)dst_width * dst_height, out);
+		out += (size_t)dst_width * dst_height * 4;
+		level.swap(next);
+		width = dst_width;
+		height = dst_height;
+	}
+}
+
+void BuildMipChain(const unsigned char* pixels, int width, int height, std::vector<MipLevel>& levels, MipFilter filter)
+{
+	std::vector<unsigned char> chain(MipChainBytes(width, height));
+	memcpy(&chain[0], pixels, (size_t)width * height * 4);
+	GenerateMipChain(&chain[0], width, height, filter);
+
+	levels.resize(MipLevelCount(width, height));
+	const unsigned char* p = &chain[0];
+	for (int i = 0; i < levels.size(); i++)
+	{
+		levels[i].width = width;
+		levels[i].height = height;
+		levels[i].pixels.assign(p, p + (size_t)width * height * 4);
+		p += (size_t)width * height * 4;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+}
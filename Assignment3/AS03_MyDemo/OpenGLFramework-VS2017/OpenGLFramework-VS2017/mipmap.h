@@ -0,0 +1,49 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <stddef.h>
+#include <vector>
+
+// RGBA8 mip chains built on the CPU, for textures whose mips are stored or
+// uploaded level by level rather than made by glGenerateMipmap.
+//
+// Every level halves each side, rounding down and never below 1, as GL
+// does. Each level is resampled from the one above in linear light: RGB is
+// decoded from sRGB into floats and alpha is taken as is. The float levels
+// feed the next level, so only the bytes written are rounded.
+//
+// The filters are separable, and their weights are computed per texel from
+// its exact footprint, so an odd side gets 3 tap boxes instead of dropping
+// a row. Pixels are clamped at the edges. The inner loops use SSE for a
+// pixel and AVX for 8 floats of a row when the compiler targets them.
+
+enum MipFilter
+{
+	MIP_FILTER_BOX = 0,		// area average of the footprint
+	MIP_FILTER_KAISER = 1,	// Kaiser windowed sinc, 4 texels of the next level wide; sharper
+};
+
+struct MipLevel
+{
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;	// RGBA8, width * height * 4
+};
+
+// Levels down to 1x1 and the bytes of all of them as RGBA8
+int MipLevelCount(int width, int height);
+size_t MipChainBytes(int width, int height);
+
+// chain starts with level 0 and has room for MipChainBytes; writes every
+// other level right after the one above it. simd = false forces the scalar
+// loops, for comparison.
+void GenerateMipChain(unsigned char* chain, int width, int height, MipFilter filter, bool simd = true);
+
+// The same chain as separate levels, levels[0] a copy of pixels
+void BuildMipChain(const unsigned char* pixels, int width, int height, std::vector<MipLevel>& levels, MipFilter filter = MIP_FILTER_BOX);
+
+const char* MipFilterName(MipFilter filter);
+// "AVX", "SSE" or "scalar": what simd = true runs
+const char* MipSimdName();
+
+#endif
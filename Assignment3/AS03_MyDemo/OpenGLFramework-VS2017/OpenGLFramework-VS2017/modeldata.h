@@ -0,0 +1,56 @@
+#ifndef MODELDATA_H
+#define MODELDATA_H
+
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+#include "textfile.h"
+#include "meshcache.h"
+#include "tiny_obj_loader.h"
+
+// The CPU side of loading a model, defined in main.cpp: the text path from
+// an .obj to the streams a mesh cache holds, and PrepareModel on top of it,
+// which goes through the mesh cache and acquires the textures. The
+// benchmarks drive these directly.
+
+extern std::vector<std::string> model_list;
+extern const char* MESH_CACHE_TAG;
+extern bool texture_atlases; // false with --no-atlas
+extern bool texture_arrays; // --texture-arrays
+
+// Post-transform cache size assumed by OptimizeTriangleOrder and the reports
+const int VERTEX_CACHE_SIZE = 32;
+
+// Everything a model needs before its GL upload: the mesh streams (mapped
+// cache or freshly built) and a texture cache handle per material
+struct PreparedModel
+{
+	MappedFile cache_file;
+	MeshCacheData data;
+	MeshCacheView view;
+	std::vector<int> textures;
+	std::vector<std::vector<float> > layers; // by shape, the array layer of each vertex; empty if not layered
+};
+
+std::string GetBaseDir(const std::string& filepath);
+
+void normalization(std::vector<tinyobj::real_t>& positions);
+void ExpandShapeCorners(const tinyobj::attrib_t* attrib, const tinyobj::shape_t* shape, std::vector<GLfloat>& vertices, std::vector<GLfloat>& colors, std::vector<GLfloat>& normals, std::vector<GLfloat>& textureCoords, std::vector<int>& material_id);
+std::vector<MeshCacheShape> SplitShapeByMaterial(std::vector<GLfloat>& vertices, std::vector<GLfloat>& colors, std::vector<GLfloat>& normals, std::vector<GLfloat>& textureCoords, std::vector<int>& material_id, int material_count);
+
+// Shaded vertices of shape drawn through a FIFO cache of cache_size entries
+int SimulateVertexCache(const MeshCacheShapeView& shape, int cache_size);
+void OptimizeVertexCache(MeshCacheShape& shape);
+
+// parse_threads as LoadObjFile's num_threads; the streaming parse is serial
+bool BuildModelDataFromAttrib(const std::string& model_path, MeshCacheData& data, bool optimize_vertex_cache, unsigned int parse_threads = 0);
+bool BuildModelDataStreaming(const std::string& model_path, MeshCacheData& data, bool optimize_vertex_cache);
+// Whichever of the two --no-streaming selects
+bool BuildModelData(const std::string& model_path, MeshCacheData& data, bool optimize_vertex_cache = true, unsigned int parse_threads = 0);
+
+// CPU side of loading model_path: no GL calls, runs on the loader thread,
+// which passes 1 for parse_threads
+bool PrepareModel(const std::string& model_path, PreparedModel& prepared, unsigned int parse_threads = 0);
+
+#endif
@@ -0,0 +1,108 @@
+#include "objfile.h"
+
+#include <istream>
+#include <sstream>
+
+// Lets tinyobj's istream based parsers read a mapping without copying it
+class MemoryStreamBuf : public std::streambuf
+{
+public:
+	MemoryStreamBuf(const char* data, size_t size)
+	{
+		char* p = const_cast<char*>(data);
+		setg(p, p, p + size);
+	}
+};
+
+static bool LoadMtlFile(const std::string& path, std::vector<tinyobj::material_t>* materials,
+	std::map<std::string, int>* mat_map, std::string* warn, std::string* err)
+{
+	MappedFile file;
+	if (!file.Open(path))
+		return false;
+
+	MemoryStreamBuf buf(file.data(), file.size());
+	std::istream stream(&buf);
+	tinyobj::LoadMtl(mat_map, materials, &stream, warn, err);
+	return true;
+}
+
+bool MappedMaterialReader::operator()(const std::string& mat_id, std::vector<tinyobj::material_t>* materials,
+	std::map<std::string, int>* mat_map, std::string* warn, std::string* err)
+{
+	if (mtl_basedir_.empty())
+	{
+		if (LoadMtlFile(mat_id, materials, mat_map, warn, err))
+			return true;
+	}
+	else
+	{
+#ifdef _WIN32
+		const char sep = ';';
+#else
+		const char sep = ':';
+#endif
+		std::istringstream dirs(mtl_basedir_);
+		std::string dir;
+		while (getline(dirs, dir, sep))
+		{
+			std::string path = mat_id;
+			if (!dir.empty())
+			{
+				char last = dir[dir.length() - 1];
+				path = (last == '/' || last == '\\') ? dir + mat_id : dir + "/" + mat_id;
+			}
+			if (LoadMtlFile(path, materials, mat_map, warn, err))
+				return true;
+		}
+	}
+
+	if (warn)
+		*warn += "Material file [ " + mat_id + " ] not found in a path : " + mtl_basedir_ + "\n";
+	return false;
+}
+
+bool LoadObjFile(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+	std::string* warn, std::string* err, const std::string& path, const std::string& mtl_basedir, unsigned int num_threads)
+{
+	MappedFile file;
+	bool ok = file.Open(path, MappedFile::MAP_COPY_ON_WRITE);
+
+	// tinyobj overwrites each line end with the '\0' that terminates the line.
+	// An unterminated last line needs a '\0' after the file instead, which a
+	// mapping that fills its last page exactly does not have.
+	if (ok && !file.terminated())
+	{
+		char last = file.data()[file.size() - 1];
+		if (last != '\n' && last != '\r')
+			ok = file.Open(path, MappedFile::READ_BUFFERED);
+	}
+
+	if (!ok)
+	{
+		if (err)
+			*err = "Cannot open file [" + path + "]\n";
+		return false;
+	}
+
+	MappedMaterialReader material_reader(mtl_basedir);
+	return tinyobj::LoadObjParallel(attrib, shapes, materials, warn, err, file.writable_data(), file.size(),
+		&material_reader, true, true, num_threads);
+}
+
+bool LoadObjFileWithCallback(const std::string& path, const std::string& mtl_basedir, const tinyobj::callback_t& callback,
+	void* user_data, std::string* warn, std::string* err)
+{
+	MappedFile file;
+	if (!file.Open(path))
+	{
+		if (err)
+			*err = "Cannot open file [" + path + "]\n";
+		return false;
+	}
+
+	MemoryStreamBuf buf(file.data(), file.size());
+	std::istream stream(&buf);
+	MappedMaterialReader material_reader(mtl_basedir);
+	return tinyobj::LoadObjWithCallback(stream, callback, user_data, &material_reader, warn, err);
+}
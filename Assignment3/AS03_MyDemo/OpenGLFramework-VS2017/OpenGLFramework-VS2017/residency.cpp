@@ -0,0 +1,65 @@
+#include "residency.h"
+
+size_t ResidentBytes(const TextureResidency& texture, int first_level)
+{
+	size_t bytes = 0;
+	for (int i = first_level; i < texture.level_count; i++)
+		bytes += texture.level_bytes[i];
+	return bytes;
+}
+
+// The least recently used texture not drawn in frame that has levels above
+// its tail, the larger on a tie; -1 if there is none
+static int TrimCandidate(const std::vector<TextureResidency>& textures, int frame)
+{
+	int best = -1;
+	for (int i = 0; i < textures.size(); i++)
+	{
+		const TextureResidency& texture = textures[i];
+		if (texture.busy || texture.last_used == frame || texture.base_level >= texture.tail_level)
+			continue;
+		if (best < 0 || texture.last_used < textures[best].last_used ||
+			(texture.last_used == textures[best].last_used && ResidentBytes(texture, texture.base_level) > ResidentBytes(textures[best], textures[best].base_level)))
+			best = i;
+	}
+	return best;
+}
+
+void PlanResidency(std::vector<TextureResidency>& textures, size_t budget, int frame, std::vector<ResidencyChange>& changes)
+{
+	size_t committed = 0;
+	for (int i = 0; i < textures.size(); i++)
+		committed += ResidentBytes(textures[i], textures[i].base_level);
+
+	for (int i = 0; i < textures.size(); i++)
+	{
+		TextureResidency& texture = textures[i];
+		if (texture.busy || texture.last_used != frame || texture.base_level <= texture.finest_level)
+			continue;
+
+		size_t resident = ResidentBytes(texture, texture.base_level);
+		size_t wanted = ResidentBytes(texture, texture.finest_level) - resident;
+		while (committed + wanted > budget)
+		{
+			int victim = TrimCandidate(textures, frame);
+			if (victim < 0)
+				break;
+			TextureResidency& trimmed = textures[victim];
+			committed -= ResidentBytes(trimmed, trimmed.base_level) - ResidentBytes(trimmed, trimmed.tail_level);
+			trimmed.base_level = trimmed.tail_level;
+			ResidencyChange change = { victim, trimmed.base_level };
+			changes.push_back(change);
+		}
+
+		// the finest level whose load still fits
+		int base_level = texture.base_level;
+		while (base_level > texture.finest_level && committed + ResidentBytes(texture, base_level - 1) - resident <= budget)
+			base_level--;
+		if (base_level == texture.base_level)
+			continue;
+		committed += ResidentBytes(texture, base_level) - resident;
+		texture.base_level = base_level;
+		ResidencyChange change = { i, base_level };
+		changes.push_back(change);
+	}
+}
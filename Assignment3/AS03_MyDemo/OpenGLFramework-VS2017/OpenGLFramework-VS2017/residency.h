@@ -0,0 +1,44 @@
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include <stddef.h>
+#include <vector>
+
+// Which mip levels of each texture to keep on the GPU under a byte budget.
+//
+// A texture is loaded coarsest first: the first load brings in only its
+// tail, the levels from tail_level down to 1x1, and the tail is never given
+// back, so a texture can always be drawn. Each frame the textures drawn in
+// it are promoted towards their finest level as far as the budget allows,
+// and room is made by trimming the least recently drawn textures back to
+// their tail. Textures drawn in the frame are never trimmed, so a budget
+// smaller than what one frame draws is only as strict as it can be.
+
+const int kResidencyMaxLevels = 16;
+
+struct TextureResidency
+{
+	size_t level_bytes[kResidencyMaxLevels]; // finest first
+	int level_count;
+	int finest_level;	// the finest a promotion may load, normally 0
+	int tail_level;		// tail_level .. level_count - 1 stay resident
+	int base_level;		// finest level resident or being loaded
+	int last_used;		// frame it was last drawn in, -1 if never
+	bool busy;			// a load is in flight, so it is left alone
+};
+
+struct ResidencyChange
+{
+	int texture;		// index into the textures planned
+	int base_level;		// finer than before loads levels, coarser trims them
+};
+
+// Bytes of levels first_level .. level_count - 1
+size_t ResidentBytes(const TextureResidency& texture, int first_level);
+
+// Plans frame: the textures with last_used == frame are promoted, the
+// least recently used others trimmed to fit. Moves base_level of each
+// texture changed to the plan and appends the change.
+void PlanResidency(std::vector<TextureResidency>& textures, size_t budget, int frame, std::vector<ResidencyChange>& changes);
+
+#endif
@@ -1,10 +1,42 @@
 #version 330
 
+// A variant defines one LIGHT_*, at most one SHADING_* and one of
+// UNTEXTURED, TEXTURED or TEXTURED TEXTURE_ARRAY (UseShaderVariant in
+// main.cpp), folding the branches on them below; the uber shader defines
+// none and reads lightIdx, shading and useTexArray instead
+#if defined(LIGHT_DIRECTIONAL)
+#define LIGHT_IDX 0
+#elif defined(LIGHT_POINT)
+#define LIGHT_IDX 1
+#elif defined(LIGHT_SPOT)
+#define LIGHT_IDX 2
+#else
+#define LIGHT_IDX lightIdx
+#endif
+#if defined(SHADING_GOURAUD)
+#define SHADING 0
+#elif defined(SHADING_PHONG)
+#define SHADING 1
+#else
+#define SHADING shading
+#endif
+#if defined(UNTEXTURED)
+#define TEXTURING 0
+#elif defined(TEXTURE_ARRAY)
+#define TEXTURING 2
+#elif defined(TEXTURED)
+#define TEXTURING 1
+#else
+#define TEXTURING (useTexArray + 1)
+#endif
+
 in vec2 texCoord;
+in float texLayer;
 in vec4 vertex_color;
 in vec3 vertex_normal;
 in vec3 vertex_view;
 in vec3 vertex_position;
+flat in int shading; // 0 vertex lighting, 1 pixel lighting
 
 out vec4 fragColor;
 
@@ -39,9 +71,15 @@ struct MaterialInfo{
 
 uniform int lightIdx;
 uniform mat4 view_matrix;			
-uniform LightInfo light[3];
-uniform MaterialInfo material;
-uniform int vertex_or_perpixel;
+// std140, mirrored by LightBlockEntry and MaterialBlock in main.cpp
+layout (std140) uniform Lights
+{
+	LightInfo light[3];
+};
+layout (std140) uniform Material
+{
+	MaterialInfo material;
+};
 
 vec4 directionalLight(){
 	// calculate light_position, viewing_position, vertex_position
@@ -136,6 +174,17 @@ vec4 spotLight(){
 // Hint: sampler2D
 
 uniform sampler2D tex;
+uniform sampler2DArray texArray; // on unit 1
+uniform int useTexArray; // the shape's materials are layers of texArray
+
+vec3 diffuseTexel() {
+	// the placeholder a shape samples until its texture is resident is white
+	if(TEXTURING == 0)
+		return vec3(1.0);
+	if(TEXTURING == 2)
+		return texture(texArray, vec3(texCoord, texLayer)).rgb;
+	return texture(tex, texCoord).rgb;
+}
 
 void main() {
 	//fragColor = vec4(texCoord.xy, 0, 1);
@@ -144,25 +193,25 @@ void main() {
 	// Hint: texture
 
 	vec4 color;
-	if(vertex_or_perpixel == 0) {
-		vec4 texColor = vec4(texture(tex, texCoord).rgb, 1.0);
+	if(SHADING == 0) {
+		vec4 texColor = vec4(diffuseTexel(), 1.0);
         fragColor = vertex_color * texColor;
         return;
 	}
-	if(lightIdx == 0)
+	if(LIGHT_IDX == 0)
 	{
 		color = directionalLight();
 	}
-	else if(lightIdx == 1)
+	else if(LIGHT_IDX == 1)
 	{
 		color = pointLight();
 	}
-	else if(lightIdx == 2)
+	else if(LIGHT_IDX == 2)
 	{
 		color = spotLight();
 	}
 	
-	vec4 texColor = vec4(texture(tex, texCoord).rgb, 1.0);
+	vec4 texColor = vec4(diffuseTexel(), 1.0);
     
 	fragColor = color * texColor;
 }
@@ -0,0 +1,85 @@
+#include "shadervariant.h"
+
+#include <string.h>
+#include <iostream>
+#include <sstream>
+
+std::string ShaderDefines(const std::string& names)
+{
+	std::istringstream in(names);
+	std::string defines, name;
+	while (in >> name)
+		defines += "#define " + name + "\n";
+	return defines;
+}
+
+// Length of source up to and including its #version line, 0 if it has none
+static size_t VersionLineEnd(const char* source, size_t length)
+{
+	const char kVersion[] = "#version";
+	const size_t kVersionLength = sizeof(kVersion) - 1;
+	for (size_t i = 0; i + kVersionLength <= length; i++)
+	{
+		if (memcmp(source + i, kVersion, kVersionLength) != 0)
+			continue;
+		while (i < length && source[i] != '\n')
+			i++;
+		return i < length ? i + 1 : length;
+	}
+	return 0;
+}
+
+static GLuint CompileStage(GLenum stage, const char* source, size_t length, const std::string& defines, const std::string& names)
+{
+	size_t split = VersionLineEnd(source, length);
+	const GLchar* strings[3] = { source, defines.c_str(), source + split };
+	GLint lengths[3] = { (GLint)split, (GLint)defines.size(), (GLint)(length - split) };
+
+	GLuint shader = glCreateShader(stage);
+	glShaderSource(shader, 3, strings, lengths);
+	glCompileShader(shader);
+
+	GLint success;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		char infoLog[1000];
+		glGetShaderInfoLog(shader, 1000, NULL, infoLog);
+		std::cout << "ERROR: " << (stage == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT") << " SHADER COMPILATION FAILED (" << names << ")\n" << infoLog << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+GLuint BuildShaderVariant(const char* vs, size_t vs_length, const char* fs, size_t fs_length, const std::string& names)
+{
+	std::string defines = ShaderDefines(names);
+	GLuint v = CompileStage(GL_VERTEX_SHADER, vs, vs_length, defines, names);
+	GLuint f = CompileStage(GL_FRAGMENT_SHADER, fs, fs_length, defines, names);
+
+	GLuint p = 0;
+	if (v != 0 && f != 0)
+	{
+		p = glCreateProgram();
+		glAttachShader(p, f);
+		glAttachShader(p, v);
+		glLinkProgram(p);
+
+		GLint success;
+		glGetProgramiv(p, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[1000];
+			glGetProgramInfoLog(p, 1000, NULL, infoLog);
+			std::cout << "ERROR: SHADER PROGRAM LINKING FAILED (" << names << ")\n" << infoLog << std::endl;
+			glDeleteProgram(p);
+			p = 0;
+		}
+	}
+
+	// deleting 0 is ignored, and attached shaders live on with the program
+	glDeleteShader(v);
+	glDeleteShader(f);
+	return p;
+}
@@ -0,0 +1,23 @@
+#ifndef SHADERVARIANT_H
+#define SHADERVARIANT_H
+
+#include <stddef.h>
+#include <string>
+#include <glad/glad.h>
+
+// Programs built from one vertex and one fragment shader source, each with
+// its own set of names #defined, so the shaders can fold away what they
+// would otherwise branch on at run time.
+//
+// The defines go in as a glShaderSource string of their own between a
+// source's #version line and the rest of it, so the sources, which may be
+// MappedFile contents without a '\0', are used as they are.
+
+// "A B" -> "#define A\n#define B\n"
+std::string ShaderDefines(const std::string& names);
+
+// Compiles both stages with names, space separated, defined and links them.
+// Errors are printed along with names; 0 if either step failed.
+GLuint BuildShaderVariant(const char* vs, size_t vs_length, const char* fs, size_t fs_length, const std::string& names);
+
+#endif
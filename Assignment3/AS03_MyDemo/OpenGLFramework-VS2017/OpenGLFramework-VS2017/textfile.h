@@ -1,2 +1,78 @@
+#ifndef TEXTFILE_H
+#define TEXTFILE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// NUL terminated copy of the whole file in a malloc'd buffer, NULL on failure
 char *textFileRead(const char *fn);
+// Replaces the contents of fn with s, returns 1 on success
 int textFileWrite(char *fn, char *s);
+
+// Read access to a whole file for everything the apps load: shaders, .obj,
+// .mtl, textures and mesh caches. The file is memory mapped so the parsers
+// work on the page cache directly; if it cannot be mapped it is read into a
+// heap buffer instead, so callers never need a second code path.
+class MappedFile
+{
+public:
+	enum Mode
+	{
+		MAP_READ_ONLY,		// read-only mapping
+		MAP_COPY_ON_WRITE,	// private writable mapping, writes never reach the file
+		READ_BUFFERED,		// heap copy followed by a '\0', also the fallback of the above
+	};
+
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::string& path, Mode mode = MAP_READ_ONLY);
+	void Close();
+
+	const char* data() const { return data_; }
+	// NULL for a MAP_READ_ONLY mapping
+	char* writable_data() const { return writable_ ? (char*)data_ : NULL; }
+	size_t size() const { return size_; }
+	// False when the contents live in the heap buffer
+	bool mapped() const { return mapped_; }
+	// True if data()[size()] reads as '\0': always for a buffered file, and
+	// for a mapping that ends inside a page, since the rest of it is zero-filled
+	bool terminated() const { return terminated_; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	bool Map(const std::string& path, bool copy_on_write);
+	bool Read(const std::string& path);
+
+	const char* data_;
+	size_t size_;
+	bool mapped_;
+	bool writable_;
+	bool terminated_;
+	void* file_;
+	void* mapping_;
+	std::vector<char> buffer_;
+};
+
+// One record per successful MappedFile::Open once EnableFileIoStats has been
+// called, nothing is recorded before. open_ms covers open + map, or open +
+// read for a buffered file; the page faults of a mapped file are paid later
+// by whoever reads it and are not included.
+struct FileIoStat
+{
+	std::string path;
+	size_t bytes;
+	bool mapped;
+	double open_ms;
+};
+
+void EnableFileIoStats();
+std::vector<FileIoStat> GetFileIoStats();
+void ResetFileIoStats();
+// Per-file table plus totals on stdout
+void PrintFileIoStats();
+
+#endif
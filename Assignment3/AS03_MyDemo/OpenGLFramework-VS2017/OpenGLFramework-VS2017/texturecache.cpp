@@ -0,0 +1,1161 @@
+#include "texturecache.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <STB/stb_image.h>
+
+#include "texturestate.h"
+
+// EXT_texture_compression_s3tc, not in the core profile glad.h
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+using namespace std;
+
+GLuint placeholder_texture = 0;
+
+bool DecodeTextureImage(const string& image_path, const MappedFile& file, DecodedImage& image)
+{
+	int channel;
+	int require_channel = 4;
+	image.data = stbi_load_from_memory((const stbi_uc*)file.data(), (int)file.size(), &image.width, &image.height, &channel, require_channel);
+	if (image.data == NULL)
+	{
+		cout << "DecodeTextureImage: Cannot load image from " << image_path << endl;
+		return false;
+	}
+	return true;
+}
+
+// Resolves "." / ".." and separators so every spelling of a file gives the
+// same string. Falls back to path itself if it cannot be resolved.
+static string CanonicalPath(const string& path)
+{
+#ifdef _WIN32
+	char full[_MAX_PATH];
+	if (_fullpath(full, path.c_str(), _MAX_PATH) == NULL)
+		return path;
+	string canonical = full;
+	// NTFS names are case-insensitive
+	transform(canonical.begin(), canonical.end(), canonical.begin(), ::tolower);
+	return canonical;
+#else
+	char* full = realpath(path.c_str(), NULL);
+	if (full == NULL)
+		return path;
+	string canonical = full;
+	free(full);
+	return canonical;
+#endif
+}
+
+// FNV-1a over 8 byte words, the bytewise loop costs as much as a BMP decode
+static uint64_t HashBytes(const char* data, size_t size)
+{
+	uint64_t h = 14695981039346656037ULL ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h ^= word;
+		h *= 1099511628211ULL;
+	}
+	for (; i < size; i++)
+	{
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+size_t DdsBytes(const DdsImage& dds)
+{
+	size_t bytes = 0;
+	for (int i = 0; i < dds.levels.size(); i++)
+		bytes += dds.levels[i].size;
+	return bytes;
+}
+
+size_t DdsRgbaBytes(const DdsImage& dds)
+{
+	size_t bytes = 0;
+	for (int i = 0; i < dds.levels.size(); i++)
+		bytes += (size_t)dds.levels[i].width * dds.levels[i].height * 4;
+	return bytes;
+}
+
+string DdsSiblingPath(const string& image_path)
+{
+	size_t slash = image_path.find_last_of("/\\");
+	size_t dot = image_path.find_last_of('.');
+	if (dot == string::npos || (slash != string::npos && dot < slash))
+		return image_path + ".dds";
+	return image_path.substr(0, dot) + ".dds";
+}
+
+enum TextureState
+{
+	TextureWaitingBuffer = 0,	// needs a mapped PBO from the render thread
+	TextureDecoding = 1,		// owned by a decode worker
+	TextureDecoded = 2,			// pixels in the PBO, waiting for the upload
+	TextureUploading = 3,		// glTexImage2D issued, fence pending
+	TextureResident = 4,
+	TextureFailed = 5,
+};
+
+enum TextureSource
+{
+	TextureFromImage = 0,		// stb_image to RGBA8, mips generated by GL or the worker
+	TextureFromDds = 1,			// BCn blocks and stored mips uploaded as they are
+	TextureFromDdsDecoded = 2,	// BCn the context lacks, decoded to RGBA8 by the worker
+	TextureFromAtlas = 3,		// images decoded into the cells of an atlas
+	TextureFromArray = 4,		// images of one size decoded into the layers of a GL_TEXTURE_2D_ARRAY
+};
+
+struct TextureCacheEntry
+{
+	string path; // canonical, empty for a free slot
+	string image_path; // as requested, for messages
+	uint64_t hash = 0;
+	int refs = 0;
+	int width = 0;
+	int height = 0;
+	TextureState state = TextureWaitingBuffer;
+	TextureSource source = TextureFromImage;
+	DdsImage dds; // levels of a DDS source
+	bool cpu_mips = false; // the worker appends the mip chain to level 0
+	TextureAtlas atlas; // layout of an atlas source; an array's layers are its image_paths
+	size_t buffer_bytes = 0; // what the worker writes into the PBO
+	size_t gpu_bytes = 0; // the texture with its mips, or the levels resident if streamed
+	// streamed entries only
+	bool streamed = false;
+	int level_count = 0;
+	int finest_level = 0; // raised past a promotion that failed
+	int tail_level = 0;
+	int base_level = -1; // finest level the texture samples, -1 until it is resident
+	int load_level = 0; // levels load_level .. load_end - 1 are what the load in flight brings in
+	int load_end = 0;
+	bool promoting = false; // the load in flight adds finer levels to a resident texture
+	int last_used = -1; // texture_frame it was last drawn in
+	unique_ptr<MappedFile> file; // encoded image, kept until decoded
+	unsigned char* pixels = NULL; // decode destination, the mapped PBO
+	// render thread only
+	GLuint pbo = 0;
+	GLuint tex = 0;
+	GLsync fence = 0;
+};
+
+mutex texture_cache_mutex; // guards everything below
+vector<TextureCacheEntry> texture_cache;
+int texture_cache_hits = 0;
+int texture_cache_misses = 0;
+size_t texture_bytes_saved = 0;
+deque<int> texture_decode_jobs;
+condition_variable texture_decode_cv; // a job was queued
+condition_variable texture_decoded_cv; // a job finished
+bool texture_decode_stop = false;
+vector<thread> texture_decoders;
+unsigned int decode_threads = 0;
+bool prefer_dds_textures = true;
+bool force_dds_decode = false;
+bool cpu_mipmaps = false;
+MipFilter mipmap_filter = MIP_FILTER_BOX;
+bool dds_format_supported[4] = { false, false, false, false };
+chrono::steady_clock::time_point texture_load_start;
+int texture_loads_pending = 0; // misses not yet resident or failed
+size_t texture_budget = 0;
+int texture_frame = 0; // frames rendered, for last_used
+int texture_promotions = 0;
+int texture_trims = 0;
+size_t texture_trimmed_bytes = 0;
+
+static const GLenum kDdsGlFormats[4] =
+{
+	GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+	GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+	GL_COMPRESSED_RG_RGTC2,
+	GL_COMPRESSED_RGBA_BPTC_UNORM,
+};
+
+static int FindCachedTexture(const string& path, uint64_t hash)
+{
+	for (int i = 0; i < texture_cache.size(); i++)
+	{
+		if (texture_cache[i].refs > 0 && texture_cache[i].hash == hash && texture_cache[i].path == path)
+			return i;
+	}
+	return -1;
+}
+
+// A free slot set up for a miss, with one reference. Caller holds
+// texture_cache_mutex and fills in the source.
+static int NewTextureEntry(const string& path, const string& image_path, uint64_t hash, int width, int height)
+{
+	int handle;
+	for (handle = 0; handle < texture_cache.size(); handle++)
+	{
+		if (texture_cache[handle].path.empty())
+			break;
+	}
+	if (handle == texture_cache.size())
+		texture_cache.push_back(TextureCacheEntry());
+
+	TextureCacheEntry& entry = texture_cache[handle];
+	entry.path = path;
+	entry.image_path = image_path;
+	entry.hash = hash;
+	entry.refs = 1;
+	entry.width = width;
+	entry.height = height;
+	entry.state = TextureWaitingBuffer;
+	texture_cache_misses++;
+	if (texture_loads_pending++ == 0)
+		texture_load_start = chrono::steady_clock::now();
+	return handle;
+}
+
+// Bytes of levels first_level .. end_level - 1 of a streamed entry
+static size_t TextureLevelBytes(const TextureCacheEntry& entry, int first_level, int end_level)
+{
+	size_t bytes = 0;
+	for (int i = first_level; i < end_level; i++)
+	{
+		if (entry.source == TextureFromDds)
+			bytes += entry.dds.levels[i].size;
+		else
+			bytes += (size_t)max(entry.width >> i, 1) * max(entry.height >> i, 1) * 4;
+	}
+	return bytes;
+}
+
+// With a budget, turns a new entry into a streamed one whose first load
+// is its tail. An image gets its chain from the worker, since glGenerateMipmap
+// cannot make levels finer than the ones it has.
+static void StreamTextureLevels(TextureCacheEntry& entry)
+{
+	int level_count = entry.source == TextureFromImage ? MipLevelCount(entry.width, entry.height) : (int)entry.dds.levels.size();
+	if (texture_budget == 0 || level_count <= 1 || level_count > kResidencyMaxLevels)
+		return;
+	int tail_level = 0;
+	while (tail_level < level_count - 1 && max(entry.width >> tail_level, entry.height >> tail_level) > kStreamTailSize)
+		tail_level++;
+	if (tail_level == 0)
+		return;
+
+	entry.streamed = true;
+	entry.cpu_mips = entry.source == TextureFromImage;
+	entry.level_count = level_count;
+	entry.tail_level = tail_level;
+	entry.load_level = tail_level;
+	entry.load_end = level_count;
+	entry.buffer_bytes = TextureLevelBytes(entry, tail_level, level_count);
+	entry.gpu_bytes = entry.buffer_bytes;
+}
+
+int AcquireTexture(const string& image_path)
+{
+	unique_ptr<MappedFile> file(new MappedFile);
+	string file_path = image_path;
+	DdsImage dds;
+	bool is_dds = false;
+	if (prefer_dds_textures && file->Open(DdsSiblingPath(image_path)))
+	{
+		is_dds = ParseDds(file->data(), file->size(), dds);
+		if (is_dds)
+			file_path = DdsSiblingPath(image_path);
+		else
+			cout << "AcquireTexture: Cannot read " << DdsSiblingPath(image_path) << ", using " << image_path << endl;
+	}
+	if (!is_dds && !file->Open(image_path))
+	{
+		cout << "AcquireTexture: Cannot open image " << image_path << endl;
+		return -1;
+	}
+	string path = CanonicalPath(file_path);
+	uint64_t hash = HashBytes(file->data(), file->size());
+
+	lock_guard<mutex> lock(texture_cache_mutex);
+	int handle = FindCachedTexture(path, hash);
+	if (handle >= 0)
+	{
+		TextureCacheEntry& entry = texture_cache[handle];
+		entry.refs++;
+		texture_cache_hits++;
+		texture_bytes_saved += entry.gpu_bytes;
+		return handle;
+	}
+
+	int width, height, channel;
+	if (is_dds)
+	{
+		width = dds.width;
+		height = dds.height;
+	}
+	else if (!stbi_info_from_memory((const stbi_uc*)file->data(), (int)file->size(), &width, &height, &channel))
+	{
+		cout << "AcquireTexture: Cannot load image from " << image_path << endl;
+		return -1;
+	}
+
+	handle = NewTextureEntry(path, file_path, hash, width, height);
+	TextureCacheEntry& entry = texture_cache[handle];
+	if (!is_dds)
+	{
+		entry.source = TextureFromImage;
+		entry.cpu_mips = cpu_mipmaps;
+		entry.buffer_bytes = entry.cpu_mips ? MipChainBytes(width, height) : (size_t)width * height * 4;
+		entry.gpu_bytes = MipChainBytes(width, height);
+	}
+	else if (dds_format_supported[dds.format])
+	{
+		entry.source = TextureFromDds;
+		entry.cpu_mips = false;
+		entry.buffer_bytes = DdsBytes(dds);
+		entry.gpu_bytes = entry.buffer_bytes;
+	}
+	else
+	{
+		entry.source = TextureFromDdsDecoded;
+		// a lone top level gets its mips from glGenerateMipmap or the worker
+		entry.cpu_mips = cpu_mipmaps && dds.levels.size() == 1;
+		entry.buffer_bytes = entry.cpu_mips ? MipChainBytes(width, height) : DdsRgbaBytes(dds);
+		entry.gpu_bytes = dds.levels.size() == 1 ? MipChainBytes(width, height) : entry.buffer_bytes;
+	}
+	entry.dds = dds;
+	entry.file = move(file);
+	StreamTextureLevels(entry);
+	return handle;
+}
+
+// Images with a gutter per mip level: the bytes of the levels an atlas of
+// this size keeps
+static size_t AtlasBytes(int width, int height)
+{
+	size_t bytes = 0;
+	for (int i = 0; i < AtlasLevelCount(kAtlasGutter); i++)
+	{
+		bytes += (size_t)width * height * 4;
+		width = max(width / 2, 1);
+		height = max(height / 2, 1);
+	}
+	return bytes;
+}
+
+bool ReadImageSize(const string& image_path, int* width, int* height)
+{
+	MappedFile file;
+	int channel;
+	return file.Open(image_path) && stbi_info_from_memory((const stbi_uc*)file.data(), (int)file.size(), width, height, &channel);
+}
+
+// Key of a texture made of several images: kind, then the canonical paths
+// in order, with a hash over their contents. Fills the sizes of rects;
+// false if an image cannot be read.
+static bool KeyImageSet(const char* kind, const vector<string>& image_paths, string& path, uint64_t& hash, vector<AtlasRect>& rects)
+{
+	path = kind;
+	hash = 14695981039346656037ULL;
+	rects.assign(image_paths.size(), AtlasRect());
+	for (int i = 0; i < image_paths.size(); i++)
+	{
+		MappedFile file;
+		int channel;
+		if (!file.Open(image_paths[i]) || !stbi_info_from_memory((const stbi_uc*)file.data(), (int)file.size(), &rects[i].width, &rects[i].height, &channel))
+		{
+			cout << "KeyImageSet: Cannot load image from " << image_paths[i] << endl;
+			return false;
+		}
+		path += CanonicalPath(image_paths[i]) + ";";
+		hash = (hash ^ HashBytes(file.data(), file.size())) * 1099511628211ULL;
+	}
+	return true;
+}
+
+int AcquireAtlasTexture(const vector<string>& image_paths, TextureAtlas& atlas)
+{
+	string path;
+	uint64_t hash;
+	vector<AtlasRect> rects;
+	if (!KeyImageSet("atlas:", image_paths, path, hash, rects))
+		return -1;
+
+	lock_guard<mutex> lock(texture_cache_mutex);
+	int handle = FindCachedTexture(path, hash);
+	if (handle >= 0)
+	{
+		TextureCacheEntry& entry = texture_cache[handle];
+		entry.refs++;
+		texture_cache_hits++;
+		texture_bytes_saved += entry.gpu_bytes;
+		atlas = entry.atlas;
+		return handle;
+	}
+
+	atlas.image_paths = image_paths;
+	atlas.rects = rects;
+	if (!PackAtlas(atlas.rects, kAtlasGutter, kAtlasMaxSize, &atlas.width, &atlas.height))
+	{
+		cout << "AcquireAtlasTexture: " << image_paths.size() << " images do not fit in " << kAtlasMaxSize << "x" << kAtlasMaxSize << endl;
+		return -1;
+	}
+
+	handle = NewTextureEntry(path, image_paths[0], hash, atlas.width, atlas.height);
+	TextureCacheEntry& entry = texture_cache[handle];
+	entry.source = TextureFromAtlas;
+	entry.cpu_mips = cpu_mipmaps;
+	entry.buffer_bytes = entry.cpu_mips ? MipChainBytes(atlas.width, atlas.height) : (size_t)atlas.width * atlas.height * 4;
+	entry.gpu_bytes = AtlasBytes(atlas.width, atlas.height);
+	entry.atlas = atlas;
+	return handle;
+}
+
+int AcquireArrayTexture(const vector<string>& image_paths)
+{
+	string path;
+	uint64_t hash;
+	vector<AtlasRect> rects;
+	if (!KeyImageSet("array:", image_paths, path, hash, rects))
+		return -1;
+	for (int i = 1; i < rects.size(); i++)
+	{
+		if (rects[i].width != rects[0].width || rects[i].height != rects[0].height)
+		{
+			cout << "AcquireArrayTexture: " << image_paths[i] << " is not the size of " << image_paths[0] << endl;
+			return -1;
+		}
+	}
+
+	lock_guard<mutex> lock(texture_cache_mutex);
+	int handle = FindCachedTexture(path, hash);
+	if (handle >= 0)
+	{
+		TextureCacheEntry& entry = texture_cache[handle];
+		entry.refs++;
+		texture_cache_hits++;
+		texture_bytes_saved += entry.gpu_bytes;
+		return handle;
+	}
+
+	handle = NewTextureEntry(path, image_paths[0], hash, rects[0].width, rects[0].height);
+	TextureCacheEntry& entry = texture_cache[handle];
+	entry.source = TextureFromArray;
+	entry.cpu_mips = false;
+	entry.buffer_bytes = (size_t)rects[0].width * rects[0].height * 4 * image_paths.size();
+	entry.gpu_bytes = MipChainBytes(rects[0].width, rects[0].height) * image_paths.size();
+	entry.atlas.image_paths = image_paths;
+	entry.atlas.width = rects[0].width;
+	entry.atlas.height = rects[0].height;
+	return handle;
+}
+
+// Hands a TextureWaitingBuffer entry and buffer_bytes of destination to the
+// decode workers. Caller holds texture_cache_mutex.
+static void StartTextureDecode(int handle, unsigned char* pixels)
+{
+	texture_cache[handle].pixels = pixels;
+	texture_cache[handle].state = TextureDecoding;
+	texture_decode_jobs.push_back(handle);
+	texture_decode_cv.notify_one();
+}
+
+// Worker side of a load: writes what the upload reads from the PBO. With
+// cpu_mips the source is a single RGBA8 level and its chain follows it. file
+// is NULL for an atlas, which reads its own images.
+static bool FillTextureBuffer(const string& image_path, TextureSource source, const DdsImage& dds, const TextureAtlas& atlas, const MappedFile* file, int width, int height, bool cpu_mips, unsigned char* pixels)
+{
+	if (source == TextureFromDds)
+	{
+		// the levels are contiguous in the file, and stay so in the PBO
+		memcpy(pixels, file->data() + dds.levels[0].offset, DdsBytes(dds));
+		return true;
+	}
+	if (source == TextureFromAtlas)
+	{
+		// texels outside every cell are never sampled, but keep them defined
+		memset(pixels, 0, (size_t)width * height * 4);
+		for (int i = 0; i < atlas.image_paths.size(); i++)
+		{
+			MappedFile image_file;
+			DecodedImage image;
+			bool ok = image_file.Open(atlas.image_paths[i]) && DecodeTextureImage(atlas.image_paths[i], image_file, image) &&
+				image.width == atlas.rects[i].width && image.height == atlas.rects[i].height;
+			if (ok)
+				BlitAtlasImage(pixels, width, atlas.rects[i], kAtlasGutter, image.data);
+			stbi_image_free(image.data);
+			if (!ok)
+				return false;
+		}
+		// a wider kernel than the box would reach past the gutters
+		if (cpu_mips)
+			GenerateMipChain(pixels, width, height, MIP_FILTER_BOX);
+		return true;
+	}
+	if (source == TextureFromArray)
+	{
+		for (int i = 0; i < atlas.image_paths.size(); i++)
+		{
+			MappedFile image_file;
+			DecodedImage image;
+			bool ok = image_file.Open(atlas.image_paths[i]) && DecodeTextureImage(atlas.image_paths[i], image_file, image) &&
+				image.width == width && image.height == height;
+			if (ok)
+				memcpy(pixels + (size_t)width * height * 4 * i, image.data, (size_t)width * height * 4);
+			stbi_image_free(image.data);
+			if (!ok)
+				return false;
+		}
+		return true;
+	}
+	if (source == TextureFromDdsDecoded)
+	{
+		for (int i = 0; i < dds.levels.size(); i++)
+		{
+			const DdsLevel& level = dds.levels[i];
+			DecodeDdsLevel(dds.format, (const unsigned char*)file->data() + level.offset, level.width, level.height, pixels);
+			if (cpu_mips)
+				GenerateMipChain(pixels, width, height, mipmap_filter);
+			pixels += (size_t)level.width * level.height * 4;
+		}
+		return true;
+	}
+
+	DecodedImage image;
+	bool ok = DecodeTextureImage(image_path, *file, image) && image.width == width && image.height == height;
+	if (ok)
+	{
+		memcpy(pixels, image.data, (size_t)width * height * 4);
+		if (cpu_mips)
+			GenerateMipChain(pixels, width, height, mipmap_filter);
+	}
+	stbi_image_free(image.data);
+	return ok;
+}
+
+// Worker side of a streamed load: levels first_level .. end_level - 1
+// back to back. An image is decoded and its whole chain made again for
+// every load, the levels outside the range are dropped.
+static bool FillTextureLevels(const string& image_path, TextureSource source, const DdsImage& dds, const MappedFile& file, int width, int height, int first_level, int end_level, unsigned char* pixels)
+{
+	if (source == TextureFromDds || source == TextureFromDdsDecoded)
+	{
+		// the file is opened again for a promotion, and may have changed
+		const DdsLevel& last = dds.levels[end_level - 1];
+		if (file.size() < last.offset + last.size)
+			return false;
+	}
+	if (source == TextureFromDds)
+	{
+		const DdsLevel& first = dds.levels[first_level];
+		const DdsLevel& last = dds.levels[end_level - 1];
+		memcpy(pixels, file.data() + first.offset, last.offset + last.size - first.offset);
+		return true;
+	}
+	if (source == TextureFromDdsDecoded)
+	{
+		for (int i = first_level; i < end_level; i++)
+		{
+			const DdsLevel& level = dds.levels[i];
+			DecodeDdsLevel(dds.format, (const unsigned char*)file.data() + level.offset, level.width, level.height, pixels);
+			pixels += (size_t)level.width * level.height * 4;
+		}
+		return true;
+	}
+
+	DecodedImage image;
+	bool ok = DecodeTextureImage(image_path, file, image) && image.width == width && image.height == height;
+	if (ok)
+	{
+		vector<unsigned char> chain(MipChainBytes(width, height));
+		memcpy(&chain[0], image.data, (size_t)width * height * 4);
+		GenerateMipChain(&chain[0], width, height, mipmap_filter);
+		size_t offset = 0, bytes = 0;
+		for (int i = 0; i < end_level; i++)
+		{
+			size_t level_bytes = (size_t)max(width >> i, 1) * max(height >> i, 1) * 4;
+			if (i < first_level)
+				offset += level_bytes;
+			else
+				bytes += level_bytes;
+		}
+		memcpy(pixels, &chain[offset], bytes);
+	}
+	stbi_image_free(image.data);
+	return ok;
+}
+
+void TextureDecodeThread()
+{
+	for (;;)
+	{
+		int handle;
+		string image_path;
+		TextureSource source;
+		DdsImage dds;
+		TextureAtlas atlas;
+		const MappedFile* file;
+		unsigned char* pixels;
+		int width, height;
+		bool cpu_mips;
+		bool streamed;
+		int load_level, load_end;
+		{
+			unique_lock<mutex> lock(texture_cache_mutex);
+			texture_decode_cv.wait(lock, [] { return texture_decode_stop || !texture_decode_jobs.empty(); });
+			if (texture_decode_stop)
+				return;
+			handle = texture_decode_jobs.front();
+			texture_decode_jobs.pop_front();
+
+			// texture_cache may grow while this runs, so copy out what the
+			// decode needs; the entry itself is not touched until it is done
+			const TextureCacheEntry& entry = texture_cache[handle];
+			image_path = entry.image_path;
+			source = entry.source;
+			dds = entry.dds;
+			atlas = entry.atlas;
+			file = entry.file.get();
+			pixels = entry.pixels;
+			width = entry.width;
+			height = entry.height;
+			cpu_mips = entry.cpu_mips;
+			streamed = entry.streamed;
+			load_level = entry.load_level;
+			load_end = entry.load_end;
+		}
+
+		bool ok;
+		if (streamed)
+		{
+			// the first load let the file go, so a promotion opens it again
+			MappedFile reopened;
+			if (file == NULL && reopened.Open(image_path))
+				file = &reopened;
+			ok = file != NULL && FillTextureLevels(image_path, source, dds, *file, width, height, load_level, load_end, pixels);
+		}
+		else
+		{
+			ok = FillTextureBuffer(image_path, source, dds, atlas, file, width, height, cpu_mips, pixels);
+		}
+
+		lock_guard<mutex> lock(texture_cache_mutex);
+		texture_cache[handle].file.reset();
+		texture_cache[handle].state = ok ? TextureDecoded : TextureFailed;
+		texture_decoded_cv.notify_all();
+	}
+}
+
+void StartTextureDecoders()
+{
+	unsigned int threads = decode_threads > 0 ? decode_threads : max(thread::hardware_concurrency(), 1u);
+	for (unsigned int i = 0; i < threads; i++)
+		texture_decoders.push_back(thread(TextureDecodeThread));
+}
+
+void StopTextureDecoders()
+{
+	{
+		lock_guard<mutex> lock(texture_cache_mutex);
+		texture_decode_stop = true;
+	}
+	texture_decode_cv.notify_all();
+	for (int i = 0; i < texture_decoders.size(); i++)
+		texture_decoders[i].join();
+	texture_decoders.clear();
+	texture_decode_stop = false;
+}
+
+// Frees an entry nobody references; a decoding entry is left to its worker
+// and freed by the next ServiceTextureUploads. Render thread, lock held.
+static void FreeTextureEntry(TextureCacheEntry& entry)
+{
+	if (entry.refs > 0 || entry.state == TextureDecoding)
+		return;
+	// a failed entry still holding its PBO has not been reported yet; a
+	// promotion was never pending
+	if (entry.state != TextureResident && !(entry.state == TextureFailed && entry.pbo == 0) && !entry.promoting)
+		texture_loads_pending--;
+	if (entry.fence != 0)
+		glDeleteSync(entry.fence);
+	if (entry.pbo != 0)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.pbo);
+		if (entry.state == TextureDecoded || entry.state == TextureFailed)
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(1, &entry.pbo);
+	}
+	if (entry.tex != 0)
+	{
+		glDeleteTextures(1, &entry.tex);
+		ForgetTexture(entry.tex);
+	}
+	entry = TextureCacheEntry();
+}
+
+void RetainTexture(int handle)
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	texture_cache[handle].refs++;
+}
+
+void ReleaseTexture(int handle)
+{
+	if (handle < 0)
+		return;
+
+	lock_guard<mutex> lock(texture_cache_mutex);
+	TextureCacheEntry& entry = texture_cache[handle];
+	if (--entry.refs == 0)
+		FreeTextureEntry(entry);
+}
+
+int TextureLayered(int handle)
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	return texture_cache[handle].source == TextureFromArray ? 1 : 0;
+}
+
+GLuint CachedTexture(int handle)
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	const TextureCacheEntry& entry = texture_cache[handle];
+	return entry.state == TextureResident || entry.promoting ? entry.tex : placeholder_texture;
+}
+
+int TextureTopDown(int handle)
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	TextureSource source = texture_cache[handle].source;
+	return source == TextureFromDds || source == TextureFromDdsDecoded ? 1 : 0;
+}
+
+void PrintTextureCacheStats()
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	int resident = 0;
+	size_t bytes = 0;
+	int compressed = 0;
+	size_t compressed_bytes = 0, compressed_rgba_bytes = 0;
+	for (int i = 0; i < texture_cache.size(); i++)
+	{
+		if (texture_cache[i].refs > 0)
+		{
+			resident++;
+			bytes += texture_cache[i].gpu_bytes;
+			if (texture_cache[i].source == TextureFromDds)
+			{
+				compressed++;
+				compressed_bytes += texture_cache[i].gpu_bytes;
+				compressed_rgba_bytes += DdsRgbaBytes(texture_cache[i].dds);
+			}
+		}
+	}
+	printf("Texture cache: %d hits, %d misses, %d textures (%.2f MB), %.2f MB GPU memory saved\n",
+		texture_cache_hits, texture_cache_misses, resident, bytes / (1024.0 * 1024.0), texture_bytes_saved / (1024.0 * 1024.0));
+	if (compressed > 0)
+	{
+		printf("  %d block compressed: %.2f MB, %.2f MB as RGBA8 with the same levels (%.2f MB saved)\n", compressed,
+			compressed_bytes / (1024.0 * 1024.0), compressed_rgba_bytes / (1024.0 * 1024.0), (compressed_rgba_bytes - compressed_bytes) / (1024.0 * 1024.0));
+	}
+	if (texture_budget > 0)
+	{
+		// streamed textures by how much of their chain is resident
+		int full = 0, partial = 0, tail = 0;
+		size_t full_bytes = 0;
+		for (int i = 0; i < texture_cache.size(); i++)
+		{
+			const TextureCacheEntry& entry = texture_cache[i];
+			if (entry.refs == 0 || !entry.streamed || entry.state == TextureFailed)
+				continue;
+			full_bytes += TextureLevelBytes(entry, 0, entry.level_count);
+			if (entry.base_level == 0)
+				full++;
+			else if (entry.base_level < entry.tail_level)
+				partial++;
+			else
+				tail++;
+		}
+		printf("  budget %.2f MB: %d streamed at full resolution, %d partly, %d at their tail (%.2f MB at full resolution); %d promotions, %d trims (%.2f MB freed)\n",
+			texture_budget / (1024.0 * 1024.0), full, partial, tail, full_bytes / (1024.0 * 1024.0), texture_promotions, texture_trims, texture_trimmed_bytes / (1024.0 * 1024.0));
+	}
+}
+
+// Specifies the bound texture from the bound PBO, so this returns before the
+// copy is done. An array is bound to GL_TEXTURE_2D_ARRAY, the rest to
+// GL_TEXTURE_2D.
+static void UploadTextureLevels(const TextureCacheEntry& entry)
+{
+	if (entry.streamed)
+	{
+		// only the levels of this load; the base level moves once the fence
+		// has signaled
+		size_t offset = 0;
+		for (int i = entry.load_level; i < entry.load_end; i++)
+		{
+			int width = max(entry.width >> i, 1), height = max(entry.height >> i, 1);
+			if (entry.source == TextureFromDds)
+			{
+				const DdsLevel& level = entry.dds.levels[i];
+				glCompressedTexImage2D(GL_TEXTURE_2D, i, kDdsGlFormats[entry.dds.format], level.width, level.height, 0, (GLsizei)level.size, (const void*)offset);
+				offset += level.size;
+			}
+			else
+			{
+				glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)offset);
+				offset += (size_t)width * height * 4;
+			}
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.level_count - 1);
+		return;
+	}
+
+	if (entry.source == TextureFromDds)
+	{
+		const vector<DdsLevel>& levels = entry.dds.levels;
+		size_t offset = 0;
+		for (int i = 0; i < levels.size(); i++)
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, kDdsGlFormats[entry.dds.format], levels[i].width, levels[i].height, 0, (GLsizei)levels[i].size, (const void*)offset);
+			offset += levels[i].size;
+		}
+		// a BCn texture cannot generate its own mips, so a short chain is
+		// made complete by ending it where the file does
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+		return;
+	}
+
+	if (entry.source == TextureFromArray)
+	{
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, entry.width, entry.height, (GLsizei)entry.atlas.image_paths.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)0);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		return;
+	}
+
+	// RGBA8 levels back to back: the decoded DDS levels, a CPU chain or
+	// just level 0, which GL completes. An atlas stops at the last level
+	// its gutters cover.
+	int level_count = 1, max_level = MipLevelCount(entry.width, entry.height) - 1;
+	if (entry.source == TextureFromAtlas)
+		max_level = min(max_level, AtlasLevelCount(kAtlasGutter) - 1);
+	if (entry.cpu_mips)
+		level_count = max_level + 1;
+	else if (entry.source == TextureFromDdsDecoded)
+		level_count = (int)entry.dds.levels.size();
+	int width = entry.width, height = entry.height;
+	size_t offset = 0;
+	for (int i = 0; i < level_count; i++)
+	{
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)offset);
+		offset += (size_t)width * height * 4;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	if (level_count > 1)
+		max_level = level_count - 1;
+	// set first, glGenerateMipmap only fills levels up to it
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_level);
+	if (level_count == 1 && max_level > 0)
+		glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+// A promotion that did not make it, its PBO already deleted: the texture
+// keeps the levels it has and is not promoted past them again
+static void AbandonPromotion(TextureCacheEntry& entry)
+{
+	entry.promoting = false;
+	entry.finest_level = entry.base_level;
+	entry.load_level = entry.base_level;
+	entry.load_end = entry.level_count;
+	entry.state = TextureResident;
+}
+
+bool ServiceTextureUploads(void (*arrived)(int handle, GLuint tex))
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	bool finished = false, in_flight = false;
+	for (int i = 0; i < texture_cache.size(); i++)
+	{
+		TextureCacheEntry& entry = texture_cache[i];
+		if (entry.path.empty())
+			continue;
+		if (entry.refs == 0)
+		{
+			FreeTextureEntry(entry);
+			continue;
+		}
+
+		GLsizeiptr bytes = (GLsizeiptr)entry.buffer_bytes;
+		switch (entry.state)
+		{
+		case TextureWaitingBuffer:
+		{
+			glGenBuffers(1, &entry.pbo);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.pbo);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+			void* pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			if (pixels == NULL)
+			{
+				cout << "ServiceTextureUploads: Cannot map a pixel buffer for " << entry.image_path << endl;
+				glDeleteBuffers(1, &entry.pbo);
+				entry.pbo = 0;
+				if (entry.promoting)
+				{
+					AbandonPromotion(entry);
+					break;
+				}
+				entry.state = TextureFailed;
+				texture_loads_pending--;
+				finished = true;
+				break;
+			}
+			StartTextureDecode(i, (unsigned char*)pixels);
+			break;
+		}
+
+		case TextureDecoded:
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.pbo);
+			// GL_FALSE means the buffer contents were lost, the texture keeps
+			// its placeholder then
+			bool intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+			if (intact)
+			{
+				// a promotion adds levels to the texture it has
+				if (entry.tex == 0)
+					glGenTextures(1, &entry.tex);
+				if (entry.source == TextureFromArray)
+					BindTextureArray(1, entry.tex);
+				else
+					BindTexture2D(0, entry.tex);
+				UploadTextureLevels(entry);
+				entry.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			entry.state = intact ? TextureUploading : TextureFailed;
+			if (!intact)
+			{
+				glDeleteBuffers(1, &entry.pbo);
+				entry.pbo = 0;
+				if (entry.promoting)
+				{
+					AbandonPromotion(entry);
+					break;
+				}
+				texture_loads_pending--;
+				finished = true;
+			}
+			break;
+		}
+
+		case TextureUploading:
+		{
+			GLenum status = glClientWaitSync(entry.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(entry.fence);
+			entry.fence = 0;
+			glDeleteBuffers(1, &entry.pbo);
+			entry.pbo = 0;
+			entry.state = TextureResident;
+			if (entry.streamed)
+			{
+				BindTexture2D(0, entry.tex);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.load_level);
+				entry.base_level = entry.load_level;
+				entry.gpu_bytes = TextureLevelBytes(entry, entry.base_level, entry.level_count);
+			}
+			arrived(i, entry.tex);
+			if (entry.promoting)
+			{
+				entry.promoting = false;
+				texture_promotions++;
+				break;
+			}
+			texture_loads_pending--;
+			finished = true;
+			break;
+		}
+
+		case TextureFailed:
+			if (entry.pbo != 0)
+			{
+				cout << "ServiceTextureUploads: Cannot decode " << entry.image_path << (entry.promoting ? ", keeping its coarser levels" : ", keeping the placeholder") << endl;
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.pbo);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				glDeleteBuffers(1, &entry.pbo);
+				entry.pbo = 0;
+				if (entry.promoting)
+				{
+					AbandonPromotion(entry);
+					break;
+				}
+				texture_loads_pending--;
+				finished = true;
+			}
+			break;
+
+		default:
+			break;
+		}
+		in_flight = in_flight || (entry.state != TextureResident && entry.state != TextureFailed);
+	}
+
+	if (finished && texture_loads_pending == 0)
+		printf("Textures resident %.1f ms after the first request\n", chrono::duration<double, milli>(chrono::steady_clock::now() - texture_load_start).count());
+	return in_flight;
+}
+
+// How PlanResidency sees an entry. One that is not streamed is a single
+// level that cannot be trimmed; a free slot is busy and so left out.
+static void DescribeResidency(const TextureCacheEntry& entry, TextureResidency& texture)
+{
+	texture.last_used = entry.last_used;
+	texture.busy = entry.path.empty() || entry.state != TextureResident;
+	if (entry.streamed)
+	{
+		texture.level_count = entry.level_count;
+		for (int i = 0; i < entry.level_count; i++)
+			texture.level_bytes[i] = TextureLevelBytes(entry, i, i + 1);
+		texture.finest_level = entry.finest_level;
+		texture.tail_level = entry.tail_level;
+		// what a load in flight will leave resident
+		texture.base_level = entry.load_level;
+		return;
+	}
+	texture.level_count = 1;
+	texture.level_bytes[0] = entry.path.empty() || entry.state == TextureFailed ? 0 : entry.gpu_bytes;
+	texture.finest_level = 0;
+	texture.tail_level = 0;
+	texture.base_level = 0;
+}
+
+// Drops the levels of a resident streamed texture finer than base_level.
+// A level redefined as empty gives back its storage, and levels below the
+// base do not count for completeness, whatever their format.
+static void TrimTexture(TextureCacheEntry& entry, int base_level)
+{
+	BindTexture2D(0, entry.tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base_level);
+	for (int i = entry.base_level; i < base_level; i++)
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	entry.base_level = base_level;
+	entry.load_level = base_level;
+	entry.gpu_bytes = TextureLevelBytes(entry, base_level, entry.level_count);
+}
+
+// A promotion starts over as a load of the missing levels, which the next
+// ServiceTextureUploads picks up.
+void UpdateTextureResidency(const vector<int>& drawn)
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	texture_frame++;
+	for (int i = 0; i < drawn.size(); i++)
+	{
+		if (drawn[i] >= 0)
+			texture_cache[drawn[i]].last_used = texture_frame;
+	}
+	if (texture_budget == 0)
+		return;
+
+	static vector<TextureResidency> textures;
+	static vector<ResidencyChange> changes;
+	textures.resize(texture_cache.size());
+	for (int i = 0; i < texture_cache.size(); i++)
+		DescribeResidency(texture_cache[i], textures[i]);
+	changes.clear();
+	PlanResidency(textures, texture_budget, texture_frame, changes);
+
+	int trims = 0;
+	size_t trimmed_bytes = 0;
+	for (int i = 0; i < changes.size(); i++)
+	{
+		TextureCacheEntry& entry = texture_cache[changes[i].texture];
+		if (changes[i].base_level > entry.load_level)
+		{
+			trimmed_bytes += TextureLevelBytes(entry, entry.base_level, changes[i].base_level);
+			TrimTexture(entry, changes[i].base_level);
+			trims++;
+			continue;
+		}
+		entry.promoting = true;
+		entry.load_end = entry.load_level;
+		entry.load_level = changes[i].base_level;
+		entry.buffer_bytes = TextureLevelBytes(entry, entry.load_level, entry.load_end);
+		entry.state = TextureWaitingBuffer;
+	}
+	if (trims > 0)
+	{
+		texture_trims += trims;
+		texture_trimmed_bytes += trimmed_bytes;
+		printf("Texture budget: trimmed %d textures to their tail, %.2f MB freed\n", trims, trimmed_bytes / (1024.0 * 1024.0));
+	}
+}
+
+void ResetTextureCacheStats()
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	texture_cache_hits = 0;
+	texture_cache_misses = 0;
+	texture_bytes_saved = 0;
+}
+
+void DecodeWaitingTextures(vector<unsigned char*>& buffers)
+{
+	unique_lock<mutex> lock(texture_cache_mutex);
+	for (int i = 0; i < texture_cache.size(); i++)
+	{
+		if (!texture_cache[i].path.empty() && texture_cache[i].state == TextureWaitingBuffer)
+		{
+			buffers.push_back((unsigned char*)malloc(texture_cache[i].buffer_bytes));
+			StartTextureDecode(i, buffers.back());
+		}
+	}
+	texture_decoded_cv.wait(lock, [] {
+		for (int i = 0; i < texture_cache.size(); i++)
+		{
+			if (texture_cache[i].state == TextureDecoding)
+				return false;
+		}
+		return true;
+	});
+}
+
+int CountDecodedTextures(size_t* bytes)
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	int textures = 0;
+	*bytes = 0;
+	for (int i = 0; i < texture_cache.size(); i++)
+	{
+		if (!texture_cache[i].path.empty() && texture_cache[i].state == TextureDecoded)
+		{
+			textures++;
+			*bytes += texture_cache[i].gpu_bytes;
+		}
+	}
+	return textures;
+}
+
+void DescribeTextureCache(vector<TextureResidency>& textures)
+{
+	lock_guard<mutex> lock(texture_cache_mutex);
+	textures.resize(texture_cache.size());
+	for (int i = 0; i < texture_cache.size(); i++)
+	{
+		DescribeResidency(texture_cache[i], textures[i]);
+		textures[i].busy = texture_cache[i].path.empty();
+	}
+}
@@ -0,0 +1,161 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+#include "textfile.h"
+#include "dds.h"
+#include "mipmap.h"
+#include "atlas.h"
+#include "residency.h"
+
+// Textures shared by every material that names the same image. Entries are
+// keyed by canonical path plus content hash, so two spellings of one path
+// share a GL texture while an image edited on disk gets a new one. A handle
+// is an index into the cache holding one reference, and the texture is
+// deleted with the last reference.
+//
+// A miss only reads the image header. The render thread then maps a pixel
+// unpack buffer of the right size, a decode worker decodes into it, and the
+// render thread issues the upload from the buffer and polls its fence.
+// Until the fence signals, materials sample placeholder_texture.
+//
+// An image with a .dds next to it (earth.jpg, earth.dds) is loaded from the
+// .dds: its BCn blocks and stored mips go to the GPU as they are, with no
+// decode. If the context lacks the format, the worker decodes the blocks to
+// RGBA8 instead.
+//
+// With --mipmaps box or kaiser, an RGBA8 texture without stored mips gets
+// its chain from the worker as well (GenerateMipChain, in linear light) and
+// every level is uploaded from the PBO, instead of glGenerateMipmap on the
+// render thread.
+//
+// An atlas entry (AcquireAtlasTexture) packs several images into one
+// texture; the worker decodes each into its cell of the PBO, and only the
+// levels its gutters keep apart are made. An array entry
+// (AcquireArrayTexture) decodes them into consecutive layers instead.
+//
+// With --texture-budget MB, single images, DDS files and decoded DDS files
+// with stored mips are streamed: the first load brings in only the levels
+// of kStreamTailSize and smaller, and UpdateTextureResidency loads the finer
+// ones while the viewed model draws them, trimming textures the other models
+// drew longest ago to stay within the budget (PlanResidency). A load of
+// finer levels goes through the same states on a texture that stays
+// resident, and is undone without harm if it fails. Atlases and arrays are
+// loaded whole and count against the budget as they are.
+
+// Options, set before StartTextureDecoders
+extern unsigned int decode_threads; // --decode-threads N, 0 for one per core
+extern bool prefer_dds_textures; // false with --no-dds
+extern bool force_dds_decode; // --decode-dds: the software path even if the context has the format
+extern bool cpu_mipmaps; // --mipmaps box|kaiser, glGenerateMipmap with --mipmaps gl
+extern MipFilter mipmap_filter;
+extern bool dds_format_supported[4]; // by DdsFormat, set in setupRC
+extern size_t texture_budget; // --texture-budget MB, 0 for no streaming
+const int kStreamTailSize = 64; // the first load of a streamed texture stops at this side
+
+// White, bound by a material until its texture is resident (setupRC)
+extern GLuint placeholder_texture;
+
+const int kAtlasGutter = 16; // texels around each atlas image, 5 clean levels
+const int kAtlasMaxSize = 4096; // a side every GL 3.3 desktop part supports
+
+struct TextureAtlas
+{
+	std::vector<std::string> image_paths;
+	std::vector<AtlasRect> rects; // by image_paths
+	int width = 0;
+	int height = 0;
+};
+
+// RGBA8 pixels decoded by stb_image, freed with stbi_image_free
+struct DecodedImage
+{
+	unsigned char* data = NULL;
+	int width = 0;
+	int height = 0;
+};
+
+// Only touches the heap, so it is safe on any thread.
+// stbi_set_flip_vertically_on_load is set once in setupRC.
+bool DecodeTextureImage(const std::string& image_path, const MappedFile& file, DecodedImage& image);
+
+// Width and height from the image header; false if it cannot be read
+bool ReadImageSize(const std::string& image_path, int* width, int* height);
+
+// The levels of a DDS as stored, and decoded to RGBA8
+size_t DdsBytes(const DdsImage& dds);
+size_t DdsRgbaBytes(const DdsImage& dds);
+
+// "dir/earth.jpg" -> "dir/earth.dds"
+std::string DdsSiblingPath(const std::string& image_path);
+
+// CPU side, safe on the loader thread: hashes the file and, on a miss, reads
+// the image size. Returns -1 if the image cannot be loaded.
+int AcquireTexture(const std::string& image_path);
+
+// One texture holding every image of image_paths, shared like a single
+// image. Fills atlas with the layout the texcoords are mapped into.
+// Returns -1 if an image cannot be read or the images do not fit.
+// Loader thread, like AcquireTexture; the images themselves are always read,
+// never a .dds next to them.
+int AcquireAtlasTexture(const std::vector<std::string>& image_paths, TextureAtlas& atlas);
+
+// A GL_TEXTURE_2D_ARRAY with image_paths as its layers, in order, shared
+// like an atlas. Returns -1 if an image cannot be read or the sizes differ.
+// Its mips always come from glGenerateMipmap.
+int AcquireArrayTexture(const std::vector<std::string>& image_paths);
+
+// One more reference to a handle already held
+void RetainTexture(int handle);
+
+// Drops one reference; on the render thread since the last one deletes the
+// GL texture
+void ReleaseTexture(int handle);
+
+// 1 if handle is a GL_TEXTURE_2D_ARRAY, sampled by the layer of each vertex
+int TextureLayered(int handle);
+
+// What a material using handle binds right now
+GLuint CachedTexture(int handle);
+
+// 1 if the rows of the texture are top-down, which is true of every DDS
+// source; the placeholder is a single texel, so it does not matter there
+int TextureTopDown(int handle);
+
+void StartTextureDecoders();
+void StopTextureDecoders();
+
+// Called once per loop iteration: maps PBOs for new textures, uploads the
+// decoded ones and swaps in the textures whose fence has signaled, calling
+// arrived for each, as well as for a texture that gained finer levels.
+// True while loads are still in flight.
+bool ServiceTextureUploads(void (*arrived)(int handle, GLuint tex));
+
+// Called before each frame drawn, after ServiceTextureUploads, with the
+// handles the frame draws: marks them as used and, with a budget, trims and
+// promotes as PlanResidency says.
+void UpdateTextureResidency(const std::vector<int>& drawn);
+
+void PrintTextureCacheStats();
+
+// For the benchmarks, which run the cache without a GL context: heap
+// buffers stand in for the PBOs and nothing is uploaded.
+
+void ResetTextureCacheStats();
+
+// Runs the decode workers over every entry waiting for its buffer, into heap
+// buffers, and returns once all are decoded. The caller frees buffers.
+void DecodeWaitingTextures(std::vector<unsigned char*>& buffers);
+
+// Entries decoded and waiting for their upload, and the GPU bytes they take
+int CountDecodedTextures(size_t* bytes);
+
+// Every entry as PlanResidency sees it once its first load has landed;
+// free slots are busy
+void DescribeTextureCache(std::vector<TextureResidency>& textures);
+
+#endif
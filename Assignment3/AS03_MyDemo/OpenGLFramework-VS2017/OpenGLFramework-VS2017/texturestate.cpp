@@ -0,0 +1,64 @@
+#include "texturestate.h"
+
+TextureStateCache texture_state;
+
+void ActiveTextureUnit(int unit)
+{
+	if (texture_state.enabled && texture_state.active_unit == unit)
+	{
+		texture_state.skipped++;
+		return;
+	}
+	glActiveTexture(GL_TEXTURE0 + unit);
+	texture_state.active_unit = unit;
+	texture_state.issued++;
+}
+
+void BindTexture2D(int unit, GLuint texture)
+{
+	if (texture_state.enabled && texture_state.textures[unit] == texture)
+	{
+		texture_state.skipped++;
+		return;
+	}
+	ActiveTextureUnit(unit);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	texture_state.textures[unit] = texture;
+	texture_state.issued++;
+}
+
+void BindTextureArray(int unit, GLuint texture)
+{
+	if (texture_state.enabled && texture_state.arrays[unit] == texture)
+	{
+		texture_state.skipped++;
+		return;
+	}
+	ActiveTextureUnit(unit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	texture_state.arrays[unit] = texture;
+	texture_state.issued++;
+}
+
+void BindSampler(int unit, GLuint sampler)
+{
+	if (texture_state.enabled && texture_state.samplers[unit] == sampler)
+	{
+		texture_state.skipped++;
+		return;
+	}
+	glBindSampler(unit, sampler);
+	texture_state.samplers[unit] = sampler;
+	texture_state.issued++;
+}
+
+void ForgetTexture(GLuint texture)
+{
+	for (int i = 0; i < kTextureUnits; i++)
+	{
+		if (texture_state.textures[i] == texture)
+			texture_state.textures[i] = 0;
+		if (texture_state.arrays[i] == texture)
+			texture_state.arrays[i] = 0;
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef TEXTURESTATE_H
+#define TEXTURESTATE_H
+
+#include <glad/glad.h>
+
+// Texture unit state as the context has it, so binds that would change
+// nothing are skipped. Every bind of a texture unit on the render thread
+// goes through here, and glDeleteTextures, which unbinds behind its back,
+// is followed by ForgetTexture. Starts at the state of a new context.
+const int kTextureUnits = 4;
+
+struct TextureStateCache
+{
+	bool enabled = true; // false with --no-samplers: every call is issued
+	int active_unit = 0;
+	GLuint textures[kTextureUnits] = {}; // GL_TEXTURE_2D of each unit
+	GLuint arrays[kTextureUnits] = {}; // GL_TEXTURE_2D_ARRAY of each unit
+	GLuint samplers[kTextureUnits] = {};
+	// since the last frame started
+	int issued = 0;
+	int skipped = 0;
+};
+extern TextureStateCache texture_state;
+
+void ActiveTextureUnit(int unit);
+void BindTexture2D(int unit, GLuint texture);
+void BindTextureArray(int unit, GLuint texture);
+void BindSampler(int unit, GLuint sampler);
+
+// After glDeleteTextures(texture): GL bound 0 wherever it was
+void ForgetTexture(GLuint texture);
+
+#endif